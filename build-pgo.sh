@@ -0,0 +1,44 @@
+#!/bin/sh
+# Builds the native library and test with profile guided and link time
+# optimization.  The instrumented build is trained on every fixture in
+# test/fixtures, then rebuilt using the profile.  A plain build with the
+# same compiler is benchmarked alongside it and the decode MP/s of both
+# builds are printed side by side.
+#
+# CC and CXX select the compiler (default clang and clang++, GCC works as
+# well) and LLVM_PROFDATA the tool merging clang profiles (default
+# llvm-profdata, e.g. LLVM_PROFDATA=llvm-profdata-17).
+set -e
+CC=${CC:-clang}
+CXX=${CXX:-clang++}
+LLVM_PROFDATA=${LLVM_PROFDATA:-llvm-profdata}
+export CC CXX
+
+mkdir -p build-pgo build-pgo-baseline
+rm -rf build-pgo/pgo-profile
+(cd build-pgo && cmake -DOPENJPHJS_PGO=GENERATE -DOPENJPHJS_LTO=ON ..)
+(cd build-pgo && make -j 8)
+(build-pgo/test/cpp/cpptest 1 train)
+# clang writes raw profiles that need merging, GCC reads its .gcda files directly
+if "$CXX" --version | grep -q clang; then
+  ("$LLVM_PROFDATA" merge -output=build-pgo/pgo-profile/default.profdata build-pgo/pgo-profile/*.profraw)
+fi
+(cd build-pgo && cmake -DOPENJPHJS_PGO=USE ..)
+(cd build-pgo && make -j 8)
+(cd build-pgo-baseline && cmake -DOPENJPHJS_PGO=OFF -DOPENJPHJS_LTO=OFF ..)
+(cd build-pgo-baseline && make -j 8)
+
+# prints the benchmark and writes "<fixture> <MP/s>" per decode to $2
+benchmark() {
+  "$1" 20 | tee "$2.log"
+  sed -n 's/^Native-decode \([^ ]*\) .*(\([0-9.]*\) MP\/s.*/\1 \2/p' "$2.log" > "$2"
+}
+echo "--- baseline (build-pgo-baseline)"
+benchmark build-pgo-baseline/test/cpp/cpptest build-pgo/baseline-mps.txt
+echo "--- PGO + LTO (build-pgo)"
+benchmark build-pgo/test/cpp/cpptest build-pgo/pgo-mps.txt
+echo "--- decode MP/s with $CXX"
+awk 'NR == FNR { base[$1] = $2; next }
+     FNR == 1 { printf "%-36s %10s %10s %8s\n", "fixture", "baseline", "pgo+lto", "gain" }
+     { printf "%-36s %10.2f %10.2f %+7.1f%%\n", $1, base[$1], $2, (base[$1] > 0 ? ($2 / base[$1] - 1) * 100 : 0) }' \
+  build-pgo/baseline-mps.txt build-pgo/pgo-mps.txt
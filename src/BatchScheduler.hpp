@@ -0,0 +1,288 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+#include "FrameInfo.hpp"
+#include "HTJ2KDecoder.hpp"
+#include "HTJ2KEncoder.hpp"
+#include "ThreadPool.hpp"
+
+/// <summary>
+/// How BatchScheduler spreads a batch over the threads
+/// </summary>
+enum class Parallelism : uint32_t {
+    /// <summary>
+    /// chosen per batch from the cost model, the default
+    /// </summary>
+    Auto = 0,
+
+    /// <summary>
+    /// every job on one thread, jobs run concurrently
+    /// </summary>
+    Frame = 1,
+
+    /// <summary>
+    /// one job at a time, each split into tiles or components on all
+    /// threads (see HTJ2KDecoder::setThreadPool())
+    /// </summary>
+    Intra = 2
+};
+
+/// <summary>
+/// A codestream to decode.  data must stay valid until decode() returns.
+/// </summary>
+struct DecodeJob {
+    const uint8_t *data {nullptr};
+    size_t size {0};
+    size_t decompositionLevel {0};
+
+    /// <summary>
+    /// results, the pixels as HTJ2KDecoder::getDecodedBytes()
+    /// </summary>
+    FrameInfo frameInfo;
+    std::vector<uint8_t> decoded;
+};
+
+/// <summary>
+/// A frame to encode.  pixels must stay valid until encode() returns.
+/// configure is called on the encoder before encoding to set the tile
+/// size, progression order and so on.
+/// </summary>
+struct EncodeJob {
+    FrameInfo frameInfo;
+    const uint8_t *pixels {nullptr};
+    std::function<void(HTJ2KEncoder &)> configure;
+
+    /// <summary>
+    /// result
+    /// </summary>
+    std::vector<uint8_t> encoded;
+};
+
+/// <summary>
+/// The split BatchScheduler chose for the last batch
+/// </summary>
+struct BatchPlan {
+    /// <summary>
+    /// jobs run first, one at a time on all threads, largest first.  The
+    /// other jobs then run concurrently, one per thread.
+    /// </summary>
+    std::vector<size_t> intraJobs;
+
+    /// <summary>
+    /// estimated cost of the plan and of running every job frame or intra
+    /// parallel, in samples per thread
+    /// </summary>
+    double estimatedCost {0};
+    double frameCost {0};
+    double intraCost {0};
+};
+
+/// <summary>
+/// Decodes or encodes batches of frames on a ThreadPool, choosing for each
+/// batch whether jobs run concurrently one per thread (best for many small
+/// frames such as CT series), one at a time split into tiles or
+/// components across the threads (large tiled frames), or the large jobs
+/// split and the rest concurrently.  The cost model counts samples: a job
+/// costs width * height * components at its decomposition level, divided
+/// over min(threads, tasks) when split, plus a fixed overhead per task for
+/// cutting out the tiles.  Concurrent jobs finish after the larger of the
+/// largest job and the total divided by the threads.  Native builds only.
+/// </summary>
+class BatchScheduler
+{
+public:
+  /// <summary>
+  /// Runs the batches on pool, which must outlive the scheduler.  The
+  /// calling thread works too, so the threads are the pool's plus one.
+  /// </summary>
+  explicit BatchScheduler(ThreadPool &pool)
+  : pool_(pool)
+  {
+  }
+
+  /// <summary>
+  /// Forces a strategy instead of the cost model, for comparisons
+  /// </summary>
+  void setParallelism(Parallelism parallelism)
+  {
+    parallelism_ = parallelism;
+  }
+
+  /// <summary>
+  /// Sets the cost of each task of a split job in samples, which covers
+  /// cutting the tile out of the codestream and the per codestream setup
+  /// of OpenJPH.  The default of 16384 is an estimate, not a measurement;
+  /// schedulerbench measures the value for the machine it runs on
+  /// </summary>
+  void setTaskOverhead(double samples)
+  {
+    taskOverhead_ = samples;
+  }
+
+  /// <summary>
+  /// Decodes every job, filling its frameInfo and decoded pixels.  If a
+  /// job throws the jobs not started yet are skipped and the first
+  /// exception is rethrown.
+  /// </summary>
+  void decode(std::vector<DecodeJob> &jobs)
+  {
+    std::vector<double> work(jobs.size());
+    std::vector<size_t> tasks(jobs.size());
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+      HTJ2KDecoder decoder;
+      decoder.setEncodedBytes(jobs[i].data, jobs[i].size);
+      decoder.readHeader();
+      const FrameInfo &frameInfo = decoder.getFrameInfo();
+      const Size size = decoder.calculateSizeAtDecompositionLevel((int)jobs[i].decompositionLevel);
+      work[i] = (double)size.width * size.height * frameInfo.componentCount;
+      tasks[i] = decoder.getParallelTaskCount();
+    }
+    run_(work, tasks, [&](size_t i, ThreadPool *pool) {
+      DecodeJob &job = jobs[i];
+      HTJ2KDecoder decoder;
+      decoder.setThreadPool(pool);
+      decoder.setEncodedBytes(job.data, job.size);
+      decoder.setDecodedBytes(&job.decoded);
+      decoder.decodeSubResolution(job.decompositionLevel);
+      job.frameInfo = decoder.getFrameInfo();
+    });
+  }
+
+  /// <summary>
+  /// Encodes every job into its encoded bytes.  If a job throws the jobs
+  /// not started yet are skipped and the first exception is rethrown.
+  /// </summary>
+  void encode(std::vector<EncodeJob> &jobs)
+  {
+    std::vector<double> work(jobs.size());
+    std::vector<size_t> tasks(jobs.size());
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+      HTJ2KEncoder encoder;
+      configure_(encoder, jobs[i]);
+      work[i] = (double)jobs[i].frameInfo.width * jobs[i].frameInfo.height * jobs[i].frameInfo.componentCount;
+      tasks[i] = encoder.getParallelTaskCount();
+    }
+    run_(work, tasks, [&](size_t i, ThreadPool *pool) {
+      EncodeJob &job = jobs[i];
+      HTJ2KEncoder encoder;
+      std::vector<uint8_t> &pixels = configure_(encoder, job);
+      pixels.assign(job.pixels, job.pixels + getFrameBytes_(job.frameInfo));
+      encoder.setThreadPool(pool);
+      encoder.encode();
+      job.encoded = encoder.getEncodedBytes();
+    });
+  }
+
+  /// <summary>
+  /// returns the plan of the last batch
+  /// </summary>
+  const BatchPlan &getLastPlan() const
+  {
+    return plan_;
+  }
+
+  /// <summary>
+  /// Computes the plan for jobs of the given work (samples) and task
+  /// counts (see getParallelTaskCount()) on threads threads
+  /// </summary>
+  BatchPlan plan(const std::vector<double> &work, const std::vector<size_t> &tasks, size_t threads) const
+  {
+    // the largest jobs are the ones worth splitting, try splitting the k
+    // largest for every k and keep the cheapest
+    std::vector<size_t> order(work.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return work[a] > work[b]; });
+    std::vector<double> remaining(order.size() + 1, 0);
+    for (size_t k = order.size(); k-- > 0;)
+    {
+      remaining[k] = remaining[k + 1] + work[order[k]];
+    }
+
+    BatchPlan result;
+    size_t best = 0;
+    double intraCost = 0;
+    for (size_t k = 0; k <= order.size(); k++)
+    {
+      const double frameCost = k < order.size() ? std::max(work[order[k]], remaining[k] / threads) : 0;
+      const double cost = intraCost + frameCost;
+      if (k == 0)
+      {
+        result.frameCost = cost;
+      }
+      if (k == order.size())
+      {
+        result.intraCost = cost;
+      }
+      const bool allowed = parallelism_ == Parallelism::Auto ||
+                           (parallelism_ == Parallelism::Frame && k == 0) ||
+                           (parallelism_ == Parallelism::Intra && k == order.size());
+      if (allowed && (k == 0 || parallelism_ != Parallelism::Auto || cost < result.estimatedCost))
+      {
+        result.estimatedCost = cost;
+        best = k;
+      }
+      if (k < order.size())
+      {
+        const double split = (double)std::max<size_t>(1, std::min(threads, tasks[order[k]]));
+        intraCost += (work[order[k]] + (tasks[order[k]] > 1 ? taskOverhead_ * tasks[order[k]] : 0)) / split;
+      }
+    }
+    result.intraJobs.assign(order.begin(), order.begin() + best);
+    return result;
+  }
+
+private:
+  // Runs the intra jobs of the plan one at a time with the pool, then the
+  // others concurrently without it
+  void run_(const std::vector<double> &work, const std::vector<size_t> &tasks, const std::function<void(size_t, ThreadPool *)> &job)
+  {
+    plan_ = plan(work, tasks, pool_.getThreadCount() + 1);
+    std::vector<bool> isIntra(work.size(), false);
+    for (size_t i : plan_.intraJobs)
+    {
+      isIntra[i] = true;
+      job(i, &pool_);
+    }
+    std::vector<size_t> others;
+    for (size_t i = 0; i < work.size(); i++)
+    {
+      if (!isIntra[i])
+      {
+        others.push_back(i);
+      }
+    }
+    // largest first so a big job does not start last
+    std::stable_sort(others.begin(), others.end(), [&](size_t a, size_t b) { return work[a] > work[b]; });
+    pool_.parallelFor(others.size(), [&](size_t i) { job(others[i], nullptr); });
+  }
+
+  static std::vector<uint8_t> &configure_(HTJ2KEncoder &encoder, const EncodeJob &job)
+  {
+    std::vector<uint8_t> &pixels = encoder.getDecodedBytes(job.frameInfo);
+    if (job.configure)
+    {
+      job.configure(encoder);
+    }
+    return pixels;
+  }
+
+  static size_t getFrameBytes_(const FrameInfo &frameInfo)
+  {
+    return (size_t)frameInfo.width * frameInfo.height * frameInfo.componentCount * ((frameInfo.bitsPerSample + 8 - 1) / 8);
+  }
+
+  ThreadPool &pool_;
+  Parallelism parallelism_ = Parallelism::Auto;
+  double taskOverhead_ = 1 << 14;
+  BatchPlan plan_;
+};
@@ -0,0 +1,718 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "Point.hpp"
+#include "Rect.hpp"
+#include "Size.hpp"
+
+/// <summary>
+/// Location of one tile-part in a codestream
+/// </summary>
+struct TilePart {
+    /// <summary>
+    /// Tile index (Isot) and tile-part index (TPsot)
+    /// </summary>
+    uint32_t tileIndex {0};
+    uint32_t partIndex {0};
+
+    /// <summary>
+    /// Offset of the SOT marker and length of the tile-part including its
+    /// header, in bytes
+    /// </summary>
+    uint64_t offset {0};
+    uint64_t length {0};
+};
+
+/// <summary>
+/// Main header fields of a codestream, the values HTJ2KDecoder::readHeader()
+/// gets from OpenJPH read straight from the SIZ and COD marker segments.
+/// The image size is not limited to the 16 bit FrameInfo range.
+/// </summary>
+struct CodestreamHeader {
+    Size imageSize;
+    uint32_t componentCount {0};
+    uint32_t bitsPerSample {0};
+    bool isSigned {false};
+    bool isUsingColorTransform {false};
+    std::vector<Point> downSamples;
+    Point imageOffset;
+    Size tileSize;
+    Point tileOffset;
+    uint32_t numDecompositions {0};
+    bool isReversible {false};
+    uint32_t progressionOrder {0};
+    Size blockDimensions;
+
+    /// <summary>
+    /// precinct size per resolution, lowest resolution first
+    /// (numDecompositions + 1 entries)
+    /// </summary>
+    std::vector<Size> precincts;
+    uint32_t numLayers {0};
+};
+
+/// <summary>
+/// Marker level index of a HTJ2K/J2K codestream.  Reads the SIZ and COD
+/// marker segments and locates every tile-part, from the TLM marker segments
+/// when present (so the tile data is never touched) or by walking the SOT
+/// markers otherwise.  The index can cut a single tile out of the codestream
+/// as a standalone codestream, which lets HTJ2KDecoder decode one tile
+/// without reading the others.
+/// </summary>
+class CodestreamIndex
+{
+public:
+  /// <summary>
+  /// Indexes the codestream in data.  The bytes are not retained, pass the
+  /// same bytes to extractTile().  Throws std::runtime_error if the
+  /// codestream is malformed.
+  /// </summary>
+  void parse(const uint8_t *data, size_t size)
+  {
+    *this = CodestreamIndex();
+    if (size < 4 || read16_(data) != SOC || read16_(data + 2) != SIZ)
+    {
+      throw std::runtime_error("CodestreamIndex: missing SOC/SIZ marker");
+    }
+    parseMainHeader_(data, size);
+    tiles_.resize(getTileCount());
+    if (!tlm_.empty() && indexFromTLM_(data, size))
+    {
+      usedTLM_ = true;
+      return;
+    }
+    for (auto &parts : tiles_)
+    {
+      parts.clear();
+    }
+    hasPlainTileParts_ = true;
+    indexFromSOT_(data, size);
+  }
+
+  /// <summary>
+  /// Reads only the main header of the codestream in data, the tile-parts
+  /// are not located so getTileParts() is not available.  This is the
+  /// cheapest way to get getHeader() for many files.  Throws
+  /// std::runtime_error if the main header is malformed.
+  /// </summary>
+  void parseHeader(const uint8_t *data, size_t size)
+  {
+    *this = CodestreamIndex();
+    if (size < 4 || read16_(data) != SOC || read16_(data + 2) != SIZ)
+    {
+      throw std::runtime_error("CodestreamIndex: missing SOC/SIZ marker");
+    }
+    parseMainHeader_(data, size);
+  }
+
+  /// <summary>
+  /// returns the main header fields
+  /// </summary>
+  CodestreamHeader getHeader() const
+  {
+    CodestreamHeader header;
+    header.imageSize = getImageSize();
+    header.componentCount = componentCount_;
+    header.bitsPerSample = bitsPerSample_;
+    header.isSigned = isSigned_;
+    header.isUsingColorTransform = isUsingColorTransform_;
+    header.downSamples = downSamples_;
+    header.imageOffset = imageOffset_;
+    header.tileSize = tileSize_;
+    header.tileOffset = tileOffset_;
+    header.numDecompositions = numDecompositions_;
+    header.isReversible = isReversible_;
+    header.progressionOrder = progressionOrder_;
+    header.blockDimensions = blockDimensions_;
+    header.precincts = precincts_;
+    header.numLayers = numLayers_;
+    return header;
+  }
+
+  /// <summary>
+  /// returns the image width and height on the reference grid
+  /// </summary>
+  Size getImageSize() const
+  {
+    return Size(imageExtent_.x - imageOffset_.x, imageExtent_.y - imageOffset_.y);
+  }
+
+  /// <summary>
+  /// returns the image offset
+  /// </summary>
+  Point getImageOffset() const
+  {
+    return imageOffset_;
+  }
+
+  /// <summary>
+  /// returns the tile size
+  /// </summary>
+  Size getTileSize() const
+  {
+    return tileSize_;
+  }
+
+  /// <summary>
+  /// returns the tile offset
+  /// </summary>
+  Point getTileOffset() const
+  {
+    return tileOffset_;
+  }
+
+  /// <summary>
+  /// returns the number of components
+  /// </summary>
+  uint32_t getComponentCount() const
+  {
+    return componentCount_;
+  }
+
+  /// <summary>
+  /// returns the number of wavelet decompositions from the COD marker
+  /// </summary>
+  uint32_t getNumDecompositions() const
+  {
+    return numDecompositions_;
+  }
+
+  /// <summary>
+  /// returns the number of tile columns and rows
+  /// </summary>
+  uint32_t getTilesX() const
+  {
+    return (uint32_t)(((uint64_t)imageExtent_.x - tileOffset_.x + tileSize_.width - 1) / tileSize_.width);
+  }
+
+  uint32_t getTilesY() const
+  {
+    return (uint32_t)(((uint64_t)imageExtent_.y - tileOffset_.y + tileSize_.height - 1) / tileSize_.height);
+  }
+
+  uint32_t getTileCount() const
+  {
+    return getTilesX() * getTilesY();
+  }
+
+  /// <summary>
+  /// returns true if the codestream has TLM marker segments
+  /// </summary>
+  bool hasTLM() const
+  {
+    return !tlm_.empty();
+  }
+
+  /// <summary>
+  /// returns true if the codestream has PPM marker segments, its tiles
+  /// cannot be extracted
+  /// </summary>
+  bool hasPPM() const
+  {
+    return hasPPM_;
+  }
+
+  /// <summary>
+  /// returns true if tile-part c of every tile holds the packets of
+  /// component c and nothing else, as written in CPRL order with tile-part
+  /// divisions at components.  Requires more than one component, all with
+  /// the same sample format, no color transform and no marker segments
+  /// that refer to components or other tiles (COC, QCC, RGN, POC, PPM).
+  /// extractTileComponent() can then cut out single components.
+  /// </summary>
+  bool hasComponentTileParts() const
+  {
+    if (componentCount_ < 2 || progressionOrder_ != CPRL || isUsingColorTransform_ || hasPPM_ ||
+        hasComponentMarkers_ || !hasUniformComponents_ || !hasPlainTileParts_)
+    {
+      return false;
+    }
+    for (const std::vector<TilePart> &parts : tiles_)
+    {
+      if (parts.size() != componentCount_)
+      {
+        return false;
+      }
+      for (uint32_t c = 0; c < componentCount_; c++)
+      {
+        if (parts[c].partIndex != c)
+        {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  /// <summary>
+  /// returns true if the tile-parts were located from the TLM marker
+  /// segments, false if the SOT markers had to be walked
+  /// </summary>
+  bool isIndexedFromTLM() const
+  {
+    return usedTLM_;
+  }
+
+  /// <summary>
+  /// returns the length of the main header (the offset of the first SOT)
+  /// </summary>
+  uint64_t getMainHeaderLength() const
+  {
+    return mainHeaderLength_;
+  }
+
+  /// <summary>
+  /// returns the tile-parts of a tile in codestream order
+  /// </summary>
+  const std::vector<TilePart> &getTileParts(uint32_t tileIndex) const
+  {
+    return tiles_.at(tileIndex);
+  }
+
+  /// <summary>
+  /// Returns the size of the image at a decomposition level, this is
+  /// what decodeSubResolution(decompositionLevel) produces
+  /// </summary>
+  Size getSizeAtDecompositionLevel(uint32_t decompositionLevel) const
+  {
+    return Size(scale_(imageExtent_.x, decompositionLevel) - scale_(imageOffset_.x, decompositionLevel),
+                scale_(imageExtent_.y, decompositionLevel) - scale_(imageOffset_.y, decompositionLevel));
+  }
+
+  /// <summary>
+  /// Returns the area a tile covers in the image decoded at a
+  /// decomposition level, relative to the image origin
+  /// </summary>
+  Rect getTileRect(uint32_t tileIndex, uint32_t decompositionLevel) const
+  {
+    const Rect tile = getTileBounds_(tileIndex);
+    const uint32_t x0 = scale_(tile.x, decompositionLevel);
+    const uint32_t y0 = scale_(tile.y, decompositionLevel);
+    return Rect(x0 - scale_(imageOffset_.x, decompositionLevel),
+                y0 - scale_(imageOffset_.y, decompositionLevel),
+                scale_(tile.x + tile.width, decompositionLevel) - x0,
+                scale_(tile.y + tile.height, decompositionLevel) - y0);
+  }
+
+  /// <summary>
+  /// Returns the indices of the tiles intersecting rect, which is in the
+  /// coordinates of the image decoded at decompositionLevel
+  /// </summary>
+  std::vector<uint32_t> getTilesInRect(const Rect &rect, uint32_t decompositionLevel) const
+  {
+    std::vector<uint32_t> result;
+    const uint32_t tilesX = getTilesX();
+    const uint32_t tilesY = getTilesY();
+    std::vector<uint32_t> columns;
+    for (uint32_t x = 0; x < tilesX; x++)
+    {
+      const Rect tile = getTileRect(x, decompositionLevel);
+      if (tile.x < rect.x + rect.width && rect.x < tile.x + tile.width)
+      {
+        columns.push_back(x);
+      }
+    }
+    for (uint32_t y = 0; y < tilesY; y++)
+    {
+      const Rect tile = getTileRect(y * tilesX, decompositionLevel);
+      if (tile.y < rect.y + rect.height && rect.y < tile.y + tile.height)
+      {
+        for (uint32_t x : columns)
+        {
+          result.push_back(y * tilesX + x);
+        }
+      }
+    }
+    return result;
+  }
+
+  /// <summary>
+  /// Copies one tile out of the indexed codestream as a standalone
+  /// codestream.  The SIZ marker is rewritten so the image area is exactly
+  /// the tile, keeping its position on the reference grid so the codeblock
+  /// and precinct partitions (and therefore the packets) are unchanged.
+  /// TLM and PLM marker segments are dropped since they describe the whole
+  /// codestream.  Codestreams with PPM marker segments are rejected because
+  /// their packet headers cannot be separated per tile.
+  /// </summary>
+  void extractTile(const uint8_t *data, size_t size, uint32_t tileIndex, std::vector<uint8_t> &out) const
+  {
+    extract_(data, size, tileIndex, AllComponents, out);
+  }
+
+  /// <summary>
+  /// Copies one component of one tile out of the indexed codestream as a
+  /// standalone single component codestream, like extractTile() but with
+  /// SIZ reduced to the component and only its tile-part kept.  Throws
+  /// std::runtime_error unless hasComponentTileParts() is true.
+  /// </summary>
+  void extractTileComponent(const uint8_t *data, size_t size, uint32_t tileIndex, uint32_t component, std::vector<uint8_t> &out) const
+  {
+    if (!hasComponentTileParts() || component >= componentCount_)
+    {
+      throw std::runtime_error("CodestreamIndex: components cannot be extracted from this codestream");
+    }
+    extract_(data, size, tileIndex, component, out);
+  }
+
+private:
+  enum Marker : uint16_t
+  {
+    SOC = 0xFF4F,
+    SIZ = 0xFF51,
+    COD = 0xFF52,
+    COC = 0xFF53,
+    TLM = 0xFF55,
+    PLM = 0xFF57,
+    QCC = 0xFF5D,
+    RGN = 0xFF5E,
+    POC = 0xFF5F,
+    PPM = 0xFF60,
+    SOT = 0xFF90,
+    SOD = 0xFF93,
+    EOC = 0xFFD9
+  };
+
+  static const uint32_t AllComponents = 0xFFFFFFFF;
+
+  // progression order value of CPRL in COD
+  static const uint32_t CPRL = 4;
+
+  struct TLMSegment
+  {
+    uint8_t index;
+    uint64_t offset;
+    uint64_t length;
+  };
+
+  // extractTile() for one component or AllComponents
+  void extract_(const uint8_t *data, size_t size, uint32_t tileIndex, uint32_t component, std::vector<uint8_t> &out) const
+  {
+    if (size < mainHeaderLength_)
+    {
+      throw std::runtime_error("CodestreamIndex: codestream does not match the index");
+    }
+    if (hasPPM_)
+    {
+      throw std::runtime_error("CodestreamIndex: tiles cannot be extracted from codestreams with PPM markers");
+    }
+    const std::vector<TilePart> &allParts = getTileParts(tileIndex);
+    const std::vector<TilePart> parts = component == AllComponents ? allParts : std::vector<TilePart>(1, allParts.at(component));
+    uint64_t length = mainHeaderLength_ + 2;
+    for (const TilePart &part : parts)
+    {
+      length += part.length;
+    }
+    out.clear();
+    out.reserve(length);
+    out.insert(out.end(), data, data + 2);
+
+    // main header without the codestream wide index segments
+    uint64_t p = 2;
+    while (p < mainHeaderLength_)
+    {
+      const uint16_t marker = read16_(data + p);
+      const uint64_t segmentLength = 2 + read16_(data + p + 2);
+      if (marker != TLM && marker != PLM)
+      {
+        const size_t start = out.size();
+        if (marker == SIZ && component != AllComponents)
+        {
+          // Csiz of 1 followed by the Ssiz, XRsiz and YRsiz of the component
+          out.insert(out.end(), data + p, data + p + 40);
+          out.insert(out.end(), data + p + 40 + 3 * component, data + p + 43 + 3 * component);
+          write16_(&out[start + 2], 41);
+          write16_(&out[start + 38], 1);
+        }
+        else
+        {
+          out.insert(out.end(), data + p, data + p + segmentLength);
+        }
+        if (marker == SIZ)
+        {
+          const uint32_t column = tileIndex % getTilesX();
+          const uint32_t row = tileIndex / getTilesX();
+          const Rect tile = getTileBounds_(tileIndex);
+          write32_(&out[start + 6], tile.x + tile.width);
+          write32_(&out[start + 10], tile.y + tile.height);
+          write32_(&out[start + 14], tile.x);
+          write32_(&out[start + 18], tile.y);
+          write32_(&out[start + 30], tileOffset_.x + column * tileSize_.width);
+          write32_(&out[start + 34], tileOffset_.y + row * tileSize_.height);
+        }
+      }
+      p += segmentLength;
+    }
+
+    // the tile-parts, renumbered as tile 0 of a single tile image
+    for (const TilePart &part : parts)
+    {
+      const size_t start = out.size();
+      out.insert(out.end(), data + part.offset, data + part.offset + part.length);
+      write16_(&out[start + 4], 0);
+      write32_(&out[start + 6], (uint32_t)part.length);
+      if (component != AllComponents)
+      {
+        out[start + 10] = 0;
+        out[start + 11] = 1;
+      }
+    }
+    out.push_back(0xFF);
+    out.push_back(0xD9);
+  }
+
+  void parseMainHeader_(const uint8_t *data, size_t size)
+  {
+    uint64_t p = 2;
+    bool hasCOD = false;
+    while (true)
+    {
+      if (p + 4 > size)
+      {
+        throw std::runtime_error("CodestreamIndex: main header is truncated");
+      }
+      const uint16_t marker = read16_(data + p);
+      if (marker == SOT)
+      {
+        break;
+      }
+      const uint64_t segmentLength = read16_(data + p + 2);
+      if ((marker & 0xFF00) != 0xFF00 || segmentLength < 2 || p + 2 + segmentLength > size)
+      {
+        throw std::runtime_error("CodestreamIndex: invalid marker segment at offset " + std::to_string(p));
+      }
+      const uint8_t *segment = data + p + 4;
+      if (marker == SIZ)
+      {
+        parseSIZ_(segment, segmentLength);
+      }
+      else if (marker == COD && segmentLength >= 12)
+      {
+        parseCOD_(segment, segmentLength);
+        hasCOD = true;
+      }
+      else if (marker == TLM && segmentLength >= 4)
+      {
+        tlm_.push_back({segment[0], p + 6, segmentLength - 4});
+      }
+      else if (marker == PPM)
+      {
+        hasPPM_ = true;
+      }
+      else if (marker == COC || marker == QCC || marker == RGN || marker == POC)
+      {
+        hasComponentMarkers_ = true;
+      }
+      p += 2 + segmentLength;
+    }
+    if (!hasCOD)
+    {
+      throw std::runtime_error("CodestreamIndex: missing COD marker");
+    }
+    mainHeaderLength_ = p;
+    std::stable_sort(tlm_.begin(), tlm_.end(), [](const TLMSegment &a, const TLMSegment &b) { return a.index < b.index; });
+  }
+
+  void parseSIZ_(const uint8_t *segment, uint64_t segmentLength)
+  {
+    if (segmentLength < 41)
+    {
+      throw std::runtime_error("CodestreamIndex: SIZ marker is truncated");
+    }
+    imageExtent_ = Point(read32_(segment + 2), read32_(segment + 6));
+    imageOffset_ = Point(read32_(segment + 10), read32_(segment + 14));
+    tileSize_ = Size(read32_(segment + 18), read32_(segment + 22));
+    tileOffset_ = Point(read32_(segment + 26), read32_(segment + 30));
+    componentCount_ = read16_(segment + 34);
+    if (imageExtent_.x <= imageOffset_.x || imageExtent_.y <= imageOffset_.y ||
+        tileSize_.width == 0 || tileSize_.height == 0 ||
+        tileOffset_.x > imageOffset_.x || tileOffset_.y > imageOffset_.y ||
+        (uint64_t)tileOffset_.x + tileSize_.width <= imageOffset_.x ||
+        (uint64_t)tileOffset_.y + tileSize_.height <= imageOffset_.y ||
+        segmentLength != 38 + 3 * (uint64_t)componentCount_)
+    {
+      throw std::runtime_error("CodestreamIndex: invalid SIZ marker");
+    }
+    // the sample format of the first component, as in FrameInfo
+    bitsPerSample_ = (segment[36] & 0x7F) + 1u;
+    isSigned_ = (segment[36] & 0x80) != 0;
+    downSamples_.resize(componentCount_);
+    hasUniformComponents_ = true;
+    for (uint32_t c = 0; c < componentCount_; c++)
+    {
+      downSamples_[c] = Point(segment[37 + 3 * c], segment[38 + 3 * c]);
+      hasUniformComponents_ = hasUniformComponents_ && memcmp(segment + 36 + 3 * c, segment + 36, 3) == 0;
+    }
+  }
+
+  void parseCOD_(const uint8_t *segment, uint64_t segmentLength)
+  {
+    const bool hasPrecincts = (segment[0] & 1) != 0;
+    progressionOrder_ = segment[1];
+    numLayers_ = read16_(segment + 2);
+    isUsingColorTransform_ = segment[4] != 0;
+    numDecompositions_ = segment[5];
+    blockDimensions_ = Size(1u << std::min(segment[6] + 2, 31), 1u << std::min(segment[7] + 2, 31));
+    isReversible_ = segment[9] == 1;
+    if (numDecompositions_ > 32 || (hasPrecincts && segmentLength < 12 + numDecompositions_ + 1))
+    {
+      throw std::runtime_error("CodestreamIndex: invalid COD marker");
+    }
+    // PPx in the low and PPy in the high nibble, 2^15 when not signalled
+    precincts_.assign(numDecompositions_ + 1, Size(1u << 15, 1u << 15));
+    if (hasPrecincts)
+    {
+      for (uint32_t r = 0; r <= numDecompositions_; r++)
+      {
+        precincts_[r] = Size(1u << (segment[10 + r] & 0xF), 1u << (segment[10 + r] >> 4));
+      }
+    }
+  }
+
+  // Builds the index from the TLM tile-part lengths.  Only the SOT marker
+  // of each tile-part is read to check the TLM agrees with the codestream,
+  // returns false if it does not so the caller can walk the SOT markers
+  bool indexFromTLM_(const uint8_t *data, size_t size)
+  {
+    uint64_t p = mainHeaderLength_;
+    uint32_t sequentialTile = 0;
+    for (const TLMSegment &tlm : tlm_)
+    {
+      const uint8_t *entry = data + tlm.offset;
+      const uint32_t tileBytes = (entry[-1] >> 4) & 3;
+      const uint32_t lengthBytes = (entry[-1] & 0x40) ? 4 : 2;
+      if (tileBytes == 3)
+      {
+        return false;
+      }
+      const uint64_t entrySize = tileBytes + lengthBytes;
+      for (uint64_t e = 0; e + entrySize <= tlm.length; e += entrySize)
+      {
+        const uint32_t tileIndex = tileBytes == 0 ? sequentialTile++ : tileBytes == 1 ? entry[e] : read16_(entry + e);
+        const uint64_t length = lengthBytes == 4 ? read32_(entry + e + tileBytes) : read16_(entry + e + tileBytes);
+        if (!addTilePart_(data, size, p, length, tileIndex))
+        {
+          return false;
+        }
+        p += length;
+      }
+    }
+    return p + 2 <= size && read16_(data + p) == EOC;
+  }
+
+  void indexFromSOT_(const uint8_t *data, size_t size)
+  {
+    uint64_t p = mainHeaderLength_;
+    while (p + 12 <= size && read16_(data + p) == SOT)
+    {
+      uint64_t length = read32_(data + p + 6);
+      if (length == 0)
+      {
+        // the last tile-part may extend to the end of the codestream
+        length = size - p - (read16_(data + size - 2) == EOC ? 2 : 0);
+      }
+      if (!addTilePart_(data, size, p, length, read16_(data + p + 4)))
+      {
+        throw std::runtime_error("CodestreamIndex: invalid tile-part at offset " + std::to_string(p));
+      }
+      p += length;
+    }
+    if (p + 2 > size || read16_(data + p) != EOC)
+    {
+      throw std::runtime_error("CodestreamIndex: missing EOC marker after the tile-parts");
+    }
+  }
+
+  bool addTilePart_(const uint8_t *data, size_t size, uint64_t offset, uint64_t length, uint32_t tileIndex)
+  {
+    if (length < 14 || offset + length > size || tileIndex >= tiles_.size() ||
+        read16_(data + offset) != SOT || read16_(data + offset + 2) != 10 || read16_(data + offset + 4) != tileIndex)
+    {
+      return false;
+    }
+    // tile-part headers with marker segments (COD, COC, PPT...) before SOD
+    hasPlainTileParts_ = hasPlainTileParts_ && read16_(data + offset + 12) == SOD;
+    TilePart part;
+    part.tileIndex = tileIndex;
+    part.partIndex = data[offset + 10];
+    part.offset = offset;
+    part.length = length;
+    tiles_[tileIndex].push_back(part);
+    return true;
+  }
+
+  // tile area on the reference grid, clipped to the image area
+  Rect getTileBounds_(uint32_t tileIndex) const
+  {
+    const uint64_t column = tileIndex % getTilesX();
+    const uint64_t row = tileIndex / getTilesX();
+    const uint64_t x0 = std::max<uint64_t>(tileOffset_.x + column * tileSize_.width, imageOffset_.x);
+    const uint64_t y0 = std::max<uint64_t>(tileOffset_.y + row * tileSize_.height, imageOffset_.y);
+    const uint64_t x1 = std::min<uint64_t>(tileOffset_.x + (column + 1) * tileSize_.width, imageExtent_.x);
+    const uint64_t y1 = std::min<uint64_t>(tileOffset_.y + (row + 1) * tileSize_.height, imageExtent_.y);
+    return Rect((uint32_t)x0, (uint32_t)y0, (uint32_t)(x1 - x0), (uint32_t)(y1 - y0));
+  }
+
+  // reference grid coordinate at a decomposition level, ceil(value / 2^level)
+  static uint32_t scale_(uint64_t value, uint32_t decompositionLevel)
+  {
+    return (uint32_t)((value + ((uint64_t)1 << decompositionLevel) - 1) >> decompositionLevel);
+  }
+
+  static uint16_t read16_(const uint8_t *p)
+  {
+    return (uint16_t)((p[0] << 8) | p[1]);
+  }
+
+  static uint32_t read32_(const uint8_t *p)
+  {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+  }
+
+  static void write16_(uint8_t *p, uint16_t value)
+  {
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+  }
+
+  static void write32_(uint8_t *p, uint32_t value)
+  {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+  }
+
+  Point imageExtent_;
+  Point imageOffset_;
+  Size tileSize_;
+  Point tileOffset_;
+  uint32_t componentCount_ = 0;
+  uint32_t numDecompositions_ = 0;
+  uint32_t bitsPerSample_ = 0;
+  bool isSigned_ = false;
+  bool isUsingColorTransform_ = false;
+  std::vector<Point> downSamples_;
+  bool isReversible_ = false;
+  uint32_t progressionOrder_ = 0;
+  Size blockDimensions_;
+  std::vector<Size> precincts_;
+  uint32_t numLayers_ = 0;
+  uint64_t mainHeaderLength_ = 0;
+  bool hasPPM_ = false;
+  bool hasComponentMarkers_ = false;
+  bool hasUniformComponents_ = false;
+  bool hasPlainTileParts_ = true;
+  bool usedTLM_ = false;
+  std::vector<TLMSegment> tlm_;
+  std::vector<std::vector<TilePart>> tiles_;
+};
@@ -0,0 +1,37 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+
+/// <summary>
+/// Resource limits applied by HTJ2KDecoder when reading untrusted
+/// codestreams.  A value of 0 disables the corresponding limit.
+/// </summary>
+struct DecoderLimits {
+    /// <summary>
+    /// Maximum number of pixels (width x height) in the image
+    /// </summary>
+    uint32_t maxPixels {0};
+
+    /// <summary>
+    /// Maximum size in bytes of the decoded buffer
+    /// </summary>
+    uint32_t maxOutputBytes {0};
+
+    /// <summary>
+    /// Maximum number of tiles in the image
+    /// </summary>
+    uint32_t maxTiles {0};
+
+    /// <summary>
+    /// Maximum number of codeblocks over all tiles, components and resolutions
+    /// </summary>
+    uint32_t maxCodeblocks {0};
+
+    /// <summary>
+    /// Maximum time in milliseconds a single decode may take
+    /// </summary>
+    uint32_t maxDecodeTimeMs {0};
+};
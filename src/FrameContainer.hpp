@@ -0,0 +1,537 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdexcept>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "FrameInfo.hpp"
+#include "XXHash64.hpp"
+
+// Multi-frame container layout, all integers little endian:
+//
+//   header   "HTJ2KMF1", u32 header length, u16 version, u16 reserved,
+//            u16 width, u16 height, u8 bitsPerSample, u8 componentCount,
+//            u8 isSigned, u8 isUsingColorTransform, u32 metadata length,
+//            metadata bytes
+//   frames   the codestreams, back to back
+//   index    per frame u64 offset, u32 length
+//   trailer  u64 index offset, u32 frame count, u32 reserved,
+//            u64 XXH64 of the index, "HTJ2KEND"
+//
+// Appending overwrites the index and trailer with the new frames and writes
+// them again after the last frame.  If the writer dies before that, the
+// reader rebuilds the index by walking the SOT markers of the frames.
+
+/// <summary>
+/// Span of one frame in a FrameContainer
+/// </summary>
+struct FrameSpan {
+    FrameSpan(uint64_t offset = 0, uint32_t length = 0) : offset(offset), length(length) {}
+    uint64_t offset;
+    uint32_t length;
+};
+
+namespace FrameContainerFormat
+{
+  const char HeaderMagic[8] = {'H', 'T', 'J', '2', 'K', 'M', 'F', '1'};
+  const char TrailerMagic[8] = {'H', 'T', 'J', '2', 'K', 'E', 'N', 'D'};
+  const uint16_t Version = 1;
+  const size_t FixedHeaderLength = 28;
+  const size_t IndexEntryLength = 12;
+  const size_t TrailerLength = 32;
+
+  inline uint64_t readLittleEndian(const uint8_t *p, size_t bytes)
+  {
+    uint64_t value = 0;
+    for (size_t i = bytes; i > 0; i--)
+    {
+      value = (value << 8) | p[i - 1];
+    }
+    return value;
+  }
+
+  inline void appendLittleEndian(std::vector<uint8_t> &out, uint64_t value, size_t bytes)
+  {
+    for (size_t i = 0; i < bytes; i++)
+    {
+      out.push_back((uint8_t)(value >> (8 * i)));
+    }
+  }
+
+  inline uint64_t readBigEndian(const uint8_t *p, size_t bytes)
+  {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++)
+    {
+      value = (value << 8) | p[i];
+    }
+    return value;
+  }
+
+  // Length of the codestream starting at data found by walking the SOT
+  // markers, 0 if it is not a complete codestream
+  inline uint64_t codestreamLength(const uint8_t *data, uint64_t size)
+  {
+    if (size < 4 || data[0] != 0xFF || data[1] != 0x4F)
+    {
+      return 0;
+    }
+    uint64_t p = 2;
+    while (p + 4 <= size && !(data[p] == 0xFF && data[p + 1] == 0x90))
+    {
+      p += 2 + readBigEndian(data + p + 2, 2);
+    }
+    while (p + 12 <= size && data[p] == 0xFF && data[p + 1] == 0x90)
+    {
+      const uint64_t length = readBigEndian(data + p + 6, 4);
+      if (length < 14)
+      {
+        return 0;
+      }
+      p += length;
+    }
+    return p + 2 <= size && data[p] == 0xFF && data[p + 1] == 0xD9 ? p + 2 : 0;
+  }
+}
+
+/// <summary>
+/// Reads a multi-frame container written by FrameContainerWriter.  The file
+/// is memory mapped and getFrame() returns spans into the mapping, which
+/// can be passed to HTJ2KDecoder::setEncodedBytes(data, size) so frames are
+/// decoded without being copied or read ahead.
+/// </summary>
+class FrameContainerReader
+{
+public:
+  FrameContainerReader() = default;
+  FrameContainerReader(const FrameContainerReader &) = delete;
+  FrameContainerReader &operator=(const FrameContainerReader &) = delete;
+
+  ~FrameContainerReader()
+  {
+    close();
+  }
+
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+  /// <summary>
+  /// Memory maps and indexes a container file.  Throws std::runtime_error if
+  /// the file cannot be read or is not a container.
+  /// </summary>
+  void open(const std::string &path)
+  {
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0)
+    {
+      if (fd >= 0)
+      {
+        ::close(fd);
+      }
+      throw std::runtime_error("FrameContainer: cannot open " + path);
+    }
+    void *mapping = status.st_size ? mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+      throw std::runtime_error("FrameContainer: cannot map " + path);
+    }
+    mapping_ = mapping;
+    mappingSize_ = (size_t)status.st_size;
+    open((const uint8_t *)mapping, mappingSize_);
+  }
+#endif
+
+  /// <summary>
+  /// Indexes a container already in memory.  The bytes must stay valid
+  /// while the reader is used.
+  /// </summary>
+  void open(const uint8_t *data, size_t size)
+  {
+    using namespace FrameContainerFormat;
+    data_ = data;
+    size_ = size;
+    frames_.clear();
+    recovered_ = false;
+    if (size < FixedHeaderLength || memcmp(data, HeaderMagic, 8) != 0)
+    {
+      close();
+      throw std::runtime_error("FrameContainer: not a frame container");
+    }
+    headerLength_ = readLittleEndian(data + 8, 4);
+    const uint64_t metadataLength = readLittleEndian(data + 24, 4);
+    if (readLittleEndian(data + 12, 2) != Version || headerLength_ != FixedHeaderLength + metadataLength || headerLength_ > size)
+    {
+      close();
+      throw std::runtime_error("FrameContainer: unsupported or corrupt header");
+    }
+    frameInfo_.width = (uint16_t)readLittleEndian(data + 16, 2);
+    frameInfo_.height = (uint16_t)readLittleEndian(data + 18, 2);
+    frameInfo_.bitsPerSample = data[20];
+    frameInfo_.componentCount = data[21];
+    frameInfo_.isSigned = data[22] != 0;
+    frameInfo_.isUsingColorTransform = data[23] != 0;
+    if (!readIndex_())
+    {
+      recoverIndex_();
+    }
+  }
+
+  /// <summary>
+  /// Unmaps the file
+  /// </summary>
+  void close()
+  {
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+    if (mapping_)
+    {
+      munmap(mapping_, mappingSize_);
+    }
+#endif
+    mapping_ = nullptr;
+    mappingSize_ = 0;
+    data_ = nullptr;
+    size_ = 0;
+    frames_.clear();
+  }
+
+  /// <summary>
+  /// returns the FrameInfo shared by all frames
+  /// </summary>
+  const FrameInfo &getFrameInfo() const
+  {
+    return frameInfo_;
+  }
+
+  /// <summary>
+  /// returns the shared metadata stored in the header
+  /// </summary>
+  const uint8_t *getMetadata() const
+  {
+    return data_ + FrameContainerFormat::FixedHeaderLength;
+  }
+
+  size_t getMetadataSize() const
+  {
+    return (size_t)(headerLength_ - FrameContainerFormat::FixedHeaderLength);
+  }
+
+  /// <summary>
+  /// returns the number of frames
+  /// </summary>
+  size_t getFrameCount() const
+  {
+    return frames_.size();
+  }
+
+  /// <summary>
+  /// returns the encoded bytes of a frame, valid until close()
+  /// </summary>
+  const uint8_t *getFrame(size_t frame) const
+  {
+    return data_ + frames_.at(frame).offset;
+  }
+
+  size_t getFrameSize(size_t frame) const
+  {
+    return frames_.at(frame).length;
+  }
+
+  /// <summary>
+  /// returns the frame offsets and lengths
+  /// </summary>
+  const std::vector<FrameSpan> &getFrameSpans() const
+  {
+    return frames_;
+  }
+
+  /// <summary>
+  /// returns the offset where the next frame is written when appending,
+  /// the end of the last frame
+  /// </summary>
+  uint64_t getFramesEnd() const
+  {
+    return frames_.empty() ? headerLength_ : frames_.back().offset + frames_.back().length;
+  }
+
+  /// <summary>
+  /// returns true if the index was rebuilt from the frames because the
+  /// trailer was missing or damaged (a writer that did not finish)
+  /// </summary>
+  bool isRecovered() const
+  {
+    return recovered_;
+  }
+
+private:
+  bool readIndex_()
+  {
+    using namespace FrameContainerFormat;
+    if (size_ < headerLength_ + TrailerLength)
+    {
+      return false;
+    }
+    const uint64_t indexEnd = size_ - TrailerLength;
+    const uint8_t *trailer = data_ + indexEnd;
+    const uint64_t indexOffset = readLittleEndian(trailer, 8);
+    const uint64_t frameCount = readLittleEndian(trailer + 8, 4);
+    // bounds first, without overflow, so the index is inside the file
+    // before it is hashed
+    if (memcmp(trailer + 24, TrailerMagic, 8) != 0 || indexOffset < headerLength_ || indexOffset > indexEnd ||
+        frameCount * IndexEntryLength != indexEnd - indexOffset)
+    {
+      return false;
+    }
+    if (XXHash64::hash(data_ + indexOffset, frameCount * IndexEntryLength) != readLittleEndian(trailer + 16, 8))
+    {
+      return false;
+    }
+    frames_.resize(frameCount);
+    for (size_t i = 0; i < frameCount; i++)
+    {
+      const uint8_t *entry = data_ + indexOffset + i * IndexEntryLength;
+      frames_[i].offset = readLittleEndian(entry, 8);
+      frames_[i].length = (uint32_t)readLittleEndian(entry + 8, 4);
+      if (frames_[i].offset < headerLength_ || frames_[i].offset > indexOffset || frames_[i].length > indexOffset - frames_[i].offset)
+      {
+        frames_.clear();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void recoverIndex_()
+  {
+    recovered_ = true;
+    uint64_t p = headerLength_;
+    while (true)
+    {
+      const uint64_t length = FrameContainerFormat::codestreamLength(data_ + p, size_ - p);
+      if (length == 0 || length > UINT32_MAX)
+      {
+        break;
+      }
+      frames_.push_back(FrameSpan(p, (uint32_t)length));
+      p += length;
+    }
+  }
+
+  void *mapping_ = nullptr;
+  size_t mappingSize_ = 0;
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  uint64_t headerLength_ = 0;
+  FrameInfo frameInfo_;
+  std::vector<FrameSpan> frames_;
+  bool recovered_ = false;
+};
+
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+/// <summary>
+/// Writes a multi-frame container.  Frames are the encoded bytes from
+/// HTJ2KEncoder::getEncodedBytes(), added in order.  An existing container
+/// can be reopened with append() to add frames while acquiring.  The index
+/// is written by flush() and close(), frames added since the last flush()
+/// are recovered by the reader if the writer does not finish.
+/// </summary>
+class FrameContainerWriter
+{
+public:
+  FrameContainerWriter() = default;
+  FrameContainerWriter(const FrameContainerWriter &) = delete;
+  FrameContainerWriter &operator=(const FrameContainerWriter &) = delete;
+
+  ~FrameContainerWriter()
+  {
+    try
+    {
+      close();
+    }
+    catch (...)
+    {
+    }
+  }
+
+  /// <summary>
+  /// Creates (or truncates) a container with the FrameInfo all frames
+  /// share and optional metadata, for example a JSON document describing
+  /// the series
+  /// </summary>
+  void create(const std::string &path, const FrameInfo &frameInfo, const std::vector<uint8_t> &metadata = std::vector<uint8_t>())
+  {
+    using namespace FrameContainerFormat;
+    close();
+    file_ = fopen(path.c_str(), "wb");
+    if (!file_)
+    {
+      throw std::runtime_error("FrameContainer: cannot create " + path);
+    }
+    std::vector<uint8_t> header(HeaderMagic, HeaderMagic + 8);
+    appendLittleEndian(header, FixedHeaderLength + metadata.size(), 4);
+    appendLittleEndian(header, Version, 2);
+    appendLittleEndian(header, 0, 2);
+    appendLittleEndian(header, frameInfo.width, 2);
+    appendLittleEndian(header, frameInfo.height, 2);
+    header.push_back(frameInfo.bitsPerSample);
+    header.push_back(frameInfo.componentCount);
+    header.push_back(frameInfo.isSigned ? 1 : 0);
+    header.push_back(frameInfo.isUsingColorTransform ? 1 : 0);
+    appendLittleEndian(header, metadata.size(), 4);
+    header.insert(header.end(), metadata.begin(), metadata.end());
+    frames_.clear();
+    end_ = header.size();
+    writeBytes_(header.data(), header.size());
+    flush();
+  }
+
+  /// <summary>
+  /// Opens an existing container to add frames after the last one
+  /// </summary>
+  void append(const std::string &path)
+  {
+    close();
+    FrameContainerReader reader;
+    reader.open(path);
+    frames_ = reader.getFrameSpans();
+    const uint64_t framesEnd = reader.getFramesEnd();
+    reader.close();
+
+    file_ = fopen(path.c_str(), "r+b");
+    if (!file_ || !seek_(framesEnd))
+    {
+      close();
+      throw std::runtime_error("FrameContainer: cannot append to " + path);
+    }
+    end_ = framesEnd;
+  }
+
+  /// <summary>
+  /// Adds an encoded frame
+  /// </summary>
+  void addFrame(const uint8_t *data, size_t size)
+  {
+    if (!file_)
+    {
+      throw std::runtime_error("FrameContainer: not open");
+    }
+    if (size < 2 || data[0] != 0xFF || data[1] != 0x4F || size > UINT32_MAX)
+    {
+      throw std::runtime_error("FrameContainer: frame is not a codestream");
+    }
+    if (!seek_(end_))
+    {
+      throw std::runtime_error("FrameContainer: seek failed");
+    }
+    writeBytes_(data, size);
+    frames_.push_back(FrameSpan(end_, (uint32_t)size));
+    end_ += size;
+  }
+
+  void addFrame(const std::vector<uint8_t> &encoded)
+  {
+    addFrame(encoded.data(), encoded.size());
+  }
+
+  /// <summary>
+  /// returns the number of frames written
+  /// </summary>
+  size_t getFrameCount() const
+  {
+    return frames_.size();
+  }
+
+  /// <summary>
+  /// Writes the index and trailer after the last frame so readers see all
+  /// frames added so far.  The next frame overwrites them.
+  /// </summary>
+  void flush()
+  {
+    using namespace FrameContainerFormat;
+    if (!file_)
+    {
+      return;
+    }
+    std::vector<uint8_t> index;
+    index.reserve(frames_.size() * IndexEntryLength + TrailerLength);
+    for (const FrameSpan &frame : frames_)
+    {
+      appendLittleEndian(index, frame.offset, 8);
+      appendLittleEndian(index, frame.length, 4);
+    }
+    const uint64_t indexHash = XXHash64::hash(index.data(), index.size());
+    appendLittleEndian(index, end_, 8);
+    appendLittleEndian(index, frames_.size(), 4);
+    appendLittleEndian(index, 0, 4);
+    appendLittleEndian(index, indexHash, 8);
+    index.insert(index.end(), TrailerMagic, TrailerMagic + 8);
+    if (!seek_(end_))
+    {
+      throw std::runtime_error("FrameContainer: seek failed");
+    }
+    writeBytes_(index.data(), index.size());
+    if (fflush(file_) != 0 || ftruncate(fileno(file_), (off_t)(end_ + index.size())) != 0)
+    {
+      throw std::runtime_error("FrameContainer: write failed");
+    }
+  }
+
+  /// <summary>
+  /// Writes the index and closes the file
+  /// </summary>
+  void close()
+  {
+    if (!file_)
+    {
+      return;
+    }
+    FILE *file = file_;
+    try
+    {
+      flush();
+    }
+    catch (...)
+    {
+      fclose(file);
+      file_ = nullptr;
+      throw;
+    }
+    file_ = nullptr;
+    if (fclose(file) != 0)
+    {
+      throw std::runtime_error("FrameContainer: close failed");
+    }
+  }
+
+private:
+  void writeBytes_(const void *data, size_t size)
+  {
+    if (fwrite(data, 1, size, file_) != size)
+    {
+      throw std::runtime_error("FrameContainer: write failed");
+    }
+  }
+
+  bool seek_(uint64_t offset)
+  {
+    return fseeko(file_, (off_t)offset, SEEK_SET) == 0;
+  }
+
+  FILE *file_ = nullptr;
+  uint64_t end_ = 0;
+  std::vector<FrameSpan> frames_;
+};
+#endif
@@ -0,0 +1,532 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+// C++20 coroutine API for the native build.  Including this header from an
+// older language mode compiles to nothing, so the synchronous API and the
+// C++11 WASM build are unaffected.
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <stdio.h>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "HTJ2KDecoder.hpp"
+#include "HTJ2KEncoder.hpp"
+
+/// <summary>
+/// Awaitable decode, encode and file reads for C++20 coroutines.
+///
+/// The operations run on an executor, any object with a
+/// post(std::function<void()>) method.  ThreadPool qualifies, and other
+/// runtimes need a small adaptor, for example with asio:
+///   struct AsioExecutor {
+///     asio::any_io_executor executor;
+///     void post(std::function<void()> work) { asio::post(executor, std::move(work)); }
+///   };
+/// Work starts as soon as an operation is created.  The awaiting coroutine
+/// resumes on the executor thread that finished it, or immediately if it
+/// had already finished.  Starting the read of the next file before
+/// awaiting the decode of the current one overlaps I/O and decoding:
+///   auto next = HTJ2KAsync::readFileAsync(io, paths[i + 1]);
+///   co_await HTJ2KAsync::decodeAsync(pool, decoder);
+///   decoder.getEncodedBytes() = co_await next;
+/// The decoder or encoder passed in must stay alive, and must not be used
+/// elsewhere, until its operation has finished.
+/// </summary>
+namespace HTJ2KAsync
+{
+
+/// <summary>
+/// Thrown by an operation whose CancellationToken was cancelled
+/// </summary>
+class OperationCancelled : public std::runtime_error
+{
+public:
+  OperationCancelled() : std::runtime_error("HTJ2KAsync: operation cancelled") {}
+};
+
+/// <summary>
+/// Observes cancellation requested through a CancellationSource.  A
+/// default constructed token is never cancelled.
+/// </summary>
+class CancellationToken
+{
+public:
+  CancellationToken() = default;
+
+  bool isCancelled() const
+  {
+    return cancelled_ && cancelled_->load(std::memory_order_relaxed);
+  }
+
+  void throwIfCancelled() const
+  {
+    if (isCancelled())
+    {
+      throw OperationCancelled();
+    }
+  }
+
+  /// <summary>
+  /// returns the flag for HTJ2KDecoder/HTJ2KEncoder::setCancellationFlag(),
+  /// 0 for a token that cannot be cancelled
+  /// </summary>
+  const std::atomic<bool> *getFlag() const
+  {
+    return cancelled_.get();
+  }
+
+private:
+  friend class CancellationSource;
+  explicit CancellationToken(std::shared_ptr<std::atomic<bool>> cancelled) : cancelled_(std::move(cancelled)) {}
+
+  std::shared_ptr<std::atomic<bool>> cancelled_;
+};
+
+/// <summary>
+/// Requests cancellation of the operations given its tokens.  Operations
+/// that have not started yet are skipped, running decodes and encodes stop
+/// at the next line, and either way the await throws OperationCancelled.
+/// </summary>
+class CancellationSource
+{
+public:
+  CancellationSource() : cancelled_(std::make_shared<std::atomic<bool>>(false)) {}
+
+  CancellationToken getToken() const
+  {
+    return CancellationToken(cancelled_);
+  }
+
+  void cancel()
+  {
+    cancelled_->store(true);
+  }
+
+  bool isCancelled() const
+  {
+    return cancelled_->load();
+  }
+
+private:
+  std::shared_ptr<std::atomic<bool>> cancelled_;
+};
+
+/// <summary>
+/// The value or exception produced by an operation
+/// </summary>
+template <typename T>
+class Outcome
+{
+public:
+  template <typename Function>
+  void run(Function &function)
+  {
+    try
+    {
+      value_.emplace(function());
+    }
+    catch (...)
+    {
+      exception_ = std::current_exception();
+    }
+  }
+
+  template <typename Value>
+  void setValue(Value &&value)
+  {
+    value_.emplace(std::forward<Value>(value));
+  }
+
+  void setException(std::exception_ptr exception)
+  {
+    exception_ = exception;
+  }
+
+  T get()
+  {
+    if (exception_)
+    {
+      std::rethrow_exception(exception_);
+    }
+    return std::move(*value_);
+  }
+
+private:
+  std::optional<T> value_;
+  std::exception_ptr exception_;
+};
+
+template <>
+class Outcome<void>
+{
+public:
+  template <typename Function>
+  void run(Function &function)
+  {
+    try
+    {
+      function();
+    }
+    catch (...)
+    {
+      exception_ = std::current_exception();
+    }
+  }
+
+  void setException(std::exception_ptr exception)
+  {
+    exception_ = exception;
+  }
+
+  void get()
+  {
+    if (exception_)
+    {
+      std::rethrow_exception(exception_);
+    }
+  }
+
+private:
+  std::exception_ptr exception_;
+};
+
+/// <summary>
+/// An operation running on an executor.  co_await it once from a
+/// coroutine, or block on it with wait().
+/// </summary>
+template <typename T>
+class AsyncOperation
+{
+public:
+  struct State
+  {
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool done = false;
+    std::coroutine_handle<> continuation;
+    Outcome<T> outcome;
+  };
+
+  explicit AsyncOperation(std::shared_ptr<State> state) : state_(std::move(state)) {}
+
+  bool await_ready() const
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->done;
+  }
+
+  bool await_suspend(std::coroutine_handle<> continuation)
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    if (state_->done)
+    {
+      return false;
+    }
+    state_->continuation = continuation;
+    return true;
+  }
+
+  T await_resume()
+  {
+    return state_->outcome.get();
+  }
+
+  /// <summary>
+  /// Blocks until the operation has finished and returns its result
+  /// </summary>
+  T wait()
+  {
+    {
+      std::unique_lock<std::mutex> lock(state_->mutex);
+      state_->finished.wait(lock, [this] { return state_->done; });
+    }
+    return state_->outcome.get();
+  }
+
+private:
+  std::shared_ptr<State> state_;
+};
+
+/// <summary>
+/// Posts function to the executor and returns the awaitable operation.
+/// The function is skipped when token is cancelled before it starts.
+/// </summary>
+template <typename Executor, typename Function>
+auto runAsync(Executor &executor, CancellationToken token, Function function) -> AsyncOperation<decltype(function())>
+{
+  typedef decltype(function()) Result;
+  typedef typename AsyncOperation<Result>::State State;
+  std::shared_ptr<State> state = std::make_shared<State>();
+  executor.post([state, token, function]() mutable {
+    auto work = [&]() -> Result {
+      token.throwIfCancelled();
+      return function();
+    };
+    state->outcome.run(work);
+    std::coroutine_handle<> continuation;
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->done = true;
+      continuation = state->continuation;
+    }
+    state->finished.notify_all();
+    if (continuation)
+    {
+      continuation.resume();
+    }
+  });
+  return AsyncOperation<Result>(std::move(state));
+}
+
+/// <summary>
+/// Runs a decoder or encoder call with its cancellation flag bound to
+/// token, reporting a cancelled run as OperationCancelled
+/// </summary>
+template <typename Codec, typename Function>
+void runCancellable(Codec &codec, const CancellationToken &token, Function function)
+{
+  codec.setCancellationFlag(token.getFlag());
+  try
+  {
+    function();
+  }
+  catch (...)
+  {
+    codec.setCancellationFlag(0);
+    token.throwIfCancelled();
+    throw;
+  }
+  codec.setCancellationFlag(0);
+}
+
+/// <summary>
+/// Decodes on the executor, see HTJ2KDecoder::decode()
+/// </summary>
+template <typename Executor>
+AsyncOperation<void> decodeAsync(Executor &executor, HTJ2KDecoder &decoder, CancellationToken token = CancellationToken())
+{
+  return runAsync(executor, token, [&decoder, token] {
+    runCancellable(decoder, token, [&decoder] { decoder.decode(); });
+  });
+}
+
+/// <summary>
+/// Decodes to a decomposition level on the executor, see
+/// HTJ2KDecoder::decodeSubResolution()
+/// </summary>
+template <typename Executor>
+AsyncOperation<void> decodeSubResolutionAsync(Executor &executor, HTJ2KDecoder &decoder, size_t decompositionLevel, CancellationToken token = CancellationToken())
+{
+  return runAsync(executor, token, [&decoder, decompositionLevel, token] {
+    runCancellable(decoder, token, [&decoder, decompositionLevel] { decoder.decodeSubResolution(decompositionLevel); });
+  });
+}
+
+/// <summary>
+/// Encodes on the executor, see HTJ2KEncoder::encode()
+/// </summary>
+template <typename Executor>
+AsyncOperation<void> encodeAsync(Executor &executor, HTJ2KEncoder &encoder, CancellationToken token = CancellationToken())
+{
+  return runAsync(executor, token, [&encoder, token] {
+    runCancellable(encoder, token, [&encoder] { encoder.encode(); });
+  });
+}
+
+/// <summary>
+/// Reads a whole file on the executor, checking for cancellation between
+/// chunks.  Use a separate executor for I/O so reads do not queue behind
+/// decodes.
+/// </summary>
+template <typename Executor>
+AsyncOperation<std::vector<uint8_t>> readFileAsync(Executor &executor, std::string path, CancellationToken token = CancellationToken())
+{
+  return runAsync(executor, token, [path, token] {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+      throw std::runtime_error("HTJ2KAsync: unable to open " + path);
+    }
+    std::vector<uint8_t> bytes;
+    const size_t chunkSize = 1 << 20;
+    size_t size = 0;
+    while (true)
+    {
+      if (token.isCancelled())
+      {
+        fclose(file);
+        throw OperationCancelled();
+      }
+      bytes.resize(size + chunkSize);
+      const size_t read = fread(bytes.data() + size, 1, chunkSize, file);
+      size += read;
+      if (read < chunkSize)
+      {
+        break;
+      }
+    }
+    const bool failed = ferror(file) != 0;
+    fclose(file);
+    if (failed)
+    {
+      throw std::runtime_error("HTJ2KAsync: error reading " + path);
+    }
+    bytes.resize(size);
+    return bytes;
+  });
+}
+
+/// <summary>
+/// Minimal lazily started coroutine type for callers without an async
+/// runtime of their own.  A Task runs when awaited, or with syncWait().
+/// </summary>
+template <typename T = void>
+class Task
+{
+public:
+  struct promise_type;
+  typedef std::coroutine_handle<promise_type> Handle;
+
+  struct PromiseBase
+  {
+    struct FinalAwaiter
+    {
+      bool await_ready() const noexcept { return false; }
+      std::coroutine_handle<> await_suspend(Handle handle) noexcept
+      {
+        std::coroutine_handle<> continuation = handle.promise().continuation;
+        return continuation ? continuation : std::noop_coroutine();
+      }
+      void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { outcome.setException(std::current_exception()); }
+
+    std::coroutine_handle<> continuation;
+    Outcome<T> outcome;
+  };
+
+  template <typename Promise, typename Value>
+  struct ReturnValue : PromiseBase
+  {
+    template <typename Result>
+    void return_value(Result &&value) { this->outcome.setValue(std::forward<Result>(value)); }
+  };
+
+  template <typename Promise>
+  struct ReturnValue<Promise, void> : PromiseBase
+  {
+    void return_void() {}
+  };
+
+  struct promise_type : ReturnValue<promise_type, T>
+  {
+    Task get_return_object() { return Task(Handle::from_promise(*this)); }
+  };
+
+  Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+
+  ~Task()
+  {
+    if (handle_)
+    {
+      handle_.destroy();
+    }
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation)
+  {
+    handle_.promise().continuation = continuation;
+    return handle_;
+  }
+
+  T await_resume()
+  {
+    return handle_.promise().outcome.get();
+  }
+
+private:
+  explicit Task(Handle handle) : handle_(handle) {}
+
+  Handle handle_;
+};
+
+/// <summary>
+/// Coroutine type that starts immediately and destroys itself when done,
+/// used by syncWait()
+/// </summary>
+struct DetachedTask
+{
+  struct promise_type
+  {
+    DetachedTask get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+template <typename T>
+DetachedTask runAndSignal(Task<T> &task, Outcome<T> &outcome, std::mutex &mutex, std::condition_variable &finished, bool &done)
+{
+  try
+  {
+    if constexpr (std::is_void<T>::value)
+    {
+      co_await task;
+    }
+    else
+    {
+      outcome.setValue(co_await task);
+    }
+  }
+  catch (...)
+  {
+    outcome.setException(std::current_exception());
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  done = true;
+  finished.notify_all();
+}
+
+/// <summary>
+/// Runs task to completion, blocking the calling thread, and returns its
+/// result.  Do not call from an executor thread the task needs.
+/// </summary>
+template <typename T>
+T syncWait(Task<T> task)
+{
+  Outcome<T> outcome;
+  std::mutex mutex;
+  std::condition_variable finished;
+  bool done = false;
+  runAndSignal(task, outcome, mutex, finished, done);
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [&done] { return done; });
+  return outcome.get();
+}
+
+} // namespace HTJ2KAsync
+
+#endif
@@ -3,9 +3,15 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <exception>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 #include <limits.h>
+#include <string.h>
 
 #include <ojph_arch.h>
 #include <ojph_file.h>
@@ -15,11 +21,18 @@
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten/val.h>
+#else
+#include "CodestreamIndex.hpp"
+#include "ThreadPool.hpp"
 #endif
 
+#include "DecoderLimits.hpp"
 #include "FrameInfo.hpp"
+#include "OutputLayout.hpp"
+#include "PixelConversion.hpp"
 #include "Point.hpp"
 #include "Size.hpp"
+#include "XXHash64.hpp"
 
 /// <summary>
 /// JavaScript API for decoding HTJ2K bistreams with OpenJPH
@@ -47,6 +60,7 @@ public:
   /// </summary>
   emscripten::val getEncodedBuffer(size_t encodedSize)
   {
+    encodedSpan_ = nullptr;
     pEncoded_->resize(encodedSize);
     return emscripten::val(emscripten::typed_memory_view(pEncoded_->size(), pEncoded_->data()));
   }
@@ -66,6 +80,7 @@ public:
   /// </summary>
   std::vector<uint8_t> &getEncodedBytes()
   {
+    encodedSpan_ = nullptr;
     return *pEncoded_;
   }
 
@@ -75,6 +90,7 @@ public:
   /// </summary>
   void setEncodedBytes(std::vector<uint8_t>* pEncoded)
   {
+    encodedSpan_ = nullptr;
     if(pEncoded == 0) {
       pEncoded_ = &encodedInternal_;
     } else {
@@ -82,6 +98,18 @@ public:
     }
   }
 
+  /// <summary>
+  /// Decodes from size bytes at data without copying them, for example a
+  /// frame in a memory mapped FrameContainer.  The bytes must stay valid
+  /// until the decode returns.  Calling getEncodedBytes() or
+  /// setEncodedBytes(std::vector*) switches back to the vector.
+  /// </summary>
+  void setEncodedBytes(const uint8_t* data, size_t size)
+  {
+    encodedSpan_ = data;
+    encodedSpanSize_ = size;
+  }
+
   /// <summary>
   /// Returns the buffer to store the decoded bytes.  This method is not exported
   /// to JavaScript, it is intended to be called by C++ code
@@ -116,7 +144,7 @@ public:
   {
     ojph::codestream codestream;
     ojph::mem_infile mem_file;
-    mem_file.open(pEncoded_->data(), pEncoded_->size());
+    openEncoded_(mem_file);
     readHeader_(codestream, mem_file);
   }
 
@@ -124,17 +152,18 @@ public:
   /// Calculates the resolution for a given decomposition level based on the
   /// current values in FrameInfo (which is populated via readHeader() and
   /// decode()).  level = 0 = full res, level = _numDecompositions = lowest resolution
+  /// The image offset is taken into account since the resolutions are
+  /// computed on the reference grid, ceil(x1 / 2^level) - ceil(x0 / 2^level)
   /// </summary>
   Size calculateSizeAtDecompositionLevel(int decompositionLevel)
   {
-    Size result(frameInfo_.width, frameInfo_.height);
-    while (decompositionLevel > 0)
-    {
-      result.width = ojph_div_ceil(result.width, 2);
-      result.height = ojph_div_ceil(result.height, 2);
-      decompositionLevel--;
-    }
-    return result;
+    const uint64_t x0 = imageOffset_.x;
+    const uint64_t y0 = imageOffset_.y;
+    const uint64_t x1 = x0 + frameInfo_.width;
+    const uint64_t y1 = y0 + frameInfo_.height;
+    const uint64_t scale = (uint64_t)1 << decompositionLevel;
+    return Size((uint32_t)(ojph_div_ceil(x1, scale) - ojph_div_ceil(x0, scale)),
+                (uint32_t)(ojph_div_ceil(y1, scale) - ojph_div_ceil(y0, scale)));
   }
 
   /// <summary>
@@ -144,11 +173,7 @@ public:
   /// </summary>
   void decode()
   {
-    ojph::codestream codestream;
-    ojph::mem_infile mem_file;
-    mem_file.open(pEncoded_->data(), pEncoded_->size());
-    readHeader_(codestream, mem_file);
-    decode_(codestream, frameInfo_, 0);
+    decodeUntil_(0, getDeadline_());
   }
 
   /// <summary>
@@ -159,11 +184,109 @@ public:
   /// </summary>
   void decodeSubResolution(size_t decompositionLevel)
   {
-    ojph::codestream codestream;
-    ojph::mem_infile mem_file;
-    mem_file.open(pEncoded_->data(), pEncoded_->size());
-    readHeader_(codestream, mem_file);
-    decode_(codestream, frameInfo_, decompositionLevel);
+    decodeUntil_(decompositionLevel, getDeadline_());
+  }
+
+  /// <summary>
+  /// Sets the resource limits checked by readHeader() and decode().  Use
+  /// these when decoding untrusted codestreams so a malicious or corrupt
+  /// header cannot force huge allocations or very long decodes.  A
+  /// std::runtime_error is thrown as soon as a limit is exceeded.
+  /// </summary>
+  void setLimits(const DecoderLimits &limits)
+  {
+    limits_ = limits;
+  }
+
+  /// <summary>
+  /// returns the resource limits
+  /// </summary>
+  const DecoderLimits &getLimits() const
+  {
+    return limits_;
+  }
+
+  /// <summary>
+  /// Sets the order the pixels are written to the decoded buffer in, see
+  /// OutputLayout.  Tiled layouts are written directly by the decode, so
+  /// tile caches and tiled textures need no reordering pass.  Throws
+  /// std::runtime_error if a Morton tile size is not a power of two.
+  /// </summary>
+  void setOutputLayout(const OutputLayout &layout)
+  {
+    OutputTiling(layout, Size(1, 1));
+    outputLayout_ = layout;
+  }
+
+  /// <summary>
+  /// returns the output layout
+  /// </summary>
+  const OutputLayout &getOutputLayout() const
+  {
+    return outputLayout_;
+  }
+
+#ifndef __EMSCRIPTEN__
+  /// <summary>
+  /// Decodes the tiles of multi-tile codestreams concurrently on pool, each
+  /// tile cut out with CodestreamIndex and decoded by its own decoder into
+  /// its area of the decoded buffer.  Multi-component codestreams without a
+  /// color transform whose tile-parts are divided at components in CPRL
+  /// order (see CodestreamIndex::hasComponentTileParts()) are also split
+  /// per component, each written to its lane of the interleaved pixels.
+  /// Other single tile codestreams, codestreams with PPM markers and tiled
+  /// output layouts are decoded serially as before, OpenJPH offers no way
+  /// to split the work inside one tile-part.  The pool must outlive the
+  /// decodes, set to 0 to disable.  Not exported to JavaScript.
+  /// </summary>
+  void setThreadPool(ThreadPool *pool)
+  {
+    pool_ = pool;
+  }
+
+  /// <summary>
+  /// Returns the number of tasks a decode of the encoded bytes is split
+  /// into with a thread pool (tiles times components), 1 if it runs
+  /// serially.  Only the marker segments are read.  Throws
+  /// std::runtime_error if the codestream is malformed.
+  /// </summary>
+  size_t getParallelTaskCount() const
+  {
+    CodestreamIndex index;
+    index.parse(getEncodedData_(), getEncodedSize_());
+    return getParallelTaskCount_(index);
+  }
+#endif
+
+  /// <summary>
+  /// Sets a flag checked between lines while decoding, a std::runtime_error
+  /// is thrown once it becomes true.  This is not exported to JavaScript, it
+  /// lets C++ callers cancel a decode from another thread.  Set to 0 to
+  /// disable.
+  /// </summary>
+  void setCancellationFlag(const std::atomic<bool> *cancelled)
+  {
+    cancelled_ = cancelled;
+  }
+
+  /// <summary>
+  /// Enables or disables hashing of the decoded pixel data.  When enabled,
+  /// decode() computes the XXH64 hash (seed 0) of the decoded buffer as each
+  /// row is written so the bytes are hashed while still in cache.  The result
+  /// is identical to hashing getDecodedBuffer() after the decode.
+  /// </summary>
+  void setComputeHash(bool computeHash)
+  {
+    computeHash_ = computeHash;
+  }
+
+  /// <summary>
+  /// returns the XXH64 hash of the decoded pixel data from the last decode.
+  /// Only valid if setComputeHash(true) was called before decoding.
+  /// </summary>
+  uint64_t getDecodedHash() const
+  {
+    return decodedHash_;
   }
 
   /// <summary>
@@ -260,11 +383,24 @@ public:
   }
 
 private:
+  void openEncoded_(ojph::mem_infile &mem_file)
+  {
+    if (encodedSpan_)
+    {
+      mem_file.open(encodedSpan_, encodedSpanSize_);
+    }
+    else
+    {
+      mem_file.open(pEncoded_->data(), pEncoded_->size());
+    }
+  }
+
   void readHeader_(ojph::codestream &codestream, ojph::mem_infile &mem_file)
   {
     // NOTE - enabling resilience does not seem to have any effect at this point...
     codestream.enable_resilience();
     codestream.read_headers(&mem_file);
+    checkHeader_(codestream);
     ojph::param_siz siz = codestream.access_siz();
     frameInfo_.width = siz.get_image_extent().x - siz.get_image_offset().x;
     frameInfo_.height = siz.get_image_extent().y - siz.get_image_offset().y;
@@ -302,16 +438,241 @@ private:
     frameInfo_.isUsingColorTransform = cod.is_using_color_transform();
   }
 
+  // Validates the header values before anything is allocated from them.
+  // FrameInfo can only describe images decode_() is able to write, the
+  // remaining checks enforce the configured limits
+  void checkHeader_(ojph::codestream &codestream)
+  {
+    ojph::param_siz siz = codestream.access_siz();
+    const uint64_t width = siz.get_image_extent().x - siz.get_image_offset().x;
+    const uint64_t height = siz.get_image_extent().y - siz.get_image_offset().y;
+    const ojph::ui32 componentCount = siz.get_num_components();
+    if (width > USHRT_MAX || height > USHRT_MAX || componentCount > UCHAR_MAX)
+    {
+      throw std::runtime_error("HTJ2KDecoder: image dimensions exceed the supported range");
+    }
+    uint64_t bytesPerPixel = 1;
+    for (ojph::ui32 c = 0; c < componentCount; c++)
+    {
+      bytesPerPixel = std::max(bytesPerPixel, (uint64_t)(siz.get_bit_depth(c) + 8 - 1) / 8);
+    }
+
+    const uint64_t pixels = width * height;
+    if (limits_.maxPixels && pixels > limits_.maxPixels)
+    {
+      throw std::runtime_error("HTJ2KDecoder: image has " + std::to_string(pixels) + " pixels, limit is " + std::to_string(limits_.maxPixels));
+    }
+    const uint64_t outputBytes = pixels * componentCount * bytesPerPixel;
+    if (limits_.maxOutputBytes && outputBytes > limits_.maxOutputBytes)
+    {
+      throw std::runtime_error("HTJ2KDecoder: decoded size is " + std::to_string(outputBytes) + " bytes, limit is " + std::to_string(limits_.maxOutputBytes));
+    }
+
+    if (limits_.maxTiles == 0 && limits_.maxCodeblocks == 0)
+    {
+      return;
+    }
+    const uint64_t tilesX = countTiles_(siz.get_image_offset().x, siz.get_image_extent().x, siz.get_tile_offset().x, siz.get_tile_size().w);
+    const uint64_t tilesY = countTiles_(siz.get_image_offset().y, siz.get_image_extent().y, siz.get_tile_offset().y, siz.get_tile_size().h);
+    if (limits_.maxTiles && tilesX * tilesY > limits_.maxTiles)
+    {
+      throw std::runtime_error("HTJ2KDecoder: image has " + std::to_string(tilesX * tilesY) + " tiles, limit is " + std::to_string(limits_.maxTiles));
+    }
+    if (limits_.maxCodeblocks)
+    {
+      // every tile-component has at least one codeblock in its LL band
+      if (tilesX * tilesY * componentCount > limits_.maxCodeblocks)
+      {
+        throw std::runtime_error("HTJ2KDecoder: image has more than " + std::to_string(limits_.maxCodeblocks) + " codeblocks");
+      }
+      const uint64_t codeblocks = countCodeblocks_(codestream, limits_.maxCodeblocks);
+      if (codeblocks > limits_.maxCodeblocks)
+      {
+        throw std::runtime_error("HTJ2KDecoder: image has more than " + std::to_string(limits_.maxCodeblocks) + " codeblocks");
+      }
+    }
+  }
+
+  // Counts the codeblocks over all tiles, components, resolutions and
+  // subbands following the partitioning rules of ITU-T T.800 Annex B.
+  // The tile grid is separable so the per axis counts are summed over the
+  // tile columns and rows independently and multiplied per subband.
+  // Counting stops early once stopAfter is exceeded.
+  static uint64_t countCodeblocks_(ojph::codestream &codestream, uint64_t stopAfter)
+  {
+    ojph::param_siz siz = codestream.access_siz();
+    ojph::param_cod cod = codestream.access_cod();
+    const ojph::ui32 numDecompositions = cod.get_num_decompositions();
+    uint64_t total = 0;
+    std::vector<Point> counted;
+    for (ojph::ui32 c = 0; c < siz.get_num_components(); c++)
+    {
+      // components with the same downsampling have the same codeblocks
+      const Point downSample(siz.get_downsampling(c).x, siz.get_downsampling(c).y);
+      uint64_t repeats = 0;
+      for (ojph::ui32 other = c; other < siz.get_num_components(); other++)
+      {
+        if (siz.get_downsampling(other).x == downSample.x && siz.get_downsampling(other).y == downSample.y)
+        {
+          repeats++;
+        }
+      }
+      bool seen = false;
+      for (size_t i = 0; i < counted.size(); i++)
+      {
+        seen = seen || (counted[i].x == downSample.x && counted[i].y == downSample.y);
+      }
+      if (seen)
+      {
+        continue;
+      }
+      counted.push_back(downSample);
+
+      for (ojph::ui32 r = 0; r <= numDecompositions; r++)
+      {
+        const uint32_t level = r ? numDecompositions - r + 1 : numDecompositions;
+        const ojph::size precinct = cod.get_precinct_size(r);
+        const uint64_t blockWidth = std::min<uint64_t>(cod.get_block_dims().w, r ? precinct.w / 2 : precinct.w);
+        const uint64_t blockHeight = std::min<uint64_t>(cod.get_block_dims().h, r ? precinct.h / 2 : precinct.h);
+        const uint64_t low[2] = {
+            countAxis_(siz.get_image_offset().x, siz.get_image_extent().x, siz.get_tile_offset().x, siz.get_tile_size().w, downSample.x, level, 0, blockWidth),
+            countAxis_(siz.get_image_offset().y, siz.get_image_extent().y, siz.get_tile_offset().y, siz.get_tile_size().h, downSample.y, level, 0, blockHeight)};
+        if (r == 0)
+        {
+          total += repeats * low[0] * low[1];
+        }
+        else
+        {
+          const uint64_t high[2] = {
+              countAxis_(siz.get_image_offset().x, siz.get_image_extent().x, siz.get_tile_offset().x, siz.get_tile_size().w, downSample.x, level, 1, blockWidth),
+              countAxis_(siz.get_image_offset().y, siz.get_image_extent().y, siz.get_tile_offset().y, siz.get_tile_size().h, downSample.y, level, 1, blockHeight)};
+          total += repeats * (high[0] * low[1] + low[0] * high[1] + high[0] * high[1]);
+        }
+        if (total > stopAfter)
+        {
+          return total;
+        }
+      }
+    }
+    return total;
+  }
+
+  // Number of tiles along one axis that overlap the image, ITU-T T.800 B.3
+  static uint64_t countTiles_(uint64_t imageStart, uint64_t imageEnd, uint64_t tileStart, uint64_t tileSize)
+  {
+    if (tileSize == 0)
+    {
+      tileSize = imageEnd - tileStart;
+    }
+    if (tileSize == 0 || imageEnd <= imageStart || imageStart < tileStart)
+    {
+      return 0;
+    }
+    return ojph_div_ceil(imageEnd - tileStart, tileSize) - (imageStart - tileStart) / tileSize;
+  }
+
+  // Sums the number of codeblocks along one axis of a subband over all
+  // tiles.  Only the tiles overlapping the image are visited, which
+  // checkHeader_() bounds by the image width or height
+  static uint64_t countAxis_(uint64_t imageStart, uint64_t imageEnd, uint64_t tileStart, uint64_t tileSize, uint64_t downSample, uint32_t level, uint64_t orientation, uint64_t blockSize)
+  {
+    if (tileSize == 0)
+    {
+      tileSize = imageEnd - tileStart;
+    }
+    if (blockSize == 0 || downSample == 0 || tileSize == 0 || imageStart < tileStart)
+    {
+      return 0;
+    }
+    const uint64_t offset = level ? (orientation << (level - 1)) : 0;
+    uint64_t count = 0;
+    const uint64_t firstTile = tileStart + (imageStart - tileStart) / tileSize * tileSize;
+    for (uint64_t t = firstTile; t < imageEnd; t += tileSize)
+    {
+      // tile-component coordinates, then subband coordinates
+      const uint64_t start = ojph_div_ceil(std::max(t, imageStart), downSample);
+      const uint64_t end = ojph_div_ceil(std::min(t + tileSize, imageEnd), downSample);
+      const uint64_t bandStart = start > offset ? ojph_div_ceil(start - offset, (uint64_t)1 << level) : 0;
+      const uint64_t bandEnd = end > offset ? ojph_div_ceil(end - offset, (uint64_t)1 << level) : 0;
+      if (bandEnd > bandStart)
+      {
+        count += ojph_div_ceil(bandEnd, blockSize) - bandStart / blockSize;
+      }
+    }
+    return count;
+  }
+
+  void checkCancelled_() const
+  {
+    if (cancelled_ && cancelled_->load(std::memory_order_relaxed))
+    {
+      throw std::runtime_error("HTJ2KDecoder: decode cancelled");
+    }
+  }
+
+  // decodeSubResolution() with maxDecodeTimeMs checked against deadline,
+  // which the tile decoders of decodeParallel_() share with their parent
+  void decodeUntil_(size_t decompositionLevel, std::chrono::steady_clock::time_point deadline)
+  {
+    deadline_ = deadline;
+    ojph::codestream codestream;
+    ojph::mem_infile mem_file;
+    openEncoded_(mem_file);
+    readHeader_(codestream, mem_file);
+    decode_(codestream, frameInfo_, decompositionLevel);
+  }
+
+  // end of a decode starting now under maxDecodeTimeMs
+  std::chrono::steady_clock::time_point getDeadline_() const
+  {
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(limits_.maxDecodeTimeMs);
+  }
+
+  void checkDecodeTime_() const
+  {
+    if (limits_.maxDecodeTimeMs == 0)
+    {
+      return;
+    }
+    if (std::chrono::steady_clock::now() > deadline_)
+    {
+      throw std::runtime_error("HTJ2KDecoder: decode exceeded the time limit of " + std::to_string(limits_.maxDecodeTimeMs) + " ms");
+    }
+  }
+
   void decode_(ojph::codestream &codestream, const FrameInfo &frameInfo, size_t decompositionLevel)
   {
+    // the output loop below assumes every component line is full width
+    for (size_t c = 0; c < frameInfo.componentCount; c++)
+    {
+      if (downSamples_[c].x != 1 || downSamples_[c].y != 1)
+      {
+        throw std::runtime_error("HTJ2KDecoder: component downsampling is not supported");
+      }
+    }
+
 
     // calculate the resolution at the requested decomposition level and
     // allocate destination buffer
     Size sizeAtDecompositionLevel = calculateSizeAtDecompositionLevel(decompositionLevel);
     int resolutionLevel = numDecompositions_ - decompositionLevel;
     const size_t bytesPerPixel = (frameInfo_.bitsPerSample + 8 - 1) / 8;
-    const size_t destinationSize = sizeAtDecompositionLevel.width * sizeAtDecompositionLevel.height * frameInfo.componentCount * bytesPerPixel;
+    const OutputTiling tiling(outputLayout_, sizeAtDecompositionLevel);
+    const size_t destinationSize = tiling.getPixelCount() * frameInfo.componentCount * bytesPerPixel;
+    if (limits_.maxOutputBytes && destinationSize > limits_.maxOutputBytes)
+    {
+      throw std::runtime_error("HTJ2KDecoder: decoded size is " + std::to_string(destinationSize) + " bytes, limit is " + std::to_string(limits_.maxOutputBytes));
+    }
     pDecoded_->resize(destinationSize);
+    hash_.reset();
+
+#ifndef __EMSCRIPTEN__
+    if (pool_ && tiling.order == OutputOrder::RowMajor && decodeParallel_(frameInfo, decompositionLevel, sizeAtDecompositionLevel))
+    {
+      decodedHash_ = computeHash_ ? hash_.digest() : 0;
+      return;
+    }
+#endif
 
     // set the level to read to and reconstruction level to the specified decompositionLevel
     codestream.restrict_input_resolution(decompositionLevel, decompositionLevel);
@@ -323,8 +684,10 @@ private:
     }
     else
     {
-      if (frameInfo_.isUsingColorTransform)
+      if (frameInfo_.isUsingColorTransform || tiling.order == OutputOrder::Morton)
       {
+        // Morton output writes bands of complete rows, which needs all
+        // components of a row before the next row
         codestream.set_planar(false);
       }
       else
@@ -336,90 +699,288 @@ private:
       }
     }
     codestream.create();
+    checkDecodeTime_();
+    checkCancelled_();
+
+    if (tiling.order == OutputOrder::TileMajor)
+    {
+      decodeTileMajor_(codestream, frameInfo, sizeAtDecompositionLevel, tiling);
+    }
+    else if (tiling.order == OutputOrder::Morton)
+    {
+      decodeMorton_(codestream, frameInfo, sizeAtDecompositionLevel, tiling);
+    }
+    else
+    {
+      decodeRowMajor_(codestream, frameInfo, sizeAtDecompositionLevel);
+    }
+    decodedHash_ = computeHash_ ? hash_.digest() : 0;
+  }
+
+#ifndef __EMSCRIPTEN__
+  // Decodes every tile, or every component of every tile, on pool_ (the
+  // calling thread helps) and copies it into place.  Returns false if
+  // there is only one piece or the tiles cannot be extracted, nothing has
+  // been decoded then
+  bool decodeParallel_(const FrameInfo &frameInfo, size_t decompositionLevel, const Size &size)
+  {
+    const uint8_t *data = getEncodedData_();
+    const size_t dataSize = getEncodedSize_();
+    CodestreamIndex index;
+    index.parse(data, dataSize);
+    if (getParallelTaskCount_(index) < 2)
+    {
+      return false;
+    }
+    const uint32_t components = index.hasComponentTileParts() ? index.getComponentCount() : 1;
+
+    const size_t sampleBytes = (frameInfo.bitsPerSample + 8 - 1) / 8;
+    const size_t pixelBytes = frameInfo.componentCount * sampleBytes;
+    const size_t lineSize = size.width * pixelBytes;
+    uint8_t *decoded = pDecoded_->data();
+    const DecoderLimits limits = limits_;
+    const std::chrono::steady_clock::time_point deadline = deadline_;
+    const std::atomic<bool> *cancelled = cancelled_;
+    pool_->parallelFor((size_t)index.getTileCount() * components, [&](size_t task) {
+      // one decoder per thread so its buffers are reused across tasks
+      thread_local HTJ2KDecoder decoder;
+      const uint32_t tile = (uint32_t)(task / components);
+      decoder.setLimits(limits);
+      decoder.setCancellationFlag(cancelled);
+      if (components == 1)
+      {
+        index.extractTile(data, dataSize, tile, decoder.getEncodedBytes());
+      }
+      else
+      {
+        index.extractTileComponent(data, dataSize, tile, (uint32_t)(task % components), decoder.getEncodedBytes());
+      }
+      decoder.decodeUntil_(decompositionLevel, deadline);
+      const Rect rect = index.getTileRect(tile, (uint32_t)decompositionLevel);
+      const uint8_t *source = decoder.getDecodedBytes().data();
+      if (components == 1)
+      {
+        const size_t tileLineSize = rect.width * pixelBytes;
+        for (uint32_t y = 0; y < rect.height; y++)
+        {
+          memcpy(decoded + (rect.y + y) * lineSize + rect.x * pixelBytes, source + y * tileLineSize, tileLineSize);
+        }
+        return;
+      }
+
+      // a single component, copied into its lane of the interleaved pixels
+      for (uint32_t y = 0; y < rect.height; y++)
+      {
+        uint8_t *row = decoded + (rect.y + y) * lineSize + rect.x * pixelBytes + (task % components) * sampleBytes;
+        const uint8_t *samples = source + (size_t)y * rect.width * sampleBytes;
+        for (uint32_t x = 0; x < rect.width; x++)
+        {
+          memcpy(row + x * pixelBytes, samples + x * sampleBytes, sampleBytes);
+        }
+      }
+    });
+    checkDecodeTime_();
+    if (computeHash_)
+    {
+      hash_.update(decoded, pDecoded_->size());
+    }
+    return true;
+  }
+#endif
+
+#ifndef __EMSCRIPTEN__
+  static size_t getParallelTaskCount_(const CodestreamIndex &index)
+  {
+    if (index.hasPPM())
+    {
+      return 1;
+    }
+    return (size_t)index.getTileCount() * (index.hasComponentTileParts() ? index.getComponentCount() : 1);
+  }
+
+  const uint8_t *getEncodedData_() const
+  {
+    return encodedSpan_ ? encodedSpan_ : pEncoded_->data();
+  }
 
-    // Extract the data line by line...
-    // NOTE: All values must be clamped https://github.com/aous72/OpenJPH/issues/35
+  size_t getEncodedSize_() const
+  {
+    return encodedSpan_ ? encodedSpanSize_ : pEncoded_->size();
+  }
+#endif
+
+  void decodeRowMajor_(ojph::codestream &codestream, const FrameInfo &frameInfo, const Size &sizeAtDecompositionLevel)
+  {
+    // Extract the data line by line.  OpenJPH reports the component of each
+    // line, which is needed because planar codestreams return all lines of
+    // a component before the next one.  A row is complete (and hashed) once
+    // its last component has been written
     ojph::ui32 comp_num;
-    for (int y = 0; y < sizeAtDecompositionLevel.height; y++)
+    const size_t bytesPerPixel = (frameInfo.bitsPerSample + 8 - 1) / 8;
+    const size_t lineSize = sizeAtDecompositionLevel.width * frameInfo.componentCount * bytesPerPixel;
+    const size_t lastComponent = frameInfo.componentCount - 1;
+    std::vector<size_t> rows(frameInfo.componentCount, 0);
+    for (size_t i = 0; i < sizeAtDecompositionLevel.height * frameInfo.componentCount; i++)
     {
-      size_t lineStart = y * sizeAtDecompositionLevel.width * frameInfo.componentCount * bytesPerPixel;
-      if (frameInfo.componentCount == 1)
+      checkDecodeTime_();
+      checkCancelled_();
+      ojph::line_buf *line = codestream.pull(comp_num);
+      uint8_t *row = pDecoded_->data() + rows[comp_num]++ * lineSize;
+      narrowLineToRow(line->i32, row, sizeAtDecompositionLevel.width, frameInfo.componentCount, comp_num, frameInfo.bitsPerSample, frameInfo.isSigned);
+
+      // hash the completed line while it is still in cache
+      if (computeHash_ && comp_num == lastComponent)
       {
-        ojph::line_buf *line = codestream.pull(comp_num);
-        if (frameInfo.bitsPerSample <= 8)
+        hash_.update(row, lineSize);
+      }
+    }
+  }
+
+  // Writes every line straight into the tiles it crosses, one contiguous
+  // segment per tile.  A row of tiles is contiguous in the buffer and is
+  // hashed once its last line has been written
+  void decodeTileMajor_(ojph::codestream &codestream, const FrameInfo &frameInfo, const Size &size, const OutputTiling &tiling)
+  {
+    const size_t pixelBytes = frameInfo.componentCount * ((frameInfo.bitsPerSample + 8 - 1) / 8);
+    const size_t tileLineBytes = tiling.tileWidth * pixelBytes;
+    const size_t tileBytes = tiling.tilePixels * pixelBytes;
+    const size_t tileRowBytes = tileBytes * tiling.tilesX;
+    const uint32_t lastTileWidth = size.width - (tiling.tilesX - 1) * tiling.tileWidth;
+    const uint32_t lastTileHeight = size.height - (tiling.tilesY - 1) * tiling.tileHeight;
+    uint8_t *decoded = pDecoded_->data();
+
+    // padding below the image in the last row of tiles, no line writes it
+    for (uint32_t tx = 0; lastTileHeight < tiling.tileHeight && tx < tiling.tilesX; tx++)
+    {
+      memset(decoded + (tiling.tilesY - 1) * tileRowBytes + tx * tileBytes + lastTileHeight * tileLineBytes, 0,
+             (tiling.tileHeight - lastTileHeight) * tileLineBytes);
+    }
+
+    ojph::ui32 comp_num;
+    const size_t lastComponent = frameInfo.componentCount - 1;
+    std::vector<uint32_t> rows(frameInfo.componentCount, 0);
+    for (size_t i = 0; i < (size_t)size.height * frameInfo.componentCount; i++)
+    {
+      checkDecodeTime_();
+      checkCancelled_();
+      ojph::line_buf *line = codestream.pull(comp_num);
+      const uint32_t y = rows[comp_num]++;
+      const uint32_t tileRow = y / tiling.tileHeight;
+      uint8_t *tileLine = decoded + tileRow * tileRowBytes + (y % tiling.tileHeight) * tileLineBytes;
+      for (uint32_t tx = 0; tx < tiling.tilesX; tx++)
+      {
+        const uint32_t width = tx + 1 == tiling.tilesX ? lastTileWidth : tiling.tileWidth;
+        narrowLineToRow(line->i32 + (size_t)tx * tiling.tileWidth, tileLine + tx * tileBytes, width, frameInfo.componentCount, comp_num, frameInfo.bitsPerSample, frameInfo.isSigned);
+      }
+      if (comp_num == lastComponent)
+      {
+        if (lastTileWidth < tiling.tileWidth)
         {
-          unsigned char *pOut = (unsigned char *)&(*pDecoded_)[lineStart];
-          for (size_t x = 0; x < sizeAtDecompositionLevel.width; x++)
-          {
-            int val = line->i32[x];
-            pOut[x] = std::max(0, std::min(val, UCHAR_MAX));
-          }
+          memset(tileLine + (tiling.tilesX - 1) * tileBytes + lastTileWidth * pixelBytes, 0, (tiling.tileWidth - lastTileWidth) * pixelBytes);
         }
-        else
+        if (computeHash_ && ((y + 1) % tiling.tileHeight == 0 || y + 1 == size.height))
         {
-          if (frameInfo.isSigned)
-          {
-            short *pOut = (short *)&(*pDecoded_)[lineStart];
-            for (size_t x = 0; x < sizeAtDecompositionLevel.width; x++)
-            {
-              int val = line->i32[x];
-              pOut[x] = std::max(SHRT_MIN, std::min(val, SHRT_MAX));
-            }
-          }
-          else
-          {
-            unsigned short *pOut = (unsigned short *)&(*pDecoded_)[lineStart];
-            for (size_t x = 0; x < sizeAtDecompositionLevel.width; x++)
-            {
-              int val = line->i32[x];
-              pOut[x] = std::max(0, std::min(val, USHRT_MAX));
-            }
-          }
+          hash_.update(decoded + tileRow * tileRowBytes, tileRowBytes);
         }
       }
-      else
+    }
+  }
+
+  // Narrows bands of B rows (B = min(16, tile width, tile height)) into a
+  // row-major staging buffer that stays in cache, then copies each B x B
+  // block of the band to the buffer.  Aligned B x B blocks are contiguous
+  // in Morton order, so the buffer is written sequentially.  The components
+  // of a row arrive together (set_planar(false)), so a band is complete
+  // after its last row
+  void decodeMorton_(ojph::codestream &codestream, const FrameInfo &frameInfo, const Size &size, const OutputTiling &tiling)
+  {
+    const size_t pixelBytes = frameInfo.componentCount * ((frameInfo.bitsPerSample + 8 - 1) / 8);
+    const uint32_t band = std::min(16u, std::min(tiling.tileWidth, tiling.tileHeight));
+    const size_t stagingStride = (size_t)tiling.tilesX * tiling.tileWidth * pixelBytes;
+    std::vector<uint8_t> staging(band * stagingStride, 0);
+
+    // staging offset of the n'th pixel of a block in Morton order
+    std::vector<size_t> blockOffsets(band * band);
+    for (uint32_t y = 0; y < band; y++)
+    {
+      for (uint32_t x = 0; x < band; x++)
       {
-        for (int c = 0; c < frameInfo.componentCount; c++)
+        blockOffsets[tiling.mortonIndex(x, y) & (band * band - 1)] = y * stagingStride + x * pixelBytes;
+      }
+    }
+
+    ojph::ui32 comp_num;
+    const size_t lastComponent = frameInfo.componentCount - 1;
+    std::vector<uint32_t> rows(frameInfo.componentCount, 0);
+    for (size_t i = 0; i < (size_t)size.height * frameInfo.componentCount; i++)
+    {
+      checkDecodeTime_();
+      checkCancelled_();
+      ojph::line_buf *line = codestream.pull(comp_num);
+      const uint32_t y = rows[comp_num]++;
+      narrowLineToRow(line->i32, staging.data() + (y % band) * stagingStride, size.width, frameInfo.componentCount, comp_num, frameInfo.bitsPerSample, frameInfo.isSigned);
+      if (comp_num == lastComponent && ((y + 1) % band == 0 || y + 1 == size.height))
+      {
+        const uint32_t bandY = y - y % band;
+        memset(staging.data() + (y + 1 - bandY) * stagingStride, 0, (bandY + band - y - 1) * stagingStride);
+        writeMortonBand_(staging.data(), blockOffsets, bandY, band, pixelBytes, tiling);
+      }
+    }
+
+    // padding bands below the image in the last row of tiles
+    std::fill(staging.begin(), staging.end(), 0);
+    for (uint32_t bandY = (size.height + band - 1) / band * band; bandY < tiling.tilesY * tiling.tileHeight; bandY += band)
+    {
+      writeMortonBand_(staging.data(), blockOffsets, bandY, band, pixelBytes, tiling);
+    }
+  }
+
+  void writeMortonBand_(const uint8_t *staging, const std::vector<size_t> &blockOffsets, uint32_t bandY, uint32_t band, size_t pixelBytes, const OutputTiling &tiling)
+  {
+    const uint32_t tileRow = bandY / tiling.tileHeight;
+    const size_t tileBytes = tiling.tilePixels * pixelBytes;
+    uint8_t *tileRowStart = pDecoded_->data() + tileRow * tiling.tilesX * tileBytes;
+    for (uint32_t tx = 0; tx < tiling.tilesX; tx++)
+    {
+      for (uint32_t x = 0; x < tiling.tileWidth; x += band)
+      {
+        uint8_t *block = tileRowStart + tx * tileBytes + tiling.mortonIndex(x, bandY % tiling.tileHeight) * pixelBytes;
+        const uint8_t *source = staging + ((size_t)tx * tiling.tileWidth + x) * pixelBytes;
+        switch (pixelBytes)
         {
-          ojph::line_buf *line = codestream.pull(comp_num);
-          if (frameInfo.bitsPerSample <= 8)
-          {
-            uint8_t *pOut = &(*pDecoded_)[lineStart] + c;
-            for (size_t x = 0; x < sizeAtDecompositionLevel.width; x++)
-            {
-              int val = line->i32[x];
-              pOut[x * frameInfo.componentCount] = std::max(0, std::min(val, UCHAR_MAX));
-            }
-          }
-          else
+        case 1: copyPixels_<1>(source, blockOffsets, block); break;
+        case 2: copyPixels_<2>(source, blockOffsets, block); break;
+        case 3: copyPixels_<3>(source, blockOffsets, block); break;
+        case 4: copyPixels_<4>(source, blockOffsets, block); break;
+        case 6: copyPixels_<6>(source, blockOffsets, block); break;
+        case 8: copyPixels_<8>(source, blockOffsets, block); break;
+        default:
+          for (size_t n = 0; n < blockOffsets.size(); n++)
           {
-            // This should work but has not been tested yet
-            if (frameInfo.isSigned)
-            {
-              short *pOut = (short *)&(*pDecoded_)[lineStart] + c;
-              for (size_t x = 0; x < sizeAtDecompositionLevel.width; x++)
-              {
-                int val = line->i32[x];
-                pOut[x * frameInfo.componentCount] = std::max(SHRT_MIN, std::min(val, SHRT_MAX));
-              }
-            }
-            else
-            {
-              unsigned short *pOut = (unsigned short *)&(*pDecoded_)[lineStart] + c;
-              for (size_t x = 0; x < sizeAtDecompositionLevel.width; x++)
-              {
-                int val = line->i32[x];
-                pOut[x * frameInfo.componentCount] = std::max(0, std::min(val, USHRT_MAX));
-              }
-            }
+            memcpy(block + n * pixelBytes, source + blockOffsets[n], pixelBytes);
           }
         }
       }
     }
+    if (computeHash_ && (bandY + band) % tiling.tileHeight == 0)
+    {
+      hash_.update(tileRowStart, tiling.tilesX * tileBytes);
+    }
+  }
+
+  template <size_t PixelBytes>
+  static void copyPixels_(const uint8_t *source, const std::vector<size_t> &offsets, uint8_t *destination)
+  {
+    for (size_t n = 0; n < offsets.size(); n++)
+    {
+      memcpy(destination + n * PixelBytes, source + offsets[n], PixelBytes);
+    }
   }
 
   std::vector<uint8_t>* pEncoded_;
   std::vector<uint8_t>* pDecoded_;
+  const uint8_t* encodedSpan_ = nullptr;
+  size_t encodedSpanSize_ = 0;
   std::vector<uint8_t> encodedInternal_; 
   std::vector<uint8_t> decodedInternal_;
   FrameInfo frameInfo_;
@@ -433,4 +994,14 @@ private:
   Size blockDimensions_;
   std::vector<Size> precincts_;
   int32_t numLayers_;
+  bool computeHash_ = false;
+  XXHash64 hash_;
+  uint64_t decodedHash_ = 0;
+  DecoderLimits limits_;
+  std::chrono::steady_clock::time_point deadline_;
+  const std::atomic<bool> *cancelled_ = nullptr;
+  OutputLayout outputLayout_;
+#ifndef __EMSCRIPTEN__
+  ThreadPool *pool_ = nullptr;
+#endif
 };
@@ -3,8 +3,15 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <exception>
+#include <functional>
 #include <memory>
+#include <stdexcept>
+#include <string.h>
+#include <string>
+#include <vector>
 
 #include <ojph_arch.h>
 #include <ojph_file.h>
@@ -14,10 +21,17 @@
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten/val.h>
+#else
+#include "ThreadPool.hpp"
 #endif
 
 #include "EncodedBuffer.hpp"
 #include "FrameInfo.hpp"
+#include "PixelConversion.hpp"
+#include "Point.hpp"
+#include "Rect.hpp"
+#include "Size.hpp"
+#include "XXHash64.hpp"
 
 /// <summary>
 /// JavaScript API for encoding images to HTJ2K bitstreams with OpenJPH
@@ -42,15 +56,10 @@ public:
   /// </returns>
   emscripten::val getDecodedBuffer(const FrameInfo &frameInfo)
   {
-    frameInfo_ = frameInfo;
+    tileSource_ = nullptr;
+    setFrameInfo_(frameInfo);
     const size_t bytesPerPixel = (frameInfo_.bitsPerSample + 8 - 1) / 8;
     const size_t decodedSize = frameInfo_.width * frameInfo_.height * frameInfo_.componentCount * bytesPerPixel;
-    downSamples_.resize(frameInfo_.componentCount);
-    for (int c = 0; c < frameInfo_.componentCount; ++c)
-    {
-      downSamples_[c].x = 1;
-      downSamples_[c].y = 1;
-    }
 
     decoded_.resize(decodedSize);
     return emscripten::val(emscripten::typed_memory_view(decoded_.size(), decoded_.data()));
@@ -68,6 +77,16 @@ public:
   {
     return emscripten::val(emscripten::typed_memory_view(encoded_.tell(), encoded_.get_data()));
   }
+
+  /// <summary>
+  /// Returns a TypedArray of the codestream of the lossy output index from
+  /// the last encode, see addLossyOutput()
+  /// </summary>
+  emscripten::val getLossyEncodedBuffer(size_t index)
+  {
+    EncodedBuffer &encoded = getLossyOutput_(index);
+    return emscripten::val(emscripten::typed_memory_view(encoded.tell(), encoded.get_data()));
+  }
 #else
   /// <summary>
   /// Returns the buffer to store the decoded bytes.  This method is not
@@ -75,13 +94,8 @@ public:
   /// </summary>
   std::vector<uint8_t> &getDecodedBytes(const FrameInfo &frameInfo)
   {
-    frameInfo_ = frameInfo;
-    downSamples_.resize(frameInfo_.componentCount);
-    for (int c = 0; c < frameInfo_.componentCount; ++c)
-    {
-      downSamples_[c].x = 1;
-      downSamples_[c].y = 1;
-    }
+    tileSource_ = nullptr;
+    setFrameInfo_(frameInfo);
     return decoded_;
   }
 
@@ -93,6 +107,16 @@ public:
   {
     return encoded_.getBuffer();
   }
+
+  /// <summary>
+  /// Returns the codestream of the lossy output index from the last
+  /// encode, see addLossyOutput().  This method is not exported to
+  /// JavaScript, it is intended to be called by C++ code
+  /// </summary>
+  const std::vector<uint8_t> &getLossyEncodedBytes(size_t index)
+  {
+    return getLossyOutput_(index).getBuffer();
+  }
 #endif
 
   /// <summary>
@@ -115,6 +139,39 @@ public:
     quantizationStep_ = quantizationStep;
   }
 
+  /// <summary>
+  /// Adds an irreversible codestream with the given quantizationStep that
+  /// is encoded in the same pass as the codestream set up with
+  /// setQuality(), for example a lossy preview next to the lossless
+  /// archive.  Each row of source pixels is read, converted and hashed
+  /// once and fed to every codestream.  The wavelet transforms cannot be
+  /// shared, the lossless 5/3 and lossy 9/7 filters give different
+  /// coefficients.  Only supported when encoding from the decoded buffer
+  /// without an output callback, and the encode runs on the calling
+  /// thread even with a thread pool.
+  /// </summary>
+  void addLossyOutput(float quantizationStep)
+  {
+    lossyQuantizationSteps_.push_back(quantizationStep);
+  }
+
+  /// <summary>
+  /// Removes the outputs added with addLossyOutput()
+  /// </summary>
+  void clearLossyOutputs()
+  {
+    lossyQuantizationSteps_.clear();
+    lossyEncoded_.clear();
+  }
+
+  /// <summary>
+  /// returns the number of outputs added with addLossyOutput()
+  /// </summary>
+  size_t getLossyOutputCount() const
+  {
+    return lossyQuantizationSteps_.size();
+  }
+
   /// <summary>
   /// Sets the progression order
   /// 0 = LRCP
@@ -212,6 +269,155 @@ public:
     set_tilepart_divisions_at_components_ = set_tilepart_divisions_at_components;
   }
 
+  /// <summary>
+  /// Enables or disables hashing of the source pixel data.  When enabled,
+  /// encode() computes the XXH64 hash (seed 0) of the decoded buffer as each
+  /// row is read so the bytes are hashed while still in cache.  The result
+  /// is identical to hashing the decoded buffer before the encode.
+  /// </summary>
+  void setComputeHash(bool computeHash)
+  {
+    computeHash_ = computeHash;
+  }
+
+#ifdef __EMSCRIPTEN__
+  /// <summary>
+  /// Streams the codestream to callback while encoding instead of
+  /// collecting it in the encoded buffer.  callback is called with a
+  /// Uint8Array view of the next bytes (the main header, then the
+  /// tile-parts of each row of tiles as it completes, then EOC), which is
+  /// only valid during the call.  TLM markers and component downsampling
+  /// are not supported in this mode.  Pass null to disable.
+  /// </summary>
+  void setOutputCallback(emscripten::val callback)
+  {
+    if (callback.isNull() || callback.isUndefined())
+    {
+      outputCallback_ = nullptr;
+      return;
+    }
+    outputCallback_ = [callback](const uint8_t *data, size_t size) {
+      callback(emscripten::val(emscripten::typed_memory_view(size, data)));
+    };
+  }
+#else
+  /// <summary>
+  /// Streams the codestream to callback while encoding instead of
+  /// collecting it in the encoded buffer, so output can be sent while the
+  /// rest of the image is still being encoded.  callback receives the main
+  /// header, then the tile-parts of each row of tiles as it completes, then
+  /// EOC; the bytes are only valid during the call.  Output arrives per row
+  /// of tiles, so use setTileSize() for low latency.  TLM markers and
+  /// component downsampling are not supported in this mode.  Pass an empty
+  /// function to disable.
+  /// </summary>
+  void setOutputCallback(std::function<void(const uint8_t *data, size_t size)> callback)
+  {
+    outputCallback_ = std::move(callback);
+  }
+#endif
+
+#ifdef __EMSCRIPTEN__
+  /// <summary>
+  /// Encodes from tiled source pixels instead of the decoded buffer, which
+  /// is not allocated.  For each tile of the grid set with setTileSize() and
+  /// setTileOffset(), in row-major order, encode() calls
+  /// callback(tileIndex, rect, buffer) where rect is the area of the tile
+  /// in the image and buffer is a Uint8Array the callback fills with the
+  /// pixels of that area, interleaved and row-major like the decoded
+  /// buffer.  Match the tile size to the source tiles so each source tile
+  /// is read once.  The hash covers the tiles in the order they were
+  /// requested.  TLM markers and component downsampling are not supported
+  /// in this mode.  getDecodedBuffer() switches back to the decoded buffer.
+  /// </summary>
+  void setTileSource(const FrameInfo &frameInfo, emscripten::val callback)
+  {
+    setFrameInfo_(frameInfo);
+    decoded_ = std::vector<uint8_t>();
+    tileSource_ = [callback](uint32_t tileIndex, const Rect &rect, uint8_t *pixels, size_t size) {
+      callback(tileIndex, rect, emscripten::val(emscripten::typed_memory_view(size, pixels)));
+    };
+  }
+#else
+  /// <summary>
+  /// Encodes from tiled source pixels instead of the decoded buffer, so
+  /// images that arrive tile by tile (tiled TIFF, whole slide images) need
+  /// no full frame staging buffer.  For each tile of the grid set with
+  /// setTileSize() and setTileOffset(), in row-major order, encode() calls
+  /// callback(tileIndex, rect, pixels, size) where rect is the area of the
+  /// tile in the image and pixels has room for its size bytes, to be filled
+  /// interleaved and row-major like the decoded buffer.  Match the tile
+  /// size to the source tiles so each source tile is read once.  The hash
+  /// covers the tiles in the order they were requested.  TLM markers and
+  /// component downsampling are not supported in this mode.
+  /// getDecodedBytes() switches back to the decoded buffer.
+  /// </summary>
+  void setTileSource(const FrameInfo &frameInfo, std::function<void(uint32_t tileIndex, const Rect &rect, uint8_t *pixels, size_t size)> callback)
+  {
+    setFrameInfo_(frameInfo);
+    decoded_ = std::vector<uint8_t>();
+    tileSource_ = std::move(callback);
+  }
+#endif
+
+#ifndef __EMSCRIPTEN__
+  /// <summary>
+  /// Encodes the tiles of tiled images (see setTileSize()) concurrently on
+  /// pool, each tile as its own codestream with its tile grid starting at
+  /// the tile, and stitches their tile-parts in tile order on the calling
+  /// thread, so the hash and tile order match the serial encode.  This is
+  /// tile level parallelism only, it does nothing for untiled images.
+  /// Works with the decoded buffer, tile
+  /// sources (called in order on the calling thread) and output callbacks,
+  /// at most a few tiles per thread are in flight.  Multi-component images
+  /// without a color transform in CPRL order (setProgressionOrder(4)) are
+  /// also split per component, each coded as its own codestream and merged;
+  /// add setTilePartDivisionsAtComponents(true) so HTJ2KDecoder can decode
+  /// the components in parallel too.  Other untiled images, TLM markers and
+  /// component downsampling encode serially as before, OpenJPH offers no
+  /// way to split the work inside one tile-component.  The pool must
+  /// outlive the encodes, set to 0 to disable.  Not exported to JavaScript.
+  /// </summary>
+  void setThreadPool(ThreadPool *pool)
+  {
+    pool_ = pool;
+  }
+
+  /// <summary>
+  /// Returns the number of tasks encode() is split into with a thread
+  /// pool for the current frame and settings (tiles times components), 1 if
+  /// it runs serially, as with lossy outputs
+  /// </summary>
+  size_t getParallelTaskCount() const
+  {
+    if (!isStitchable_() || !lossyQuantizationSteps_.empty())
+    {
+      return 1;
+    }
+    return getTileAreas_().size() * (isComponentParallel_() ? frameInfo_.componentCount : 1);
+  }
+#endif
+
+  /// <summary>
+  /// Sets a flag checked between lines while encoding, a std::runtime_error
+  /// is thrown once it becomes true.  This is not exported to JavaScript, it
+  /// lets C++ callers cancel an encode from another thread.  Set to 0 to
+  /// disable.
+  /// </summary>
+  void setCancellationFlag(const std::atomic<bool> *cancelled)
+  {
+    cancelled_ = cancelled;
+  }
+
+  /// <summary>
+  /// returns the XXH64 hash of the source pixel data from the last encode.
+  /// Only valid if setComputeHash(true) was called before encoding.
+  /// </summary>
+  uint64_t getDecodedHash() const
+  {
+    return decodedHash_;
+  }
+
   /// <summary>
   /// Executes an HTJ2K encode using the data in the source buffer.  The
   /// JavaScript code must copy the source image frame into the source
@@ -220,20 +426,163 @@ public:
   /// </summary>
   void encode()
   {
+    hash_.reset();
     encoded_.open();
+    downSamples_.resize(frameInfo_.componentCount);
+#ifndef __EMSCRIPTEN__
+    if (pool_ && getParallelTaskCount() > 1)
+    {
+      encodeParallel_(getTileAreas_(), isComponentParallel_() ? frameInfo_.componentCount : 1);
+      decodedHash_ = computeHash_ ? hash_.digest() : 0;
+      return;
+    }
+#endif
+    if (!lossyQuantizationSteps_.empty() && (tileSource_ || outputCallback_))
+    {
+      throw std::runtime_error(std::string("HTJ2KEncoder: lossy outputs are not supported with ") + (tileSource_ ? "tiled input" : "an output callback"));
+    }
+    if (tileSource_)
+    {
+      encodeTiled_();
+    }
+    else if (outputCallback_)
+    {
+      encodeStreaming_();
+    }
+    else
+    {
+      // the codestream set with setQuality() first, then the lossy outputs
+      lossyEncoded_.resize(lossyQuantizationSteps_.size());
+      std::vector<Output_> outputs(1, Output_(&encoded_, lossless_, quantizationStep_));
+      for (size_t i = 0; i < lossyEncoded_.size(); i++)
+      {
+        lossyEncoded_[i].open();
+        outputs.push_back(Output_(&lossyEncoded_[i], false, lossyQuantizationSteps_[i]));
+      }
+      encode_(outputs.data(), outputs.size(), Rect(imageOffset_.x, imageOffset_.y, frameInfo_.width - imageOffset_.x, frameInfo_.height - imageOffset_.y),
+              decoded_.data(), getLineSize_(), computeHash_ ? &hash_ : nullptr);
+    }
+    decodedHash_ = computeHash_ ? hash_.digest() : 0;
+  }
+
+private:
+  // Takes frameInfo with no component downsampling, without touching the
+  // decoded buffer
+  void setFrameInfo_(const FrameInfo &frameInfo)
+  {
+    frameInfo_ = frameInfo;
+    downSamples_.resize(frameInfo_.componentCount);
+    for (int c = 0; c < frameInfo_.componentCount; ++c)
+    {
+      downSamples_[c].x = 1;
+      downSamples_[c].y = 1;
+    }
+  }
+
+  // A codestream encode_() writes and its quality
+  struct Output_
+  {
+    Output_(ojph::outfile_base *out, bool lossless, float quantizationStep)
+    : out(out), lossless(lossless), quantizationStep(quantizationStep)
+    {
+    }
+
+    ojph::outfile_base *out;
+    bool lossless;
+    float quantizationStep;
+  };
+
+  // Encodes the area of the reference grid to out as a complete
+  // codestream with the quality set with setQuality(), see below
+  void encode_(ojph::outfile_base &out, const Rect &area, const uint8_t *source, size_t stride, XXHash64 *hash, int component = AllComponents) const
+  {
+    const Output_ output(&out, lossless_, quantizationStep_);
+    encode_(&output, 1, area, source, stride, hash, component);
+  }
+
+  // Encodes the area of the reference grid to each of the count outputs
+  // as a complete codestream.  Row n of the area is read from source + n *
+  // stride and added to hash if there is one.  A component of
+  // AllComponents or more encodes only that component of the interleaved
+  // pixels as a single component codestream.  Only reads the encoder's
+  // state, so tiles and components can be encoded concurrently
+  void encode_(const Output_ *outputs, size_t count, const Rect &area, const uint8_t *source, size_t stride, XXHash64 *hash, int component = AllComponents) const
+  {
+    std::vector<std::unique_ptr<ojph::codestream>> codestreams(count);
+    for (size_t k = 0; k < count; k++)
+    {
+      codestreams[k].reset(new ojph::codestream());
+      writeHeaders_(*codestreams[k], outputs[k], area, component);
+    }
+
+    // Encode the image.  OpenJPH asks for the component of each line via
+    // next_comp, planar codestreams take all lines of a component before
+    // the next one.  The outputs differ only in quality so they ask in the
+    // same order, each row is widened into the line of the first and
+    // copied to the others.  A row is fully consumed (and hashed) once its
+    // last component has been read
+    const ojph::ui32 num_comps = component == AllComponents ? frameInfo_.componentCount : 1;
+    std::vector<ojph::ui32> next_comp(count);
+    std::vector<ojph::line_buf *> cur_line(count);
+    for (size_t k = 0; k < count; k++)
+    {
+      cur_line[k] = codestreams[k]->exchange(NULL, next_comp[k]);
+    }
+    const size_t lineSize = area.width * getPixelSize_();
+    std::vector<size_t> rows(num_comps, 0);
+    for (size_t i = 0; i < (size_t)area.height * num_comps; i++)
+    {
+      if (cancelled_ && cancelled_->load(std::memory_order_relaxed))
+      {
+        throw std::runtime_error("HTJ2KEncoder: encode cancelled");
+      }
+      const ojph::ui32 comp = next_comp[0];
+      const uint8_t *row = source + rows[comp]++ * stride;
+      widenRowToLine(row, cur_line[0]->i32, area.width, frameInfo_.componentCount, component == AllComponents ? comp : component,
+                     frameInfo_.bitsPerSample, frameInfo_.isSigned);
+      for (size_t k = 1; k < count; k++)
+      {
+        memcpy(cur_line[k]->i32, cur_line[0]->i32, area.width * sizeof(ojph::si32));
+      }
+      for (size_t k = 0; k < count; k++)
+      {
+        cur_line[k] = codestreams[k]->exchange(cur_line[k], next_comp[k]);
+      }
+
+      // hash the consumed line while it is still in cache
+      if (hash && comp == num_comps - 1)
+      {
+        hash->update(row, lineSize);
+      }
+    }
+
+    // cleanup
+    for (size_t k = 0; k < count; k++)
+    {
+      codestreams[k]->flush();
+      codestreams[k]->close();
+    }
+  }
 
+  // Sets up codestream for the area and component (see encode_()) with the
+  // quality of output and writes its main header
+  void writeHeaders_(ojph::codestream &codestream, const Output_ &output, const Rect &area, int component) const
+  {
     // Setup image size parameters
-    ojph::codestream codestream;
     ojph::param_siz siz = codestream.access_siz();
-    siz.set_image_extent(ojph::point(frameInfo_.width, frameInfo_.height));
-    int num_comps = frameInfo_.componentCount;
-    downSamples_.resize(num_comps);
+    siz.set_image_extent(ojph::point(area.x + area.width, area.y + area.height));
+    int num_comps = component == AllComponents ? frameInfo_.componentCount : 1;
     siz.set_num_components(num_comps);
     for (int c = 0; c < num_comps; ++c)
-      siz.set_component(c, ojph::point(downSamples_[c].x, downSamples_[c].y), frameInfo_.bitsPerSample, frameInfo_.isSigned);
-    siz.set_image_offset(ojph::point(imageOffset_.x, imageOffset_.y));
+    {
+      const Point &downSample = downSamples_[component == AllComponents ? c : component];
+      siz.set_component(c, ojph::point(downSample.x, downSample.y), frameInfo_.bitsPerSample, frameInfo_.isSigned);
+    }
+    siz.set_image_offset(ojph::point(area.x, area.y));
     siz.set_tile_size(ojph::size(tileSize_.width, tileSize_.height));
-    siz.set_tile_offset(ojph::point(tileOffset_.x, tileOffset_.y));
+    // the grid starts at the tile holding the top left corner of area, as
+    // T.800 requires, so its tiles are numbered from 0 there
+    siz.set_tile_offset(ojph::point(getTileOrigin_(area.x, tileOffset_.x, tileSize_.width), getTileOrigin_(area.y, tileOffset_.y, tileSize_.height)));
 
     // Setup encoding parameters
     ojph::param_cod cod = codestream.access_cod();
@@ -251,65 +600,413 @@ public:
     const char *progOrders[] = {"LRCP", "RLCP", "RPCL", "PCRL", "CPRL"};
     cod.set_progression_order(progOrders[progressionOrder_]);
     cod.set_color_transform(frameInfo_.isUsingColorTransform);
-    cod.set_reversible(lossless_);
-    if (!lossless_)
+    cod.set_reversible(output.lossless);
+    if (!output.lossless)
     {
-      codestream.access_qcd().set_irrev_quant(quantizationStep_);
+      codestream.access_qcd().set_irrev_quant(output.quantizationStep);
     }
-    codestream.set_tilepart_divisions(set_tilepart_divisions_at_resolutions_, set_tilepart_divisions_at_components_);
+    codestream.set_tilepart_divisions(set_tilepart_divisions_at_resolutions_, set_tilepart_divisions_at_components_ && component == AllComponents);
     codestream.request_tlm_marker(request_tlm_marker_);
     codestream.set_planar(frameInfo_.isUsingColorTransform == false);
-    codestream.write_headers(&encoded_);
+    codestream.write_headers(output.out);
+  }
+
+  // Encodes one row of tiles at a time as its own codestream and passes
+  // its tile-parts to the output callback as soon as it is done.  Each
+  // strip's tile grid starts at its own tile row (see writeHeaders_()) so
+  // its tiles are numbered from 0 and only need their tile indices (Isot)
+  // offset by the tiles of the rows above.  The main header of the first
+  // strip is sent first with SIZ patched to the full image.
+  void encodeStreaming_()
+  {
+    checkStitchable_("an output callback");
+
+    const uint32_t x0 = imageOffset_.x;
+    const uint32_t y0 = imageOffset_.y;
+    const uint32_t x1 = frameInfo_.width;
+    const uint32_t y1 = frameInfo_.height;
+    const uint32_t tileWidth = tileSize_.width ? tileSize_.width : x1 - tileOffset_.x;
+    const uint32_t tileHeight = tileSize_.height ? tileSize_.height : y1 - tileOffset_.y;
+    const uint32_t tilesX = (x1 - tileOffset_.x + tileWidth - 1) / tileWidth - (x0 - tileOffset_.x) / tileWidth;
+
+    std::vector<uint8_t> mainHeader;
+    uint32_t tileIndexBase = 0;
+    for (uint32_t stripStart = y0; stripStart < y1; tileIndexBase += tilesX)
+    {
+      const uint32_t stripEnd = std::min(y1, tileOffset_.y + ((stripStart - tileOffset_.y) / tileHeight + 1) * tileHeight);
+      part_.open();
+      encode_(part_, Rect(x0, stripStart, x1 - x0, stripEnd - stripStart), decoded_.data() + (size_t)(stripStart - y0) * getLineSize_(), getLineSize_(),
+              computeHash_ ? &hash_ : nullptr);
+      streamStrip_(part_, mainHeader, tileIndexBase);
+      stripStart = stripEnd;
+    }
+    const uint8_t eoc[2] = {0xFF, 0xD9};
+    emit_(eoc, sizeof(eoc));
+  }
+
+  // Encodes every tile as its own codestream, with the image area reduced
+  // to the tile and its tile grid starting at the tile (see
+  // writeHeaders_()), so its only tile is tile 0, and stitches their
+  // tile-parts like encodeStreaming_() stitches rows of tiles with Isot
+  // set to the index of the tile.  Only one tile of source pixels is held
+  // at a time
+  void encodeTiled_()
+  {
+    checkStitchable_("tiled input");
 
-    // Encode the image
-    const size_t bytesPerPixel = frameInfo_.bitsPerSample / 8;
-    ojph::ui32 next_comp;
-    ojph::line_buf *cur_line = codestream.exchange(NULL, next_comp);
-    siz = codestream.access_siz();
-    int height = siz.get_image_extent().y - siz.get_image_offset().y;
-    for (size_t y = 0; y < height; y++)
+    const std::vector<Rect> areas = getTileAreas_();
+    std::vector<uint8_t> mainHeader;
+    for (uint32_t tileIndex = 0; tileIndex < areas.size(); tileIndex++)
     {
-      for (size_t c = 0; c < siz.get_num_components(); c++)
+      const Rect &area = areas[tileIndex];
+      tilePixels_.resize((size_t)area.width * area.height * getPixelSize_());
+      tileSource_(tileIndex, Rect(area.x - imageOffset_.x, area.y - imageOffset_.y, area.width, area.height), tilePixels_.data(), tilePixels_.size());
+      part_.open();
+      encode_(part_, area, tilePixels_.data(), area.width * getPixelSize_(), computeHash_ ? &hash_ : nullptr);
+      streamStrip_(part_, mainHeader, tileIndex);
+    }
+    const uint8_t eoc[2] = {0xFF, 0xD9};
+    emit_(eoc, sizeof(eoc));
+  }
+
+#ifndef __EMSCRIPTEN__
+  // Encodes the tiles like encodeTiled_() but on pool_, a window of about
+  // two tasks per thread at a time.  With more than one component each
+  // component of a tile is its own task, see mergeComponents_().  The tile
+  // source, hashing and stitching run on the calling thread in tile order,
+  // so the output does not depend on which task finishes first
+  void encodeParallel_(const std::vector<Rect> &areas, size_t components)
+  {
+    const size_t pixelSize = getPixelSize_();
+    const size_t window = std::min(areas.size(), std::max<size_t>(1, 2 * (pool_->getThreadCount() + 1) / components));
+    parts_.resize(window * components);
+    if (tileSource_)
+    {
+      windowPixels_.resize(window);
+    }
+
+    std::vector<uint8_t> mainHeader;
+    for (size_t first = 0; first < areas.size(); first += window)
+    {
+      const size_t count = std::min(window, areas.size() - first);
+      for (size_t i = 0; tileSource_ && i < count; i++)
+      {
+        const Rect &area = areas[first + i];
+        std::vector<uint8_t> &pixels = windowPixels_[i];
+        pixels.resize((size_t)area.width * area.height * pixelSize);
+        tileSource_((uint32_t)(first + i), Rect(area.x - imageOffset_.x, area.y - imageOffset_.y, area.width, area.height), pixels.data(), pixels.size());
+        if (computeHash_)
+        {
+          hash_.update(pixels.data(), pixels.size());
+        }
+      }
+      pool_->parallelFor(count * components, [&](size_t task) {
+        const size_t i = task / components;
+        const Rect &area = areas[first + i];
+        const int component = components == 1 ? AllComponents : (int)(task % components);
+        parts_[task].open();
+        if (tileSource_)
+        {
+          encode_(parts_[task], area, windowPixels_[i].data(), area.width * pixelSize, nullptr, component);
+        }
+        else
+        {
+          const uint8_t *source = decoded_.data() + (size_t)(area.y - imageOffset_.y) * getLineSize_() + (size_t)(area.x - imageOffset_.x) * pixelSize;
+          encode_(parts_[task], area, source, getLineSize_(), nullptr, component);
+        }
+      });
+      for (size_t i = 0; i < count; i++)
       {
-        int *dp = cur_line->i32;
-        if (frameInfo_.bitsPerSample <= 8)
+        if (components == 1)
         {
-          uint8_t *pIn = (uint8_t *)(decoded_.data() + (y * frameInfo_.width * bytesPerPixel * siz.get_num_components()) + c);
-          for (size_t x = 0; x < frameInfo_.width; x++)
-          {
-            *dp++ = *pIn;
-            pIn += siz.get_num_components();
-          }
+          streamStrip_(parts_[i], mainHeader, (uint32_t)(first + i));
         }
         else
         {
-          if (frameInfo_.isSigned)
-          {
-            int16_t *pIn = (int16_t *)(decoded_.data() + (y * frameInfo_.width * bytesPerPixel));
-            for (size_t x = 0; x < frameInfo_.width; x++)
-            {
-              *dp++ = *pIn++;
-            }
-          }
-          else
-          {
-            uint16_t *pIn = (uint16_t *)(decoded_.data() + (y * frameInfo_.width * bytesPerPixel));
-            for (size_t x = 0; x < frameInfo_.width; x++)
-            {
-              *dp++ = *pIn++;
-            }
-          }
+          mergeComponents_(&parts_[i * components], mainHeader, (uint32_t)(first + i));
         }
-        cur_line = codestream.exchange(cur_line, next_comp);
       }
     }
 
-    // cleanup
-    codestream.flush();
-    codestream.close();
+    // the serial encodes hash the rows of the image in order
+    if (computeHash_ && !tileSource_)
+    {
+      const size_t lineSize = (frameInfo_.width - imageOffset_.x) * pixelSize;
+      for (uint32_t y = 0; y < frameInfo_.height - imageOffset_.y; y++)
+      {
+        hash_.update(decoded_.data() + (size_t)y * getLineSize_(), lineSize);
+      }
+    }
+    const uint8_t eoc[2] = {0xFF, 0xD9};
+    emit_(eoc, sizeof(eoc));
+  }
+#endif
+
+#ifndef __EMSCRIPTEN__
+  // Emits tile tileIndex from the single component codestreams of its
+  // components in parts, each holding only that tile as tile 0 (see
+  // writeHeaders_()), preceded by the main header (SIZ patched to the
+  // whole image, its tile grid and all components) the first time.  In CPRL order the
+  // packets of a tile are ordered by component first and, without a
+  // color transform, coded independently, so the tile body is the bodies
+  // of the components one after another.  They become one tile-part, or
+  // one per component with tile-part divisions at components
+  void mergeComponents_(EncodedBuffer *parts, std::vector<uint8_t> &mainHeader, uint32_t tileIndex)
+  {
+    const uint32_t components = frameInfo_.componentCount;
+    std::vector<const uint8_t *> bodies(components);
+    std::vector<uint32_t> lengths(components);
+    uint32_t total = 0;
+    uint8_t partCount = 1;
+    for (uint32_t c = 0; c < components; c++)
+    {
+      const uint8_t *data = parts[c].get_data();
+      const size_t size = parts[c].tell();
+      size_t p = 2;
+      while (p + 4 <= size && read16_(data + p) != 0xFF90)
+      {
+        p += 2 + read16_(data + p + 2);
+      }
+      // a single tile-part holding just SOD and the packets, then EOC
+      const uint32_t length = p + 14 <= size ? ((uint32_t)read16_(data + p + 6) << 16) | read16_(data + p + 8) : 0;
+      if (length < 14 || p + length + 2 != size || read16_(data + p + 12) != 0xFF93 || data[p + 10] != 0)
+      {
+        throw std::runtime_error("HTJ2KEncoder: unexpected component codestream, cannot merge");
+      }
+      partCount = data[p + 11];
+      bodies[c] = data + p + 14;
+      lengths[c] = length - 14;
+      total += lengths[c];
+
+      if (c == 0 && mainHeader.empty())
+      {
+        // SIZ follows SOC, the component entry after Csiz is repeated
+        mainHeader.assign(data, data + p);
+        write32_(&mainHeader[8], frameInfo_.width);
+        write32_(&mainHeader[12], frameInfo_.height);
+        write32_(&mainHeader[16], imageOffset_.x);
+        write32_(&mainHeader[20], imageOffset_.y);
+        write32_(&mainHeader[32], tileOffset_.x);
+        write32_(&mainHeader[36], tileOffset_.y);
+        mainHeader[40] = (uint8_t)(components >> 8);
+        mainHeader[41] = (uint8_t)components;
+        const std::vector<uint8_t> entry(mainHeader.begin() + 42, mainHeader.begin() + 45);
+        for (uint32_t i = 1; i < components; i++)
+        {
+          mainHeader.insert(mainHeader.begin() + 45, entry.begin(), entry.end());
+        }
+        const uint32_t sizLength = read16_(&mainHeader[4]) + 3 * (components - 1);
+        mainHeader[4] = (uint8_t)(sizLength >> 8);
+        mainHeader[5] = (uint8_t)sizLength;
+        emit_(mainHeader.data(), mainHeader.size());
+      }
+    }
+
+    const bool divided = set_tilepart_divisions_at_components_;
+    for (uint32_t c = 0; c < components; c++)
+    {
+      if (c == 0 || divided)
+      {
+        const uint32_t length = 14 + (divided ? lengths[c] : total);
+        const uint8_t header[14] = {0xFF, 0x90, 0, 10, (uint8_t)(tileIndex >> 8), (uint8_t)tileIndex,
+                                    (uint8_t)(length >> 24), (uint8_t)(length >> 16), (uint8_t)(length >> 8), (uint8_t)length,
+                                    (uint8_t)(divided ? c : 0), (uint8_t)(divided && partCount ? components : partCount), 0xFF, 0x93};
+        emit_(header, sizeof(header));
+      }
+      emit_(bodies[c], lengths[c]);
+    }
+  }
+#endif
+
+  // true if the components can be coded as separate codestreams and
+  // merged, see mergeComponents_()
+  bool isComponentParallel_() const
+  {
+    return frameInfo_.componentCount > 1 && !frameInfo_.isUsingColorTransform && progressionOrder_ == 4 &&
+           !set_tilepart_divisions_at_resolutions_ && isStitchable_();
+  }
+
+  // The tiles of the grid set with setTileSize() and setTileOffset() in
+  // row-major order, as areas of the reference grid
+  std::vector<Rect> getTileAreas_() const
+  {
+    const uint32_t x0 = imageOffset_.x;
+    const uint32_t y0 = imageOffset_.y;
+    const uint32_t x1 = frameInfo_.width;
+    const uint32_t y1 = frameInfo_.height;
+    const uint32_t tileWidth = tileSize_.width ? tileSize_.width : x1 - tileOffset_.x;
+    const uint32_t tileHeight = tileSize_.height ? tileSize_.height : y1 - tileOffset_.y;
+
+    std::vector<Rect> areas;
+    for (uint32_t ty0 = y0; ty0 < y1; )
+    {
+      const uint32_t ty1 = std::min(y1, tileOffset_.y + ((ty0 - tileOffset_.y) / tileHeight + 1) * tileHeight);
+      for (uint32_t tx0 = x0; tx0 < x1; )
+      {
+        const uint32_t tx1 = std::min(x1, tileOffset_.x + ((tx0 - tileOffset_.x) / tileWidth + 1) * tileWidth);
+        areas.push_back(Rect(tx0, ty0, tx1 - tx0, ty1 - ty0));
+        tx0 = tx1;
+      }
+      ty0 = ty1;
+    }
+    return areas;
+  }
+
+  // Start of the tile holding start on an axis of the tile grid, tileOffset
+  // when the image is not tiled on that axis or start is before the grid
+  static uint32_t getTileOrigin_(uint32_t start, uint32_t tileOffset, uint32_t tileSize)
+  {
+    if (tileSize == 0 || start < tileOffset)
+    {
+      return tileOffset;
+    }
+    return tileOffset + (start - tileOffset) / tileSize * tileSize;
+  }
+
+  // true if tiles encoded as separate codestreams can be stitched
+  bool isStitchable_() const
+  {
+    return !request_tlm_marker_ && !isDownSampled_();
+  }
+
+  bool isDownSampled_() const
+  {
+    for (const Point &downSample : downSamples_)
+    {
+      if (downSample.x != 1 || downSample.y != 1)
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void checkStitchable_(const char *mode) const
+  {
+    if (request_tlm_marker_)
+    {
+      throw std::runtime_error(std::string("HTJ2KEncoder: TLM markers are not supported with ") + mode);
+    }
+    if (isDownSampled_())
+    {
+      throw std::runtime_error(std::string("HTJ2KEncoder: component downsampling is not supported with ") + mode);
+    }
+  }
+
+  // Passes stitched codestream bytes to the output callback, or appends
+  // them to the encoded buffer when there is none
+  void emit_(const uint8_t *data, size_t size)
+  {
+    if (outputCallback_)
+    {
+      outputCallback_(data, size);
+    }
+    else
+    {
+      encoded_.write(data, size);
+    }
+  }
+
+  // Emits the tile-parts of the codestream in part with Isot offset by
+  // tileIndexBase, preceded by the main header (SIZ patched to the whole
+  // image) the first time
+  void streamStrip_(EncodedBuffer &part, std::vector<uint8_t> &mainHeader, uint32_t tileIndexBase)
+  {
+    const uint8_t *data = part.get_data();
+    const size_t size = part.tell();
+    size_t p = 2;
+    while (p + 4 <= size && read16_(data + p) != 0xFF90)
+    {
+      p += 2 + read16_(data + p + 2);
+    }
+    if (p + 4 > size)
+    {
+      throw std::runtime_error("HTJ2KEncoder: strip codestream has no tile-parts");
+    }
+
+    // SIZ follows SOC, Xsiz, Ysiz, XOsiz, YOsiz, XTOsiz and YTOsiz are at
+    // fixed positions
+    if (mainHeader.empty())
+    {
+      mainHeader.assign(data, data + p);
+      write32_(&mainHeader[8], frameInfo_.width);
+      write32_(&mainHeader[12], frameInfo_.height);
+      write32_(&mainHeader[16], imageOffset_.x);
+      write32_(&mainHeader[20], imageOffset_.y);
+      write32_(&mainHeader[32], tileOffset_.x);
+      write32_(&mainHeader[36], tileOffset_.y);
+      emit_(mainHeader.data(), mainHeader.size());
+    }
+    else
+    {
+      const size_t sizEnd = 4 + read16_(data + 4);
+      if (p != mainHeader.size() || memcmp(data + sizEnd, &mainHeader[sizEnd], p - sizEnd) != 0)
+      {
+        throw std::runtime_error("HTJ2KEncoder: strip main headers differ, cannot stitch");
+      }
+    }
+
+    streamed_.assign(data + p, data + size);
+    size_t q = 0;
+    while (q + 12 <= streamed_.size() && read16_(&streamed_[q]) == 0xFF90)
+    {
+      const uint32_t tileIndex = tileIndexBase + read16_(&streamed_[q + 4]);
+      if (tileIndex > 65534)
+      {
+        throw std::runtime_error("HTJ2KEncoder: too many tiles");
+      }
+      streamed_[q + 4] = (uint8_t)(tileIndex >> 8);
+      streamed_[q + 5] = (uint8_t)tileIndex;
+      const uint32_t length = ((uint32_t)read16_(&streamed_[q + 6]) << 16) | read16_(&streamed_[q + 8]);
+      if (length == 0)
+      {
+        throw std::runtime_error("HTJ2KEncoder: tile-part without a length, cannot stream");
+      }
+      q += length;
+    }
+    // everything up to the strip's EOC
+    if (q + 2 != streamed_.size() || read16_(&streamed_[q]) != 0xFFD9)
+    {
+      throw std::runtime_error("HTJ2KEncoder: unexpected data after the tile-parts of a strip");
+    }
+    emit_(streamed_.data(), q);
+  }
+
+  size_t getPixelSize_() const
+  {
+    return frameInfo_.componentCount * ((frameInfo_.bitsPerSample + 8 - 1) / 8);
+  }
+
+  size_t getLineSize_() const
+  {
+    return frameInfo_.width * getPixelSize_();
+  }
+
+  // component argument of encode_() for all components
+  static const int AllComponents = -1;
+
+  EncodedBuffer &getLossyOutput_(size_t index)
+  {
+    if (index >= lossyEncoded_.size())
+    {
+      throw std::runtime_error("HTJ2KEncoder: no lossy output " + std::to_string(index));
+    }
+    return lossyEncoded_[index];
+  }
+
+  static uint16_t read16_(const uint8_t *p)
+  {
+    return (uint16_t)((p[0] << 8) | p[1]);
+  }
+
+  static void write32_(uint8_t *p, uint32_t value)
+  {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
   }
 
-private:
   std::vector<uint8_t> decoded_;
   EncodedBuffer encoded_;
   FrameInfo frameInfo_;
@@ -320,6 +1017,22 @@ private:
   bool set_tilepart_divisions_at_resolutions_ = false;
   float quantizationStep_ = -1.0f;
   size_t progressionOrder_ = 2; // RPCL
+  bool computeHash_ = false;
+  XXHash64 hash_;
+  uint64_t decodedHash_ = 0;
+  const std::atomic<bool> *cancelled_ = nullptr;
+  std::function<void(const uint8_t *, size_t)> outputCallback_;
+  std::vector<uint8_t> streamed_;
+  EncodedBuffer part_;
+  std::function<void(uint32_t, const Rect &, uint8_t *, size_t)> tileSource_;
+  std::vector<uint8_t> tilePixels_;
+  std::vector<float> lossyQuantizationSteps_;
+  std::vector<EncodedBuffer> lossyEncoded_;
+#ifndef __EMSCRIPTEN__
+  ThreadPool *pool_ = nullptr;
+  std::vector<EncodedBuffer> parts_;
+  std::vector<std::vector<uint8_t>> windowPixels_;
+#endif
 
   std::vector<Point> downSamples_;
   Point imageOffset_;
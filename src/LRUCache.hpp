@@ -0,0 +1,136 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <utility>
+
+/// <summary>
+/// Thread safe least recently used cache with a memory budget.  Every entry
+/// has a cost (normally its size in bytes) and the least recently used
+/// entries are evicted once the total cost exceeds the budget.  Values are
+/// shared so an entry can be evicted while a reader still uses it.
+/// </summary>
+template <typename Key, typename Value>
+class LRUCache
+{
+public:
+  /// <summary>
+  /// Creates a cache holding entries up to a total cost of budget
+  /// </summary>
+  explicit LRUCache(size_t budget) : budget_(budget)
+  {
+  }
+
+  /// <summary>
+  /// returns the cached value or an empty pointer, and marks the entry as
+  /// most recently used
+  /// </summary>
+  std::shared_ptr<const Value> get(const Key &key)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end())
+    {
+      misses_++;
+      return nullptr;
+    }
+    hits_++;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->value;
+  }
+
+  /// <summary>
+  /// returns true if key is cached without changing the eviction order
+  /// </summary>
+  bool contains(const Key &key) const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index_.count(key) != 0;
+  }
+
+  /// <summary>
+  /// Adds or replaces an entry.  Entries costing more than the whole
+  /// budget are not cached.
+  /// </summary>
+  void put(const Key &key, std::shared_ptr<const Value> value, size_t cost)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it != index_.end())
+    {
+      cost_ -= it->second->cost;
+      entries_.erase(it->second);
+      index_.erase(it);
+    }
+    if (cost > budget_)
+    {
+      return;
+    }
+    entries_.push_front({key, std::move(value), cost});
+    index_[key] = entries_.begin();
+    cost_ += cost;
+    while (cost_ > budget_)
+    {
+      cost_ -= entries_.back().cost;
+      index_.erase(entries_.back().key);
+      entries_.pop_back();
+      evictions_++;
+    }
+  }
+
+  /// <summary>
+  /// Removes all entries
+  /// </summary>
+  void clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    index_.clear();
+    cost_ = 0;
+  }
+
+  /// <summary>
+  /// Usage statistics
+  /// </summary>
+  struct Statistics
+  {
+    size_t entries;
+    size_t cost;
+    size_t budget;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+  };
+
+  /// <summary>
+  /// returns the usage statistics
+  /// </summary>
+  Statistics getStatistics() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return Statistics{entries_.size(), cost_, budget_, hits_, misses_, evictions_};
+  }
+
+private:
+  struct Entry
+  {
+    Key key;
+    std::shared_ptr<const Value> value;
+    size_t cost;
+  };
+
+  mutable std::mutex mutex_;
+  std::list<Entry> entries_;
+  std::map<Key, typename std::list<Entry>::iterator> index_;
+  size_t budget_;
+  size_t cost_ = 0;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+  uint64_t evictions_ = 0;
+};
@@ -0,0 +1,140 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include "Size.hpp"
+
+/// <summary>
+/// Order of the pixels in the decoded buffer
+/// </summary>
+enum class OutputOrder : uint32_t {
+    /// <summary>
+    /// rows top to bottom, the default
+    /// </summary>
+    RowMajor = 0,
+
+    /// <summary>
+    /// tiles in row-major order, each tile a row-major block of
+    /// tileSize pixels
+    /// </summary>
+    TileMajor = 1,
+
+    /// <summary>
+    /// tiles in row-major order, each tile in Morton (Z) order
+    /// </summary>
+    Morton = 2
+};
+
+/// <summary>
+/// Layout of the decoded buffer.  For the tiled orders every tile occupies
+/// tileSize.width * tileSize.height pixels so tile n starts at
+/// n * tile bytes, tiles on the right and bottom edges are padded with
+/// zeros.  Morton tiles must have power of two dimensions, when the width
+/// and height differ the extra bits of the longer side are the most
+/// significant.  A tileSize of 0 x 0 makes the whole image one tile
+/// (rounded up to powers of two for Morton).  Pixels stay interleaved
+/// within the tiles.
+/// </summary>
+struct OutputLayout {
+    OutputOrder order {OutputOrder::RowMajor};
+    Size tileSize;
+};
+
+/// <summary>
+/// Geometry of an OutputLayout for an image size, RowMajor is one tile the
+/// size of the image
+/// </summary>
+struct OutputTiling {
+    OutputTiling(const OutputLayout &layout, const Size &imageSize)
+    : order(layout.order)
+    {
+        if (order == OutputOrder::RowMajor || (layout.tileSize.width == 0 && layout.tileSize.height == 0))
+        {
+            tileWidth = imageSize.width;
+            tileHeight = imageSize.height;
+        }
+        else
+        {
+            tileWidth = layout.tileSize.width;
+            tileHeight = layout.tileSize.height;
+        }
+        if (order == OutputOrder::Morton)
+        {
+            log2TileWidth = ceilLog2(tileWidth);
+            log2TileHeight = ceilLog2(tileHeight);
+            if ((layout.tileSize.width || layout.tileSize.height) &&
+                (tileWidth != 1u << log2TileWidth || tileHeight != 1u << log2TileHeight))
+            {
+                throw std::runtime_error("OutputLayout: Morton tiles must have power of two dimensions");
+            }
+            tileWidth = 1u << log2TileWidth;
+            tileHeight = 1u << log2TileHeight;
+        }
+        if (tileWidth == 0 || tileHeight == 0)
+        {
+            throw std::runtime_error("OutputLayout: invalid tile size");
+        }
+        tilesX = (imageSize.width + tileWidth - 1) / tileWidth;
+        tilesY = (imageSize.height + tileHeight - 1) / tileHeight;
+        tilePixels = (size_t)tileWidth * tileHeight;
+    }
+
+    /// <summary>
+    /// returns the number of pixels in the buffer, including the padding
+    /// </summary>
+    size_t getPixelCount() const
+    {
+        return tilePixels * tilesX * tilesY;
+    }
+
+    /// <summary>
+    /// returns the index of pixel (x, y) in the buffer
+    /// </summary>
+    size_t getPixelIndex(uint32_t x, uint32_t y) const
+    {
+        const size_t tile = (size_t)(y / tileHeight) * tilesX + x / tileWidth;
+        const uint32_t tx = x % tileWidth;
+        const uint32_t ty = y % tileHeight;
+        return tile * tilePixels + (order == OutputOrder::Morton ? mortonIndex(tx, ty) : (size_t)ty * tileWidth + tx);
+    }
+
+    /// <summary>
+    /// returns the Morton index of (x, y) within a tile
+    /// </summary>
+    size_t mortonIndex(uint32_t x, uint32_t y) const
+    {
+        const uint32_t common = std::min(log2TileWidth, log2TileHeight);
+        size_t index = 0;
+        for (uint32_t bit = 0; bit < common; bit++)
+        {
+            index |= (size_t)((x >> bit) & 1) << (2 * bit);
+            index |= (size_t)((y >> bit) & 1) << (2 * bit + 1);
+        }
+        return index | (size_t)(log2TileWidth > log2TileHeight ? x >> common : y >> common) << (2 * common);
+    }
+
+    static uint32_t ceilLog2(uint32_t value)
+    {
+        uint32_t bits = 0;
+        while (bits < 31 && (1u << bits) < value)
+        {
+            bits++;
+        }
+        return bits;
+    }
+
+    OutputOrder order;
+    uint32_t tileWidth {0};
+    uint32_t tileHeight {0};
+    uint32_t log2TileWidth {0};
+    uint32_t log2TileHeight {0};
+    uint32_t tilesX {0};
+    uint32_t tilesY {0};
+    size_t tilePixels {0};
+};
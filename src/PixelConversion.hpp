@@ -0,0 +1,395 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <limits>
+
+#include "SIMDLevel.hpp"
+
+#ifdef OPENJPHJS_X86_SIMD
+#include <immintrin.h>
+#endif
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
+// SIMD kernels for contiguous lines.  Each converts the longest prefix of
+// the line that is a whole number of iterations and returns its length,
+// the caller converts the rest.  Narrowing clamps exactly like the scalar
+// loops.
+
+#ifdef OPENJPHJS_X86_SIMD
+inline size_t narrowSSE2_(const int32_t *src, uint8_t *dst, size_t width)
+{
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16)
+  {
+    const __m128i lo = _mm_packs_epi32(_mm_loadu_si128((const __m128i *)(src + x)), _mm_loadu_si128((const __m128i *)(src + x + 4)));
+    const __m128i hi = _mm_packs_epi32(_mm_loadu_si128((const __m128i *)(src + x + 8)), _mm_loadu_si128((const __m128i *)(src + x + 12)));
+    _mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+  }
+  return x;
+}
+
+inline size_t narrowSSE2_(const int32_t *src, int16_t *dst, size_t width)
+{
+  size_t x = 0;
+  for (; x + 8 <= width; x += 8)
+  {
+    _mm_storeu_si128((__m128i *)(dst + x), _mm_packs_epi32(_mm_loadu_si128((const __m128i *)(src + x)), _mm_loadu_si128((const __m128i *)(src + x + 4))));
+  }
+  return x;
+}
+
+// SSE2 has no unsigned 32 to 16 bit pack, clamp to [0, 65535] with
+// compares, then shift into the signed range for the signed pack
+inline __m128i clampUnsigned16SSE2_(__m128i v)
+{
+  const __m128i max = _mm_set1_epi32(65535);
+  const __m128i above = _mm_cmpgt_epi32(v, max);
+  v = _mm_or_si128(_mm_andnot_si128(above, v), _mm_and_si128(above, max));
+  v = _mm_andnot_si128(_mm_cmplt_epi32(v, _mm_setzero_si128()), v);
+  return _mm_sub_epi32(v, _mm_set1_epi32(32768));
+}
+
+inline size_t narrowSSE2_(const int32_t *src, uint16_t *dst, size_t width)
+{
+  size_t x = 0;
+  for (; x + 8 <= width; x += 8)
+  {
+    const __m128i packed = _mm_packs_epi32(clampUnsigned16SSE2_(_mm_loadu_si128((const __m128i *)(src + x))),
+                                           clampUnsigned16SSE2_(_mm_loadu_si128((const __m128i *)(src + x + 4))));
+    _mm_storeu_si128((__m128i *)(dst + x), _mm_xor_si128(packed, _mm_set1_epi16((short)0x8000)));
+  }
+  return x;
+}
+
+inline size_t widenSSE2_(const uint8_t *src, int32_t *dst, size_t width)
+{
+  size_t x = 0;
+  const __m128i zero = _mm_setzero_si128();
+  for (; x + 16 <= width; x += 16)
+  {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+    const __m128i lo = _mm_unpacklo_epi8(v, zero);
+    const __m128i hi = _mm_unpackhi_epi8(v, zero);
+    _mm_storeu_si128((__m128i *)(dst + x), _mm_unpacklo_epi16(lo, zero));
+    _mm_storeu_si128((__m128i *)(dst + x + 4), _mm_unpackhi_epi16(lo, zero));
+    _mm_storeu_si128((__m128i *)(dst + x + 8), _mm_unpacklo_epi16(hi, zero));
+    _mm_storeu_si128((__m128i *)(dst + x + 12), _mm_unpackhi_epi16(hi, zero));
+  }
+  return x;
+}
+
+inline size_t widenSSE2_(const int16_t *src, int32_t *dst, size_t width)
+{
+  size_t x = 0;
+  for (; x + 8 <= width; x += 8)
+  {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+    _mm_storeu_si128((__m128i *)(dst + x), _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+    _mm_storeu_si128((__m128i *)(dst + x + 4), _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+  }
+  return x;
+}
+
+inline size_t widenSSE2_(const uint16_t *src, int32_t *dst, size_t width)
+{
+  size_t x = 0;
+  const __m128i zero = _mm_setzero_si128();
+  for (; x + 8 <= width; x += 8)
+  {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+    _mm_storeu_si128((__m128i *)(dst + x), _mm_unpacklo_epi16(v, zero));
+    _mm_storeu_si128((__m128i *)(dst + x + 4), _mm_unpackhi_epi16(v, zero));
+  }
+  return x;
+}
+
+// the AVX2 packs work within 128 bit lanes, the permutes put the lanes
+// back in order
+__attribute__((target("avx2"))) inline size_t narrowAVX2_(const int32_t *src, uint8_t *dst, size_t width)
+{
+  size_t x = 0;
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  for (; x + 32 <= width; x += 32)
+  {
+    const __m256i lo = _mm256_packs_epi32(_mm256_loadu_si256((const __m256i *)(src + x)), _mm256_loadu_si256((const __m256i *)(src + x + 8)));
+    const __m256i hi = _mm256_packs_epi32(_mm256_loadu_si256((const __m256i *)(src + x + 16)), _mm256_loadu_si256((const __m256i *)(src + x + 24)));
+    _mm256_storeu_si256((__m256i *)(dst + x), _mm256_permutevar8x32_epi32(_mm256_packus_epi16(lo, hi), order));
+  }
+  return x;
+}
+
+__attribute__((target("avx2"))) inline size_t narrowAVX2_(const int32_t *src, int16_t *dst, size_t width)
+{
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16)
+  {
+    const __m256i packed = _mm256_packs_epi32(_mm256_loadu_si256((const __m256i *)(src + x)), _mm256_loadu_si256((const __m256i *)(src + x + 8)));
+    _mm256_storeu_si256((__m256i *)(dst + x), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+  }
+  return x;
+}
+
+__attribute__((target("avx2"))) inline size_t narrowAVX2_(const int32_t *src, uint16_t *dst, size_t width)
+{
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16)
+  {
+    const __m256i packed = _mm256_packus_epi32(_mm256_loadu_si256((const __m256i *)(src + x)), _mm256_loadu_si256((const __m256i *)(src + x + 8)));
+    _mm256_storeu_si256((__m256i *)(dst + x), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+  }
+  return x;
+}
+
+__attribute__((target("avx2"))) inline size_t widenAVX2_(const uint8_t *src, int32_t *dst, size_t width)
+{
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16)
+  {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+    _mm256_storeu_si256((__m256i *)(dst + x), _mm256_cvtepu8_epi32(v));
+    _mm256_storeu_si256((__m256i *)(dst + x + 8), _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+  }
+  return x;
+}
+
+__attribute__((target("avx2"))) inline size_t widenAVX2_(const int16_t *src, int32_t *dst, size_t width)
+{
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16)
+  {
+    _mm256_storeu_si256((__m256i *)(dst + x), _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + x))));
+    _mm256_storeu_si256((__m256i *)(dst + x + 8), _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + x + 8))));
+  }
+  return x;
+}
+
+__attribute__((target("avx2"))) inline size_t widenAVX2_(const uint16_t *src, int32_t *dst, size_t width)
+{
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16)
+  {
+    _mm256_storeu_si256((__m256i *)(dst + x), _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + x))));
+    _mm256_storeu_si256((__m256i *)(dst + x + 8), _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + x + 8))));
+  }
+  return x;
+}
+#endif
+
+#ifdef __wasm_simd128__
+inline size_t narrowSIMD128_(const int32_t *src, uint8_t *dst, size_t width)
+{
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16)
+  {
+    const v128_t lo = wasm_i16x8_narrow_i32x4(wasm_v128_load(src + x), wasm_v128_load(src + x + 4));
+    const v128_t hi = wasm_i16x8_narrow_i32x4(wasm_v128_load(src + x + 8), wasm_v128_load(src + x + 12));
+    wasm_v128_store(dst + x, wasm_u8x16_narrow_i16x8(lo, hi));
+  }
+  return x;
+}
+
+inline size_t narrowSIMD128_(const int32_t *src, int16_t *dst, size_t width)
+{
+  size_t x = 0;
+  for (; x + 8 <= width; x += 8)
+  {
+    wasm_v128_store(dst + x, wasm_i16x8_narrow_i32x4(wasm_v128_load(src + x), wasm_v128_load(src + x + 4)));
+  }
+  return x;
+}
+
+inline size_t narrowSIMD128_(const int32_t *src, uint16_t *dst, size_t width)
+{
+  size_t x = 0;
+  for (; x + 8 <= width; x += 8)
+  {
+    wasm_v128_store(dst + x, wasm_u16x8_narrow_i32x4(wasm_v128_load(src + x), wasm_v128_load(src + x + 4)));
+  }
+  return x;
+}
+
+inline size_t widenSIMD128_(const uint8_t *src, int32_t *dst, size_t width)
+{
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16)
+  {
+    const v128_t v = wasm_v128_load(src + x);
+    const v128_t lo = wasm_u16x8_extend_low_u8x16(v);
+    const v128_t hi = wasm_u16x8_extend_high_u8x16(v);
+    wasm_v128_store(dst + x, wasm_u32x4_extend_low_u16x8(lo));
+    wasm_v128_store(dst + x + 4, wasm_u32x4_extend_high_u16x8(lo));
+    wasm_v128_store(dst + x + 8, wasm_u32x4_extend_low_u16x8(hi));
+    wasm_v128_store(dst + x + 12, wasm_u32x4_extend_high_u16x8(hi));
+  }
+  return x;
+}
+
+inline size_t widenSIMD128_(const int16_t *src, int32_t *dst, size_t width)
+{
+  size_t x = 0;
+  for (; x + 8 <= width; x += 8)
+  {
+    const v128_t v = wasm_v128_load(src + x);
+    wasm_v128_store(dst + x, wasm_i32x4_extend_low_i16x8(v));
+    wasm_v128_store(dst + x + 4, wasm_i32x4_extend_high_i16x8(v));
+  }
+  return x;
+}
+
+inline size_t widenSIMD128_(const uint16_t *src, int32_t *dst, size_t width)
+{
+  size_t x = 0;
+  for (; x + 8 <= width; x += 8)
+  {
+    const v128_t v = wasm_v128_load(src + x);
+    wasm_v128_store(dst + x, wasm_u32x4_extend_low_u16x8(v));
+    wasm_v128_store(dst + x + 4, wasm_u32x4_extend_high_u16x8(v));
+  }
+  return x;
+}
+#endif
+
+// Runs the narrowing kernel of the current SIMD level, see getSIMDLevel()
+template <typename T>
+inline size_t narrowSIMD_(const int32_t *src, T *dst, size_t width)
+{
+  switch (getSIMDLevel())
+  {
+#ifdef OPENJPHJS_X86_SIMD
+  case SIMDLevel::AVX2:
+    return narrowAVX2_(src, dst, width);
+  case SIMDLevel::SSE2:
+    return narrowSSE2_(src, dst, width);
+#endif
+#ifdef __wasm_simd128__
+  case SIMDLevel::SIMD128:
+    return narrowSIMD128_(src, dst, width);
+#endif
+  default:
+    return 0;
+  }
+}
+
+// Runs the widening kernel of the current SIMD level, see getSIMDLevel()
+template <typename T>
+inline size_t widenSIMD_(const T *src, int32_t *dst, size_t width)
+{
+  switch (getSIMDLevel())
+  {
+#ifdef OPENJPHJS_X86_SIMD
+  case SIMDLevel::AVX2:
+    return widenAVX2_(src, dst, width);
+  case SIMDLevel::SSE2:
+    return widenSSE2_(src, dst, width);
+#endif
+#ifdef __wasm_simd128__
+  case SIMDLevel::SIMD128:
+    return widenSIMD128_(src, dst, width);
+#endif
+  default:
+    return 0;
+  }
+}
+
+/// <summary>
+/// Narrows one line of 32 bit samples from OpenJPH to the output sample
+/// type T, clamping to the range of T (https://github.com/aous72/OpenJPH/issues/35).
+/// Every stride'th element of dst is written, which interleaves a component
+/// when stride is the number of components.  Contiguous lines use the SIMD
+/// kernels of getSIMDLevel().
+/// </summary>
+template <typename T>
+inline void narrowLine(const int32_t *src, T *dst, size_t width, size_t stride)
+{
+  const int32_t minValue = std::numeric_limits<T>::min();
+  const int32_t maxValue = std::numeric_limits<T>::max();
+  if (stride == 1)
+  {
+    // separate contiguous loop so the compiler can vectorize the tail
+    for (size_t x = narrowSIMD_(src, dst, width); x < width; x++)
+    {
+      dst[x] = (T)std::max(minValue, std::min(src[x], maxValue));
+    }
+  }
+  else
+  {
+    for (size_t x = 0; x < width; x++)
+    {
+      dst[x * stride] = (T)std::max(minValue, std::min(src[x], maxValue));
+    }
+  }
+}
+
+/// <summary>
+/// Widens one line of samples of type T to the 32 bit samples OpenJPH
+/// expects.  Every stride'th element of src is read, which deinterleaves a
+/// component when stride is the number of components.  Contiguous lines
+/// use the SIMD kernels of getSIMDLevel().
+/// </summary>
+template <typename T>
+inline void widenLine(const T *src, int32_t *dst, size_t width, size_t stride)
+{
+  if (stride == 1)
+  {
+    for (size_t x = widenSIMD_(src, dst, width); x < width; x++)
+    {
+      dst[x] = src[x];
+    }
+  }
+  else
+  {
+    for (size_t x = 0; x < width; x++)
+    {
+      dst[x] = src[x * stride];
+    }
+  }
+}
+
+/// <summary>
+/// Writes component of a decoded line into a row of the interleaved output
+/// buffer, selecting the sample type from the bit depth and signedness the
+/// same way the decoded buffer is laid out: 8 bit samples for bit depths up
+/// to 8, otherwise signed or unsigned 16 bit samples.
+/// </summary>
+inline void narrowLineToRow(const int32_t *src, uint8_t *row, size_t width, size_t componentCount, size_t component, size_t bitsPerSample, bool isSigned)
+{
+  if (bitsPerSample <= 8)
+  {
+    narrowLine<uint8_t>(src, row + component, width, componentCount);
+  }
+  else if (isSigned)
+  {
+    narrowLine<int16_t>(src, (int16_t *)row + component, width, componentCount);
+  }
+  else
+  {
+    narrowLine<uint16_t>(src, (uint16_t *)row + component, width, componentCount);
+  }
+}
+
+/// <summary>
+/// Reads component from a row of the interleaved source buffer into a line
+/// for the encoder.  The inverse of narrowLineToRow().
+/// </summary>
+inline void widenRowToLine(const uint8_t *row, int32_t *dst, size_t width, size_t componentCount, size_t component, size_t bitsPerSample, bool isSigned)
+{
+  if (bitsPerSample <= 8)
+  {
+    widenLine<uint8_t>(row + component, dst, width, componentCount);
+  }
+  else if (isSigned)
+  {
+    widenLine<int16_t>((const int16_t *)row + component, dst, width, componentCount);
+  }
+  else
+  {
+    widenLine<uint16_t>((const uint16_t *)row + component, dst, width, componentCount);
+  }
+}
@@ -0,0 +1,12 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+struct Rect {
+    Rect(uint32_t x = 0, uint32_t y = 0, uint32_t width = 0, uint32_t height = 0) : x(x), y(y), width(width), height(height) {}
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
\ No newline at end of file
@@ -0,0 +1,146 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+
+/// <summary>
+/// Instruction set used by the pixel conversion kernels in
+/// PixelConversion.hpp
+/// </summary>
+enum class SIMDLevel : uint32_t {
+    /// <summary>
+    /// plain C++ loops, available everywhere
+    /// </summary>
+    Scalar = 0,
+
+    /// <summary>
+    /// x86 SSE2, every x86-64 CPU
+    /// </summary>
+    SSE2 = 1,
+
+    /// <summary>
+    /// x86 AVX2, when the CPU supports it
+    /// </summary>
+    AVX2 = 2,
+
+    /// <summary>
+    /// WebAssembly 128 bit SIMD, WASM builds compiled with -msimd128
+    /// </summary>
+    SIMD128 = 3
+};
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define OPENJPHJS_X86_SIMD 1
+#endif
+
+/// <summary>
+/// returns the name of level as accepted by OPENJPHJS_SIMD_LEVEL
+/// </summary>
+inline const char *getSIMDLevelName(SIMDLevel level)
+{
+  switch (level)
+  {
+  case SIMDLevel::SSE2:
+    return "sse2";
+  case SIMDLevel::AVX2:
+    return "avx2";
+  case SIMDLevel::SIMD128:
+    return "simd128";
+  default:
+    return "scalar";
+  }
+}
+
+/// <summary>
+/// returns true if this build has kernels for level and the CPU runs them
+/// </summary>
+inline bool isSIMDLevelSupported(SIMDLevel level)
+{
+  switch (level)
+  {
+  case SIMDLevel::Scalar:
+    return true;
+#ifdef OPENJPHJS_X86_SIMD
+  case SIMDLevel::SSE2:
+    return true;
+  case SIMDLevel::AVX2:
+    return __builtin_cpu_supports("avx2");
+#endif
+#ifdef __wasm_simd128__
+  case SIMDLevel::SIMD128:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+/// <summary>
+/// returns the fastest level this build and CPU support
+/// </summary>
+inline SIMDLevel getSupportedSIMDLevel()
+{
+  for (SIMDLevel level : {SIMDLevel::SIMD128, SIMDLevel::AVX2, SIMDLevel::SSE2})
+  {
+    if (isSIMDLevelSupported(level))
+    {
+      return level;
+    }
+  }
+  return SIMDLevel::Scalar;
+}
+
+// The level the kernels use.  Starts at the supported level, or at the
+// one named by the OPENJPHJS_SIMD_LEVEL environment variable (scalar,
+// sse2, avx2 or simd128) if it is supported
+inline std::atomic<uint32_t> &simdLevel_()
+{
+  static std::atomic<uint32_t> level([] {
+    SIMDLevel initial = getSupportedSIMDLevel();
+    const char *name = getenv("OPENJPHJS_SIMD_LEVEL");
+    for (SIMDLevel candidate : {SIMDLevel::Scalar, SIMDLevel::SSE2, SIMDLevel::AVX2, SIMDLevel::SIMD128})
+    {
+      if (name && strcmp(name, getSIMDLevelName(candidate)) == 0 && isSIMDLevelSupported(candidate))
+      {
+        initial = candidate;
+      }
+    }
+    return (uint32_t)initial;
+  }());
+  return level;
+}
+
+/// <summary>
+/// returns the level the pixel conversion kernels currently use
+/// </summary>
+inline SIMDLevel getSIMDLevel()
+{
+  return (SIMDLevel)simdLevel_().load(std::memory_order_relaxed);
+}
+
+/// <summary>
+/// Forces the pixel conversion kernels to level for every encoder and
+/// decoder in the process, for benchmarking each level or working around
+/// a bad kernel on a specific CPU.  The OPENJPHJS_SIMD_LEVEL environment
+/// variable sets the initial level the same way.  Throws
+/// std::runtime_error if the level is not supported, see
+/// isSIMDLevelSupported().  The kernels of OpenJPH itself choose their
+/// instruction set once per process and are not affected.
+/// </summary>
+inline void setSIMDLevel(SIMDLevel level)
+{
+  if (!isSIMDLevelSupported(level))
+  {
+    throw std::runtime_error(std::string("setSIMDLevel: ") + getSIMDLevelName(level) + " is not supported");
+  }
+  simdLevel_().store((uint32_t)level, std::memory_order_relaxed);
+}
@@ -0,0 +1,526 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdexcept>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "CodestreamIndex.hpp"
+#include "FrameContainer.hpp"
+#include "XXHash64.hpp"
+
+// Sidecar metadata index layout, all integers little endian:
+//
+//   header   "HTJ2KIX1", u16 version, u16 record length, u32 path count,
+//            u64 record count, u64 path table offset,
+//            u64 XXH64 of the records and the path table
+//   records  one fixed length record per codestream:
+//              u32 path index, u32 frame index, u64 offset, u64 length,
+//              u32 width, u32 height, u32 image offset x, y,
+//              u32 tile width, height, u32 tile offset x, y,
+//              u16 component count, u8 bits per sample,
+//              u8 flags (1 signed, 2 color transform, 4 reversible),
+//              u8 decompositions, u8 progression order, u16 layers,
+//              u8 log2 codeblock width, height,
+//              u8 XRsiz, YRsiz of the first 4 components,
+//              u8 PPy << 4 | PPx per resolution, lowest first (33 entries),
+//              reserved up to the record length
+//   paths    u64 offset of each path from the path table offset, then the
+//            NUL terminated paths
+//
+// Readers accept records longer than they know so fields can be added at
+// the end without a new version.
+
+namespace SidecarIndexFormat
+{
+  const char Magic[8] = {'H', 'T', 'J', '2', 'K', 'I', 'X', '1'};
+  const uint16_t Version = 1;
+  const size_t HeaderLength = 40;
+  const size_t RecordLength = 112;
+  const size_t MaxDownSamples = 4;
+  const size_t MaxResolutions = 33;
+
+  enum Flags : uint8_t
+  {
+    Signed = 1,
+    ColorTransform = 2,
+    Reversible = 4
+  };
+}
+
+/// <summary>
+/// Metadata of one codestream in a sidecar index.  Downsampling is kept
+/// for the first four components only.
+/// </summary>
+struct SidecarRecord {
+    /// <summary>
+    /// File holding the codestream (see SidecarIndexReader::getPath()), the
+    /// frame number when the file is a FrameContainer (0 otherwise), and
+    /// where the codestream is in the file
+    /// </summary>
+    uint32_t pathIndex {0};
+    uint32_t frameIndex {0};
+    uint64_t offset {0};
+    uint64_t length {0};
+
+    Size imageSize;
+    uint32_t componentCount {0};
+    uint32_t bitsPerSample {0};
+    bool isSigned {false};
+    bool isUsingColorTransform {false};
+    Point downSamples[SidecarIndexFormat::MaxDownSamples];
+    Point imageOffset;
+    Size tileSize;
+    Point tileOffset;
+    uint32_t numDecompositions {0};
+    bool isReversible {false};
+    uint32_t progressionOrder {0};
+    Size blockDimensions;
+    Size precincts[SidecarIndexFormat::MaxResolutions];
+    uint32_t numLayers {0};
+
+    /// <summary>
+    /// returns the FrameInfo HTJ2KDecoder reports for the codestream, the
+    /// width and height are truncated if they exceed 16 bits
+    /// </summary>
+    FrameInfo getFrameInfo() const
+    {
+        FrameInfo frameInfo;
+        frameInfo.width = (uint16_t)imageSize.width;
+        frameInfo.height = (uint16_t)imageSize.height;
+        frameInfo.bitsPerSample = (uint8_t)bitsPerSample;
+        frameInfo.componentCount = (uint8_t)componentCount;
+        frameInfo.isSigned = isSigned;
+        frameInfo.isUsingColorTransform = isUsingColorTransform;
+        return frameInfo;
+    }
+};
+
+/// <summary>
+/// Reads a sidecar index written by SidecarIndexWriter.  The file is memory
+/// mapped and records are decoded on demand, so opening an index of
+/// millions of frames touches only its header.
+/// </summary>
+class SidecarIndexReader
+{
+public:
+  SidecarIndexReader() = default;
+  SidecarIndexReader(const SidecarIndexReader &) = delete;
+  SidecarIndexReader &operator=(const SidecarIndexReader &) = delete;
+
+  ~SidecarIndexReader()
+  {
+    close();
+  }
+
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+  /// <summary>
+  /// Memory maps an index file.  Throws std::runtime_error if the file
+  /// cannot be read or is not a sidecar index.
+  /// </summary>
+  void open(const std::string &path)
+  {
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0)
+    {
+      if (fd >= 0)
+      {
+        ::close(fd);
+      }
+      throw std::runtime_error("SidecarIndex: cannot open " + path);
+    }
+    void *mapping = status.st_size ? mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+      throw std::runtime_error("SidecarIndex: cannot map " + path);
+    }
+    mapping_ = mapping;
+    mappingSize_ = (size_t)status.st_size;
+    open((const uint8_t *)mapping, mappingSize_);
+  }
+#endif
+
+  /// <summary>
+  /// Reads an index already in memory.  The bytes must stay valid while
+  /// the reader is used.
+  /// </summary>
+  void open(const uint8_t *data, size_t size)
+  {
+    using namespace SidecarIndexFormat;
+    using FrameContainerFormat::readLittleEndian;
+    data_ = data;
+    size_ = size;
+    if (size < HeaderLength || memcmp(data, Magic, 8) != 0)
+    {
+      close();
+      throw std::runtime_error("SidecarIndex: not a sidecar index");
+    }
+    recordLength_ = readLittleEndian(data + 10, 2);
+    pathCount_ = readLittleEndian(data + 12, 4);
+    recordCount_ = readLittleEndian(data + 16, 8);
+    pathTableOffset_ = readLittleEndian(data + 24, 8);
+    if (readLittleEndian(data + 8, 2) != Version || recordLength_ < RecordLength ||
+        recordCount_ > (size - HeaderLength) / recordLength_ ||
+        pathTableOffset_ != HeaderLength + recordCount_ * recordLength_ ||
+        pathCount_ > (size - pathTableOffset_) / 8)
+    {
+      close();
+      throw std::runtime_error("SidecarIndex: unsupported or corrupt header");
+    }
+  }
+
+  /// <summary>
+  /// Unmaps the file
+  /// </summary>
+  void close()
+  {
+#if !defined(__EMSCRIPTEN__) && !defined(_WIN32)
+    if (mapping_)
+    {
+      munmap(mapping_, mappingSize_);
+    }
+#endif
+    mapping_ = nullptr;
+    mappingSize_ = 0;
+    data_ = nullptr;
+    size_ = 0;
+    recordCount_ = 0;
+    pathCount_ = 0;
+  }
+
+  /// <summary>
+  /// Checks the records and paths against the hash in the header.  This
+  /// reads the whole file, open() does not.
+  /// </summary>
+  bool verify() const
+  {
+    return data_ && XXHash64::hash(data_ + SidecarIndexFormat::HeaderLength, size_ - SidecarIndexFormat::HeaderLength) ==
+                        FrameContainerFormat::readLittleEndian(data_ + 32, 8);
+  }
+
+  /// <summary>
+  /// returns the number of codestreams in the index
+  /// </summary>
+  size_t getRecordCount() const
+  {
+    return (size_t)recordCount_;
+  }
+
+  /// <summary>
+  /// Decodes a record.  Only the bytes of that record are read.
+  /// </summary>
+  SidecarRecord getRecord(size_t record) const
+  {
+    using namespace SidecarIndexFormat;
+    using FrameContainerFormat::readLittleEndian;
+    if (record >= recordCount_)
+    {
+      throw std::runtime_error("SidecarIndex: record " + std::to_string(record) + " out of range");
+    }
+    const uint8_t *p = data_ + HeaderLength + record * recordLength_;
+    SidecarRecord result;
+    result.pathIndex = (uint32_t)readLittleEndian(p, 4);
+    result.frameIndex = (uint32_t)readLittleEndian(p + 4, 4);
+    result.offset = readLittleEndian(p + 8, 8);
+    result.length = readLittleEndian(p + 16, 8);
+    result.imageSize = Size((uint32_t)readLittleEndian(p + 24, 4), (uint32_t)readLittleEndian(p + 28, 4));
+    result.imageOffset = Point((uint32_t)readLittleEndian(p + 32, 4), (uint32_t)readLittleEndian(p + 36, 4));
+    result.tileSize = Size((uint32_t)readLittleEndian(p + 40, 4), (uint32_t)readLittleEndian(p + 44, 4));
+    result.tileOffset = Point((uint32_t)readLittleEndian(p + 48, 4), (uint32_t)readLittleEndian(p + 52, 4));
+    result.componentCount = (uint32_t)readLittleEndian(p + 56, 2);
+    result.bitsPerSample = p[58];
+    result.isSigned = (p[59] & Signed) != 0;
+    result.isUsingColorTransform = (p[59] & ColorTransform) != 0;
+    result.isReversible = (p[59] & Reversible) != 0;
+    result.numDecompositions = p[60];
+    result.progressionOrder = p[61];
+    result.numLayers = (uint32_t)readLittleEndian(p + 62, 2);
+    result.blockDimensions = Size(1u << p[64], 1u << p[65]);
+    for (size_t c = 0; c < MaxDownSamples; c++)
+    {
+      result.downSamples[c] = Point(p[66 + 2 * c], p[67 + 2 * c]);
+    }
+    for (size_t r = 0; r < MaxResolutions; r++)
+    {
+      result.precincts[r] = Size(1u << (p[74 + r] & 0xF), 1u << (p[74 + r] >> 4));
+    }
+    return result;
+  }
+
+  /// <summary>
+  /// returns the number of files referenced by the records
+  /// </summary>
+  size_t getPathCount() const
+  {
+    return (size_t)pathCount_;
+  }
+
+  /// <summary>
+  /// returns a file path as given to SidecarIndexWriter::addPath()
+  /// </summary>
+  std::string getPath(size_t pathIndex) const
+  {
+    if (pathIndex >= pathCount_)
+    {
+      throw std::runtime_error("SidecarIndex: path " + std::to_string(pathIndex) + " out of range");
+    }
+    const uint64_t offset = pathTableOffset_ + FrameContainerFormat::readLittleEndian(data_ + pathTableOffset_ + 8 * pathIndex, 8);
+    const void *end = offset < size_ ? memchr(data_ + offset, 0, (size_t)(size_ - offset)) : nullptr;
+    if (!end)
+    {
+      throw std::runtime_error("SidecarIndex: corrupt path table");
+    }
+    return std::string((const char *)data_ + offset, (const char *)end);
+  }
+
+private:
+  void *mapping_ = nullptr;
+  size_t mappingSize_ = 0;
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  uint64_t recordLength_ = 0;
+  uint64_t recordCount_ = 0;
+  uint64_t pathCount_ = 0;
+  uint64_t pathTableOffset_ = 0;
+};
+
+/// <summary>
+/// Writes a sidecar index.  Records are written as they are added, the
+/// paths and the header are written by close().  The index is created
+/// under a temporary name and renamed over the destination when complete,
+/// so readers never see a partial index.
+/// </summary>
+class SidecarIndexWriter
+{
+public:
+  SidecarIndexWriter() = default;
+  SidecarIndexWriter(const SidecarIndexWriter &) = delete;
+  SidecarIndexWriter &operator=(const SidecarIndexWriter &) = delete;
+
+  ~SidecarIndexWriter()
+  {
+    if (file_)
+    {
+      fclose(file_);
+      remove(temporaryPath_.c_str());
+    }
+  }
+
+  /// <summary>
+  /// Starts a new index, replacing path once close() succeeds
+  /// </summary>
+  void create(const std::string &path)
+  {
+    if (file_)
+    {
+      throw std::runtime_error("SidecarIndex: already open");
+    }
+    path_ = path;
+    temporaryPath_ = path + ".tmp";
+    file_ = fopen(temporaryPath_.c_str(), "wb");
+    if (!file_)
+    {
+      throw std::runtime_error("SidecarIndex: cannot create " + temporaryPath_);
+    }
+    const std::vector<uint8_t> header(SidecarIndexFormat::HeaderLength);
+    hash_.reset();
+    writeBytes_(header.data(), header.size(), false);
+    paths_.clear();
+    recordCount_ = 0;
+  }
+
+  /// <summary>
+  /// Adds a file path and returns its index for the records
+  /// </summary>
+  uint32_t addPath(const std::string &path)
+  {
+    paths_.push_back(path);
+    return (uint32_t)(paths_.size() - 1);
+  }
+
+  /// <summary>
+  /// Adds a record
+  /// </summary>
+  void addRecord(const SidecarRecord &record)
+  {
+    using namespace SidecarIndexFormat;
+    using FrameContainerFormat::appendLittleEndian;
+    if (!file_)
+    {
+      throw std::runtime_error("SidecarIndex: not open");
+    }
+    if (record.pathIndex >= paths_.size() || record.componentCount > UINT16_MAX || record.bitsPerSample > UINT8_MAX ||
+        record.numDecompositions >= MaxResolutions || record.progressionOrder > UINT8_MAX || record.numLayers > UINT16_MAX)
+    {
+      throw std::runtime_error("SidecarIndex: record cannot be stored");
+    }
+    std::vector<uint8_t> bytes;
+    bytes.reserve(RecordLength);
+    appendLittleEndian(bytes, record.pathIndex, 4);
+    appendLittleEndian(bytes, record.frameIndex, 4);
+    appendLittleEndian(bytes, record.offset, 8);
+    appendLittleEndian(bytes, record.length, 8);
+    appendLittleEndian(bytes, record.imageSize.width, 4);
+    appendLittleEndian(bytes, record.imageSize.height, 4);
+    appendLittleEndian(bytes, record.imageOffset.x, 4);
+    appendLittleEndian(bytes, record.imageOffset.y, 4);
+    appendLittleEndian(bytes, record.tileSize.width, 4);
+    appendLittleEndian(bytes, record.tileSize.height, 4);
+    appendLittleEndian(bytes, record.tileOffset.x, 4);
+    appendLittleEndian(bytes, record.tileOffset.y, 4);
+    appendLittleEndian(bytes, record.componentCount, 2);
+    bytes.push_back((uint8_t)record.bitsPerSample);
+    bytes.push_back((uint8_t)((record.isSigned ? Signed : 0) | (record.isUsingColorTransform ? ColorTransform : 0) |
+                              (record.isReversible ? Reversible : 0)));
+    bytes.push_back((uint8_t)record.numDecompositions);
+    bytes.push_back((uint8_t)record.progressionOrder);
+    appendLittleEndian(bytes, record.numLayers, 2);
+    bytes.push_back(log2_(record.blockDimensions.width));
+    bytes.push_back(log2_(record.blockDimensions.height));
+    for (size_t c = 0; c < MaxDownSamples; c++)
+    {
+      bytes.push_back((uint8_t)record.downSamples[c].x);
+      bytes.push_back((uint8_t)record.downSamples[c].y);
+    }
+    for (size_t r = 0; r < MaxResolutions; r++)
+    {
+      bytes.push_back((uint8_t)(log2_(record.precincts[r].height) << 4 | log2_(record.precincts[r].width)));
+    }
+    bytes.resize(RecordLength);
+    writeBytes_(bytes.data(), bytes.size());
+    recordCount_++;
+  }
+
+  /// <summary>
+  /// Reads the main header of a codestream and adds its record, the
+  /// tile data is not touched.  Throws std::runtime_error if the main
+  /// header is malformed.
+  /// </summary>
+  void addCodestream(uint32_t pathIndex, uint32_t frameIndex, uint64_t offset, const uint8_t *data, size_t size)
+  {
+    index_.parseHeader(data, size);
+    const CodestreamHeader header = index_.getHeader();
+    SidecarRecord record;
+    record.pathIndex = pathIndex;
+    record.frameIndex = frameIndex;
+    record.offset = offset;
+    record.length = size;
+    record.imageSize = header.imageSize;
+    record.componentCount = header.componentCount;
+    record.bitsPerSample = header.bitsPerSample;
+    record.isSigned = header.isSigned;
+    record.isUsingColorTransform = header.isUsingColorTransform;
+    for (size_t c = 0; c < header.downSamples.size() && c < SidecarIndexFormat::MaxDownSamples; c++)
+    {
+      record.downSamples[c] = header.downSamples[c];
+    }
+    record.imageOffset = header.imageOffset;
+    record.tileSize = header.tileSize;
+    record.tileOffset = header.tileOffset;
+    record.numDecompositions = header.numDecompositions;
+    record.isReversible = header.isReversible;
+    record.progressionOrder = header.progressionOrder;
+    record.blockDimensions = header.blockDimensions;
+    for (size_t r = 0; r < header.precincts.size(); r++)
+    {
+      record.precincts[r] = header.precincts[r];
+    }
+    record.numLayers = header.numLayers;
+    addRecord(record);
+  }
+
+  /// <summary>
+  /// returns the number of records added
+  /// </summary>
+  uint64_t getRecordCount() const
+  {
+    return recordCount_;
+  }
+
+  /// <summary>
+  /// Writes the paths and the header and moves the index into place
+  /// </summary>
+  void close()
+  {
+    using namespace SidecarIndexFormat;
+    using FrameContainerFormat::appendLittleEndian;
+    if (!file_)
+    {
+      return;
+    }
+    std::vector<uint8_t> table;
+    uint64_t stringOffset = 8 * paths_.size();
+    for (const std::string &path : paths_)
+    {
+      appendLittleEndian(table, stringOffset, 8);
+      stringOffset += path.size() + 1;
+    }
+    for (const std::string &path : paths_)
+    {
+      table.insert(table.end(), path.c_str(), path.c_str() + path.size() + 1);
+    }
+    writeBytes_(table.data(), table.size());
+
+    std::vector<uint8_t> header(Magic, Magic + 8);
+    appendLittleEndian(header, Version, 2);
+    appendLittleEndian(header, RecordLength, 2);
+    appendLittleEndian(header, paths_.size(), 4);
+    appendLittleEndian(header, recordCount_, 8);
+    appendLittleEndian(header, HeaderLength + recordCount_ * RecordLength, 8);
+    appendLittleEndian(header, hash_.digest(), 8);
+    FILE *file = file_;
+    file_ = nullptr;
+    const bool written = fseek(file, 0, SEEK_SET) == 0 && fwrite(header.data(), 1, header.size(), file) == header.size();
+    if (fclose(file) != 0 || !written || rename(temporaryPath_.c_str(), path_.c_str()) != 0)
+    {
+      remove(temporaryPath_.c_str());
+      throw std::runtime_error("SidecarIndex: cannot write " + path_);
+    }
+  }
+
+private:
+  void writeBytes_(const void *data, size_t size, bool hashed = true)
+  {
+    if (hashed)
+    {
+      hash_.update(data, size);
+    }
+    if (fwrite(data, 1, size, file_) != size)
+    {
+      throw std::runtime_error("SidecarIndex: write failed");
+    }
+  }
+
+  static uint8_t log2_(uint32_t value)
+  {
+    uint8_t bits = 0;
+    while (bits < 15 && (1u << (bits + 1)) <= value)
+    {
+      bits++;
+    }
+    return bits;
+  }
+
+  FILE *file_ = nullptr;
+  std::string path_;
+  std::string temporaryPath_;
+  std::vector<std::string> paths_;
+  uint64_t recordCount_ = 0;
+  XXHash64 hash_;
+  CodestreamIndex index_;
+};
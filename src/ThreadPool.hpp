@@ -0,0 +1,183 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// Fixed size pool of worker threads running tasks in submission order.
+/// HTJ2KDecoder and HTJ2KEncoder are not thread safe, use one instance per
+/// task (or per worker) when decoding on the pool.  Native builds only.
+/// </summary>
+class ThreadPool
+{
+public:
+  /// <summary>
+  /// Starts threadCount workers, 0 uses the number of hardware threads
+  /// </summary>
+  explicit ThreadPool(size_t threadCount = 0)
+  {
+    if (threadCount == 0)
+    {
+      threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threadCount; i++)
+    {
+      workers_.emplace_back([this] { run_(); });
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /// <summary>
+  /// Runs the tasks already queued and stops the workers
+  /// </summary>
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wakeup_.notify_all();
+    for (std::thread &worker : workers_)
+    {
+      worker.join();
+    }
+  }
+
+  /// <summary>
+  /// Queues a task.  Tasks must not throw, catch and report errors inside
+  /// the task.
+  /// </summary>
+  void post(std::function<void()> task)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(task));
+    }
+    wakeup_.notify_one();
+  }
+
+  /// <summary>
+  /// Calls fn(0) to fn(count - 1) on the workers and the calling thread and
+  /// returns once all calls have finished.  The calling thread takes part,
+  /// so this can be called from a task running on the same pool without
+  /// deadlocking.  If a call throws, the indices not started yet are
+  /// skipped and the first exception is rethrown.
+  /// </summary>
+  void parallelFor(size_t count, const std::function<void(size_t)> &fn)
+  {
+    struct State
+    {
+      std::atomic<size_t> next {0};
+      size_t finished = 0;
+      bool failed = false;
+      std::exception_ptr error;
+      std::mutex mutex;
+      std::condition_variable done;
+    };
+    const std::shared_ptr<State> state = std::make_shared<State>();
+    const size_t total = count;
+    const std::function<void(size_t)> *function = &fn;
+
+    // helpers that start after every index was claimed never touch fn
+    auto work = [state, total, function]() {
+      size_t index;
+      while ((index = state->next.fetch_add(1)) < total)
+      {
+        std::exception_ptr error;
+        bool skip;
+        {
+          std::lock_guard<std::mutex> lock(state->mutex);
+          skip = state->failed;
+        }
+        if (!skip)
+        {
+          try
+          {
+            (*function)(index);
+          }
+          catch (...)
+          {
+            error = std::current_exception();
+          }
+        }
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (error && !state->failed)
+        {
+          state->failed = true;
+          state->error = error;
+        }
+        if (++state->finished == total)
+        {
+          state->done.notify_all();
+        }
+      }
+    };
+    for (size_t i = 1; i < std::min(count, workers_.size() + 1); i++)
+    {
+      post(work);
+    }
+    work();
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&] { return state->finished == total; });
+    if (state->error)
+    {
+      std::rethrow_exception(state->error);
+    }
+  }
+
+  /// <summary>
+  /// returns the number of tasks waiting for a worker
+  /// </summary>
+  size_t getQueueDepth() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tasks_.size();
+  }
+
+  /// <summary>
+  /// returns the number of worker threads
+  /// </summary>
+  size_t getThreadCount() const
+  {
+    return workers_.size();
+  }
+
+private:
+  void run_()
+  {
+    while (true)
+    {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wakeup_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+        if (tasks_.empty())
+        {
+          return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+  mutable std::mutex mutex_;
+  std::condition_variable wakeup_;
+  std::deque<std::function<void()>> tasks_;
+  std::vector<std::thread> workers_;
+  bool stopping_ = false;
+};
@@ -0,0 +1,361 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#include "CodestreamIndex.hpp"
+#include "HTJ2KDecoder.hpp"
+#include "LRUCache.hpp"
+#include "Rect.hpp"
+#include "ThreadPool.hpp"
+
+/// <summary>
+/// Settings for VirtualImage
+/// </summary>
+struct VirtualImageSettings {
+    /// <summary>
+    /// Maximum bytes of decoded tiles kept in memory
+    /// </summary>
+    size_t memoryBudget {256 << 20};
+
+    /// <summary>
+    /// Number of background threads decoding the tiles around the last
+    /// request, 0 disables prefetching
+    /// </summary>
+    size_t prefetchThreads {1};
+};
+
+/// <summary>
+/// Lazily decoded view of a (large) HTJ2K image for pan and zoom.
+/// getPixels() decodes only the tiles the requested area touches that are
+/// not cached yet, each tile cut out of the codestream with
+/// CodestreamIndex and decoded at the requested decomposition level.
+/// Decoded tiles are kept in an LRU cache within the memory budget, and
+/// after each request the ring of tiles around it is decoded in the
+/// background so panning finds them ready.  Tiles are the unit of work, so
+/// images encoded without tiles are decoded whole (at the requested
+/// level).  Native builds only.
+/// </summary>
+class VirtualImage
+{
+public:
+  /// <summary>
+  /// Opens the codestream at data without copying it, the bytes must stay
+  /// valid for the lifetime of the VirtualImage.  Throws std::runtime_error
+  /// if the codestream cannot be indexed.
+  /// </summary>
+  VirtualImage(const uint8_t *data, size_t size, const VirtualImageSettings &settings = VirtualImageSettings())
+      : data_(data), size_(size), tiles_(settings.memoryBudget)
+  {
+    open_(settings);
+  }
+
+  /// <summary>
+  /// Opens a codestream, taking ownership of the bytes
+  /// </summary>
+  VirtualImage(std::vector<uint8_t> encoded, const VirtualImageSettings &settings = VirtualImageSettings())
+      : encoded_(std::move(encoded)), data_(encoded_.data()), size_(encoded_.size()), tiles_(settings.memoryBudget)
+  {
+    open_(settings);
+  }
+
+  VirtualImage(const VirtualImage &) = delete;
+  VirtualImage &operator=(const VirtualImage &) = delete;
+
+  /// <summary>
+  /// Drops the queued prefetches and waits for the running ones
+  /// </summary>
+  ~VirtualImage()
+  {
+    closing_ = true;
+    pool_.reset();
+  }
+
+  /// <summary>
+  /// returns the FrameInfo of the full resolution image
+  /// </summary>
+  const FrameInfo &getFrameInfo() const
+  {
+    return frameInfo_;
+  }
+
+  /// <summary>
+  /// returns the number of wavelet decompositions, the highest level
+  /// getPixels() accepts
+  /// </summary>
+  size_t getNumDecompositions() const
+  {
+    return index_.getNumDecompositions();
+  }
+
+  /// <summary>
+  /// returns the image size at a decomposition level
+  /// </summary>
+  Size getSizeAtDecompositionLevel(uint32_t decompositionLevel) const
+  {
+    return index_.getSizeAtDecompositionLevel(decompositionLevel);
+  }
+
+  /// <summary>
+  /// Returns the pixels of rect in the image at decompositionLevel (rect is
+  /// in the coordinates of that level, and is clipped to the image).  The
+  /// pixels are interleaved like HTJ2KDecoder::getDecodedBytes() with rows
+  /// of rect.width pixels.
+  /// </summary>
+  std::vector<uint8_t> getPixels(Rect rect, uint32_t decompositionLevel)
+  {
+    if (decompositionLevel > index_.getNumDecompositions())
+    {
+      throw std::runtime_error("VirtualImage: decomposition level " + std::to_string(decompositionLevel) + " is not available");
+    }
+    const Size size = index_.getSizeAtDecompositionLevel(decompositionLevel);
+    rect.x = std::min(rect.x, size.width);
+    rect.y = std::min(rect.y, size.height);
+    rect.width = std::min(rect.width, size.width - rect.x);
+    rect.height = std::min(rect.height, size.height - rect.y);
+
+    const size_t rowBytes = (size_t)rect.width * bytesPerPixel_;
+    std::vector<uint8_t> pixels(rowBytes * rect.height);
+    const std::vector<uint32_t> tileIndices = index_.getTilesInRect(rect, decompositionLevel);
+    for (uint32_t tileIndex : tileIndices)
+    {
+      std::shared_ptr<const DecodedTile> tile = getTile_(tileIndex, decompositionLevel);
+      const uint32_t x0 = std::max(rect.x, tile->rect.x);
+      const uint32_t y0 = std::max(rect.y, tile->rect.y);
+      const uint32_t x1 = std::min(rect.x + rect.width, tile->rect.x + tile->rect.width);
+      const uint32_t y1 = std::min(rect.y + rect.height, tile->rect.y + tile->rect.height);
+      for (uint32_t y = y0; y < y1; y++)
+      {
+        memcpy(&pixels[(y - rect.y) * rowBytes + (size_t)(x0 - rect.x) * bytesPerPixel_],
+               &tile->pixels[((size_t)(y - tile->rect.y) * tile->rect.width + (x0 - tile->rect.x)) * bytesPerPixel_],
+               (size_t)(x1 - x0) * bytesPerPixel_);
+      }
+    }
+    prefetchAround_(tileIndices, decompositionLevel);
+    return pixels;
+  }
+
+  /// <summary>
+  /// Usage statistics
+  /// </summary>
+  struct Statistics
+  {
+    uint64_t tilesDecoded;
+    uint64_t tilesPrefetched;
+    uint64_t cacheHits;
+    uint64_t cacheMisses;
+    size_t cachedBytes;
+  };
+
+  /// <summary>
+  /// returns the usage statistics
+  /// </summary>
+  Statistics getStatistics() const
+  {
+    const auto cache = tiles_.getStatistics();
+    return Statistics{tilesDecoded_, tilesPrefetched_, cache.hits, cache.misses, cache.cost};
+  }
+
+private:
+  struct DecodedTile
+  {
+    std::vector<uint8_t> pixels;
+    Rect rect;
+  };
+
+  typedef std::shared_ptr<const DecodedTile> TilePointer;
+
+  // decomposition level in the high bits, tile index in the low bits
+  static uint64_t key_(uint32_t tileIndex, uint32_t decompositionLevel)
+  {
+    return ((uint64_t)decompositionLevel << 32) | tileIndex;
+  }
+
+  void open_(const VirtualImageSettings &settings)
+  {
+    index_.parse(data_, size_);
+
+    // the sample format from the first tile, the size from the index
+    HTJ2KDecoder decoder;
+    index_.extractTile(data_, size_, 0, decoder.getEncodedBytes());
+    decoder.readHeader();
+    frameInfo_ = decoder.getFrameInfo();
+    const Size size = index_.getImageSize();
+    if (size.width > USHRT_MAX || size.height > USHRT_MAX)
+    {
+      throw std::runtime_error("VirtualImage: image dimensions exceed the supported range");
+    }
+    frameInfo_.width = (uint16_t)size.width;
+    frameInfo_.height = (uint16_t)size.height;
+    bytesPerPixel_ = frameInfo_.componentCount * ((frameInfo_.bitsPerSample + 8 - 1) / 8);
+    if (settings.prefetchThreads)
+    {
+      pool_.reset(new ThreadPool(settings.prefetchThreads));
+    }
+  }
+
+  // Returns a decoded tile from the cache, waiting for it if another
+  // thread is already decoding it, or decodes it on this thread
+  TilePointer getTile_(uint32_t tileIndex, uint32_t decompositionLevel)
+  {
+    const uint64_t key = key_(tileIndex, decompositionLevel);
+    TilePointer cached = tiles_.get(key);
+    if (cached)
+    {
+      return cached;
+    }
+
+    std::promise<TilePointer> promise;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      auto pending = pending_.find(key);
+      if (pending != pending_.end())
+      {
+        std::shared_future<TilePointer> result = pending->second;
+        lock.unlock();
+        return result.get();
+      }
+      // the tile may have been finished between the cache lookup and here,
+      // the miss is already counted
+      cached = tiles_.contains(key) ? tiles_.get(key) : nullptr;
+      if (cached)
+      {
+        return cached;
+      }
+      pending_[key] = promise.get_future().share();
+    }
+
+    TilePointer tile;
+    try
+    {
+      tile = decodeTile_(tileIndex, decompositionLevel);
+      tiles_.put(key, tile, tile->pixels.size());
+      promise.set_value(tile);
+    }
+    catch (...)
+    {
+      promise.set_exception(std::current_exception());
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_.erase(key);
+      throw;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.erase(key);
+    return tile;
+  }
+
+  TilePointer decodeTile_(uint32_t tileIndex, uint32_t decompositionLevel)
+  {
+    // one decoder per thread keeps its buffers between tiles
+    thread_local HTJ2KDecoder decoder;
+    std::shared_ptr<DecodedTile> tile = std::make_shared<DecodedTile>();
+    index_.extractTile(data_, size_, tileIndex, decoder.getEncodedBytes());
+    decoder.setDecodedBytes(&tile->pixels);
+    try
+    {
+      decoder.decodeSubResolution(decompositionLevel);
+    }
+    catch (...)
+    {
+      decoder.setDecodedBytes(0);
+      throw;
+    }
+    decoder.setDecodedBytes(0);
+    tile->rect = index_.getTileRect(tileIndex, decompositionLevel);
+    if (tile->pixels.size() != (size_t)tile->rect.width * tile->rect.height * bytesPerPixel_)
+    {
+      throw std::runtime_error("VirtualImage: decoded tile " + std::to_string(tileIndex) + " does not match the tile size");
+    }
+    tilesDecoded_++;
+    return tile;
+  }
+
+  // Queues the tiles bordering the requested ones that are neither cached
+  // nor being decoded.  Requests made while the previous ring is still
+  // queued replace it, so fast panning does not build up a backlog
+  void prefetchAround_(const std::vector<uint32_t> &tileIndices, uint32_t decompositionLevel)
+  {
+    if (!pool_ || tileIndices.empty())
+    {
+      return;
+    }
+    const uint32_t tilesX = index_.getTilesX();
+    const uint32_t tilesY = index_.getTilesY();
+    uint32_t column0 = tilesX, row0 = tilesY, column1 = 0, row1 = 0;
+    for (uint32_t tileIndex : tileIndices)
+    {
+      column0 = std::min(column0, tileIndex % tilesX);
+      column1 = std::max(column1, tileIndex % tilesX);
+      row0 = std::min(row0, tileIndex / tilesX);
+      row1 = std::max(row1, tileIndex / tilesX);
+    }
+    column0 = column0 ? column0 - 1 : 0;
+    row0 = row0 ? row0 - 1 : 0;
+    column1 = std::min(column1 + 1, tilesX - 1);
+    row1 = std::min(row1 + 1, tilesY - 1);
+
+    const uint64_t generation = ++prefetchGeneration_;
+    for (uint32_t row = row0; row <= row1; row++)
+    {
+      for (uint32_t column = column0; column <= column1; column++)
+      {
+        const uint32_t tileIndex = row * tilesX + column;
+        const uint64_t key = key_(tileIndex, decompositionLevel);
+        if (std::find(tileIndices.begin(), tileIndices.end(), tileIndex) != tileIndices.end() || tiles_.contains(key))
+        {
+          continue;
+        }
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (pending_.count(key))
+          {
+            continue;
+          }
+        }
+        pool_->post([this, tileIndex, decompositionLevel, generation] {
+          if (closing_ || generation != prefetchGeneration_)
+          {
+            return;
+          }
+          try
+          {
+            getTile_(tileIndex, decompositionLevel);
+            tilesPrefetched_++;
+          }
+          catch (...)
+          {
+            // reported when the tile is requested
+          }
+        });
+      }
+    }
+  }
+
+  std::vector<uint8_t> encoded_;
+  const uint8_t *data_;
+  size_t size_;
+  CodestreamIndex index_;
+  FrameInfo frameInfo_;
+  size_t bytesPerPixel_ = 0;
+  LRUCache<uint64_t, DecodedTile> tiles_;
+  std::mutex mutex_;
+  std::map<uint64_t, std::shared_future<TilePointer>> pending_;
+  std::atomic<uint64_t> tilesDecoded_{0};
+  std::atomic<uint64_t> tilesPrefetched_{0};
+  std::atomic<uint64_t> prefetchGeneration_{0};
+  std::atomic<bool> closing_{false};
+  // last so the workers stop before the members they use are destroyed
+  std::unique_ptr<ThreadPool> pool_;
+};
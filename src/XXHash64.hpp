@@ -0,0 +1,192 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * XXHash64 is a streaming implementation of the 64 bit xxHash algorithm
+ * (XXH64).  Data can be fed in chunks of any size via update() and the
+ * resulting digest is identical to hashing all of the bytes in one call.
+ * This allows the decoder and encoder to hash pixel rows while they are
+ * still in cache instead of making a separate pass over the full frame.
+ */
+class XXHash64
+{
+public:
+  /**  A constructor */
+  explicit XXHash64(uint64_t seed = 0)
+  {
+    reset(seed);
+  }
+
+  /** Call this function to start a new hash
+   *
+   *  @param seed is the seed for the hash, 0 by default
+   */
+  void reset(uint64_t seed = 0)
+  {
+    seed_ = seed;
+    v_[0] = seed + Prime1 + Prime2;
+    v_[1] = seed + Prime2;
+    v_[2] = seed;
+    v_[3] = seed - Prime1;
+    totalLength_ = 0;
+    bufferSize_ = 0;
+  }
+
+  /** Call this function to add bytes to the hash
+   *
+   *  @param data is the address of the bytes to add
+   *  @param length is the number of bytes to add
+   */
+  void update(const void *data, size_t length)
+  {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    const uint8_t *const end = p + length;
+    totalLength_ += length;
+
+    // top up a partially filled stripe from a previous call first
+    if (bufferSize_ + length < StripeSize)
+    {
+      memcpy(buffer_ + bufferSize_, p, length);
+      bufferSize_ += length;
+      return;
+    }
+    if (bufferSize_ > 0)
+    {
+      const size_t fill = StripeSize - bufferSize_;
+      memcpy(buffer_ + bufferSize_, p, fill);
+      p += fill;
+      processStripe_(buffer_);
+      bufferSize_ = 0;
+    }
+
+    while (p + StripeSize <= end)
+    {
+      processStripe_(p);
+      p += StripeSize;
+    }
+
+    bufferSize_ = end - p;
+    memcpy(buffer_, p, bufferSize_);
+  }
+
+  /** Call this function to get the hash of all bytes added so far.
+   *
+   *  The state is not modified, so more bytes may be added afterwards.
+   *
+   *  @return the 64 bit hash
+   */
+  uint64_t digest() const
+  {
+    uint64_t h;
+    if (totalLength_ >= StripeSize)
+    {
+      h = rotl_(v_[0], 1) + rotl_(v_[1], 7) + rotl_(v_[2], 12) + rotl_(v_[3], 18);
+      for (int i = 0; i < 4; i++)
+      {
+        h = mergeRound_(h, v_[i]);
+      }
+    }
+    else
+    {
+      h = seed_ + Prime5;
+    }
+    h += totalLength_;
+
+    const uint8_t *p = buffer_;
+    const uint8_t *const end = buffer_ + bufferSize_;
+    while (p + 8 <= end)
+    {
+      h ^= round_(0, read64_(p));
+      h = rotl_(h, 27) * Prime1 + Prime4;
+      p += 8;
+    }
+    if (p + 4 <= end)
+    {
+      h ^= (uint64_t)read32_(p) * Prime1;
+      h = rotl_(h, 23) * Prime2 + Prime3;
+      p += 4;
+    }
+    while (p < end)
+    {
+      h ^= (*p) * Prime5;
+      h = rotl_(h, 11) * Prime1;
+      p++;
+    }
+
+    h ^= h >> 33;
+    h *= Prime2;
+    h ^= h >> 29;
+    h *= Prime3;
+    h ^= h >> 32;
+    return h;
+  }
+
+  /** Convenience function to hash a buffer in a single call */
+  static uint64_t hash(const void *data, size_t length, uint64_t seed = 0)
+  {
+    XXHash64 hasher(seed);
+    hasher.update(data, length);
+    return hasher.digest();
+  }
+
+private:
+  static const uint64_t Prime1 = 11400714785074694791ULL;
+  static const uint64_t Prime2 = 14029467366897019727ULL;
+  static const uint64_t Prime3 = 1609587929392839161ULL;
+  static const uint64_t Prime4 = 9650029242287828579ULL;
+  static const uint64_t Prime5 = 2870177450012600261ULL;
+  static const size_t StripeSize = 32;
+
+  static uint64_t rotl_(uint64_t x, int r)
+  {
+    return (x << r) | (x >> (64 - r));
+  }
+
+  // xxHash is defined on little endian reads, which memcpy gives us on
+  // x86 and WASM without alignment concerns
+  static uint64_t read64_(const uint8_t *p)
+  {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static uint32_t read32_(const uint8_t *p)
+  {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static uint64_t round_(uint64_t acc, uint64_t input)
+  {
+    acc += input * Prime2;
+    acc = rotl_(acc, 31);
+    return acc * Prime1;
+  }
+
+  static uint64_t mergeRound_(uint64_t acc, uint64_t val)
+  {
+    acc ^= round_(0, val);
+    return acc * Prime1 + Prime4;
+  }
+
+  void processStripe_(const uint8_t *p)
+  {
+    v_[0] = round_(v_[0], read64_(p));
+    v_[1] = round_(v_[1], read64_(p + 8));
+    v_[2] = round_(v_[2], read64_(p + 16));
+    v_[3] = round_(v_[3], read64_(p + 24));
+  }
+
+  uint64_t seed_;
+  uint64_t v_[4];
+  uint64_t totalLength_;
+  uint8_t buffer_[StripeSize];
+  size_t bufferSize_;
+};
@@ -3,9 +3,15 @@
 
 #include "HTJ2KDecoder.hpp"
 #include "HTJ2KEncoder.hpp"
+#include "SIMDLevel.hpp"
 
 #include <emscripten.h>
 #include <emscripten/bind.h>
+#include <emscripten/heap.h>
+#include <stdio.h>
+#ifdef OPENJPHJS_MALLINFO
+#include <malloc.h>
+#endif
 
 using namespace emscripten;
 
@@ -23,7 +29,31 @@ static std::string getVersion() {
   return version;
 }
 
-static unsigned int getSIMDLevel() {
+// 64 bit integers need BigInt support in JavaScript, so hashes are
+// returned as 16 character hex strings instead
+static std::string hashToString(uint64_t hash) {
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+  return hex;
+}
+
+// Returns the WASM heap size and, when the allocator supports mallinfo,
+// the allocator's view of it: highWater is the largest footprint reached
+static val getHeapStatistics() {
+  val statistics = val::object();
+  statistics.set("heapSize", (double)emscripten_get_heap_size());
+#ifdef OPENJPHJS_MALLINFO
+  struct mallinfo info = mallinfo();
+  statistics.set("arena", (double)info.arena);
+  statistics.set("inUse", (double)info.uordblks);
+  statistics.set("free", (double)info.fordblks);
+  statistics.set("highWater", (double)info.usmblks);
+#endif
+  return statistics;
+}
+
+// the level OpenJPH chose for its own kernels, fixed for the process
+static unsigned int getOpenJPHSIMDLevel() {
   int level = 0;
   ojph::init_cpu_ext_level(level);
   return level;
@@ -32,7 +62,21 @@ static unsigned int getSIMDLevel() {
 
 EMSCRIPTEN_BINDINGS(charlsjs) {
     function("getVersion", &getVersion);
-    function("getSIMDLevel", &getSIMDLevel);
+    function("getSIMDLevel", &getOpenJPHSIMDLevel);
+    function("getConversionSIMDLevel", &getSIMDLevel);
+    function("setSIMDLevel", &setSIMDLevel);
+    function("getSupportedSIMDLevel", &getSupportedSIMDLevel);
+    function("isSIMDLevelSupported", &isSIMDLevelSupported);
+    function("getHeapStatistics", &getHeapStatistics);
+}
+
+EMSCRIPTEN_BINDINGS(SIMDLevel) {
+  enum_<SIMDLevel>("SIMDLevel")
+    .value("Scalar", SIMDLevel::Scalar)
+    .value("SSE2", SIMDLevel::SSE2)
+    .value("AVX2", SIMDLevel::AVX2)
+    .value("SIMD128", SIMDLevel::SIMD128)
+       ;
 }
 
 EMSCRIPTEN_BINDINGS(FrameInfo) {
@@ -46,6 +90,28 @@ EMSCRIPTEN_BINDINGS(FrameInfo) {
        ;
 }
 
+EMSCRIPTEN_BINDINGS(DecoderLimits) {
+  value_object<DecoderLimits>("DecoderLimits")
+    .field("maxPixels", &DecoderLimits::maxPixels)
+    .field("maxOutputBytes", &DecoderLimits::maxOutputBytes)
+    .field("maxTiles", &DecoderLimits::maxTiles)
+    .field("maxCodeblocks", &DecoderLimits::maxCodeblocks)
+    .field("maxDecodeTimeMs", &DecoderLimits::maxDecodeTimeMs)
+       ;
+}
+
+EMSCRIPTEN_BINDINGS(OutputLayout) {
+  enum_<OutputOrder>("OutputOrder")
+    .value("RowMajor", OutputOrder::RowMajor)
+    .value("TileMajor", OutputOrder::TileMajor)
+    .value("Morton", OutputOrder::Morton)
+       ;
+  value_object<OutputLayout>("OutputLayout")
+    .field("order", &OutputLayout::order)
+    .field("tileSize", &OutputLayout::tileSize)
+       ;
+}
+
 EMSCRIPTEN_BINDINGS(Point) {
   value_object<Point>("Point")
     .field("x", &Point::x)
@@ -53,6 +119,15 @@ EMSCRIPTEN_BINDINGS(Point) {
        ;
 }
 
+EMSCRIPTEN_BINDINGS(Rect) {
+  value_object<Rect>("Rect")
+    .field("x", &Rect::x)
+    .field("y", &Rect::y)
+    .field("width", &Rect::width)
+    .field("height", &Rect::height)
+       ;
+}
+
 EMSCRIPTEN_BINDINGS(Size) {
   value_object<Size>("Size")
     .field("width", &Size::width)
@@ -80,6 +155,14 @@ EMSCRIPTEN_BINDINGS(HTJ2KDecoder) {
     .function("getBlockDimensions", &HTJ2KDecoder::getBlockDimensions)
     .function("getPrecinct", &HTJ2KDecoder::getPrecinct)
     .function("getNumLayers", &HTJ2KDecoder::getNumLayers)
+    .function("setLimits", &HTJ2KDecoder::setLimits)
+    .function("getLimits", &HTJ2KDecoder::getLimits)
+    .function("setOutputLayout", &HTJ2KDecoder::setOutputLayout)
+    .function("getOutputLayout", &HTJ2KDecoder::getOutputLayout)
+    .function("setComputeHash", &HTJ2KDecoder::setComputeHash)
+    .function("getDecodedHash", optional_override([](const HTJ2KDecoder& decoder) {
+      return hashToString(decoder.getDecodedHash());
+    }))
    ;
 }
 
@@ -88,12 +171,18 @@ EMSCRIPTEN_BINDINGS(HTJ2KEncoder) {
     .constructor<>()
     .function("getDecodedBuffer", &HTJ2KEncoder::getDecodedBuffer)
     .function("getEncodedBuffer", &HTJ2KEncoder::getEncodedBuffer)
+    .function("getLossyEncodedBuffer", &HTJ2KEncoder::getLossyEncodedBuffer)
     .function("encode", &HTJ2KEncoder::encode)
+    .function("setOutputCallback", &HTJ2KEncoder::setOutputCallback)
+    .function("setTileSource", &HTJ2KEncoder::setTileSource)
     .function("setDecompositions", &HTJ2KEncoder::setDecompositions)
     .function("setTLMMarker", &HTJ2KEncoder::setTLMMarker)
     .function("setTilePartDivisionsAtResolutions", &HTJ2KEncoder::setTilePartDivisionsAtResolutions)
     .function("setTilePartDivisionsAtComponents", &HTJ2KEncoder::setTilePartDivisionsAtComponents)
     .function("setQuality", &HTJ2KEncoder::setQuality)
+    .function("addLossyOutput", &HTJ2KEncoder::addLossyOutput)
+    .function("clearLossyOutputs", &HTJ2KEncoder::clearLossyOutputs)
+    .function("getLossyOutputCount", &HTJ2KEncoder::getLossyOutputCount)
     .function("setProgressionOrder", &HTJ2KEncoder::setProgressionOrder)
     .function("setDownSample", &HTJ2KEncoder::setDownSample)
     .function("setImageOffset", &HTJ2KEncoder::setImageOffset)
@@ -102,5 +191,9 @@ EMSCRIPTEN_BINDINGS(HTJ2KEncoder) {
     .function("setBlockDimensions", &HTJ2KEncoder::setBlockDimensions)
     .function("setNumPrecincts", &HTJ2KEncoder::setNumPrecincts)
     .function("setPrecinct", &HTJ2KEncoder::setPrecinct)
+    .function("setComputeHash", &HTJ2KEncoder::setComputeHash)
+    .function("getDecodedHash", optional_override([](const HTJ2KEncoder& encoder) {
+      return hashToString(encoder.getDecodedHash());
+    }))
    ;
 }
\ No newline at end of file
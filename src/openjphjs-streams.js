@@ -0,0 +1,398 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Node.js Transform streams that encode and decode frames on a pool of
+// worker threads, each running its own instance of openjphjs.js.
+//
+//   const { createDecodeStream } = require('./openjphjs-streams.js')
+//   pipeline(codestreams, createDecodeStream({ workers: 4 }), sink, done)
+//
+// Both streams are in object mode.  The encode stream takes
+// { frameInfo, pixels } objects (or raw pixel Buffers when the frameInfo
+// option is set) and emits J2C Buffers.  The decode stream takes J2C
+// Buffers and emits { frameInfo, pixels } objects.  At most maxInFlight
+// frames are queued or being coded, writes are held back until a frame
+// completes and until the reader has consumed what was emitted, so memory
+// stays bounded with slow producers and consumers alike.  Output is in
+// input order unless ordered is false, which emits each frame as soon as
+// it is done.  Every worker keeps one decoder and one encoder per set of
+// encoder settings, so the WASM buffers are allocated once and reused for
+// all frames.  The decompositionLevel and encoder options travel with each
+// frame, so streams sharing a pool (the pool option) may differ in them.
+'use strict'
+
+const os = require('os')
+const path = require('path')
+const { Transform } = require('stream')
+const { Worker, isMainThread, parentPort, workerData } = require('worker_threads')
+
+const defaultModulePath = path.join(__dirname, 'openjphjs.js')
+
+function bytesPerFrame(frameInfo) {
+  return frameInfo.width * frameInfo.height * frameInfo.componentCount * Math.ceil(frameInfo.bitsPerSample / 8)
+}
+
+// Returns an ArrayBuffer holding exactly the bytes of view, the view's own
+// buffer when it covers all of it and may be transferred, a copy otherwise
+function toArrayBuffer(view, transfer) {
+  if (transfer && view.byteOffset === 0 && view.byteLength === view.buffer.byteLength) {
+    return view.buffer
+  }
+  return view.buffer.slice(view.byteOffset, view.byteOffset + view.byteLength)
+}
+
+/**
+ * Fixed size pool of worker threads running openjphjs, options.workers
+ * threads loading options.modulePath.  Tasks wait in a queue until a
+ * worker is idle.  A worker that fails a task is replaced, since the WASM
+ * instance cannot be trusted after an abort.
+ */
+class WorkerPool {
+  constructor(options = {}) {
+    this.size = options.workers || (os.availableParallelism ? os.availableParallelism() : os.cpus().length)
+    this._workerData = {
+      openjphjsStreams: true,
+      modulePath: path.resolve(options.modulePath || defaultModulePath)
+    }
+    this._idle = []
+    this._queue = []
+    this._running = new Map()
+    this._nextId = 0
+    this._closed = false
+    for (let i = 0; i < this.size; i++) {
+      this._spawn()
+    }
+  }
+
+  // Runs a task ({ kind: 'encode' | 'decode', ... }) and resolves with the
+  // worker's reply
+  run(task, transferList) {
+    if (this._closed) {
+      return Promise.reject(new Error('WorkerPool: pool is closed'))
+    }
+    return new Promise((resolve, reject) => {
+      this._queue.push({ task, transferList, resolve, reject })
+      this._dispatch()
+    })
+  }
+
+  close() {
+    this._closed = true
+    const error = new Error('WorkerPool: pool is closed')
+    for (const queued of this._queue.splice(0)) {
+      queued.reject(error)
+    }
+    const workers = this._idle.splice(0).concat(Array.from(this._running.keys()))
+    return Promise.all(workers.map((worker) => worker.terminate()))
+  }
+
+  _spawn() {
+    const worker = new Worker(__filename, { workerData: this._workerData })
+    worker.on('message', (reply) => this._reply(worker, reply))
+    worker.on('error', (error) => this._fail(worker, error))
+    worker.on('exit', () => this._fail(worker, new Error('WorkerPool: worker exited')))
+    this._idle.push(worker)
+  }
+
+  _dispatch() {
+    while (this._idle.length && this._queue.length) {
+      const worker = this._idle.pop()
+      const queued = this._queue.shift()
+      queued.task.id = this._nextId++
+      this._running.set(worker, queued)
+      worker.postMessage(queued.task, queued.transferList)
+    }
+  }
+
+  _reply(worker, reply) {
+    const queued = this._running.get(worker)
+    this._running.delete(worker)
+    if (reply.error) {
+      queued.reject(new Error(reply.error))
+      this._replace(worker)
+    } else {
+      queued.resolve(reply)
+      this._idle.push(worker)
+    }
+    this._dispatch()
+  }
+
+  _fail(worker, error) {
+    const queued = this._running.get(worker)
+    if (queued) {
+      this._running.delete(worker)
+      queued.reject(error)
+    }
+    const idle = this._idle.indexOf(worker)
+    if (idle >= 0) {
+      this._idle.splice(idle, 1)
+    }
+    if (!this._closed && (queued || idle >= 0)) {
+      this._spawn()
+      this._dispatch()
+    }
+  }
+
+  _replace(worker) {
+    worker.removeAllListeners('exit')
+    worker.terminate()
+    if (!this._closed) {
+      this._spawn()
+    }
+  }
+}
+
+/**
+ * Transform running one pool task per frame, see the top of this file
+ */
+class FrameTransform extends Transform {
+  constructor(options = {}) {
+    const pool = options.pool || new WorkerPool(options)
+    const maxInFlight = options.maxInFlight || pool.size * 2
+    super({ objectMode: true, writableHighWaterMark: 1, readableHighWaterMark: maxInFlight })
+    this._options = options
+    this._pool = pool
+    this._ownsPool = !options.pool
+    this._maxInFlight = maxInFlight
+    this._ordered = options.ordered !== false
+    this._inFlight = 0
+    this._nextSequence = 0
+    this._nextToPush = 0
+    this._completed = new Map()
+    this._pendingCallback = null
+    this._flushCallback = null
+  }
+
+  _transform(chunk, encoding, callback) {
+    let message
+    let transferList
+    try {
+      [message, transferList] = this._createTask(chunk)
+    } catch (error) {
+      callback(error)
+      return
+    }
+    const sequence = this._nextSequence++
+    this._inFlight++
+    this._pool.run(message, transferList).then(
+      (reply) => this._complete(sequence, this._createOutput(reply)),
+      (error) => this.destroy(error))
+    if (this._inFlight < this._maxInFlight) {
+      callback()
+    } else {
+      this._pendingCallback = callback
+    }
+  }
+
+  _complete(sequence, output) {
+    if (this.destroyed) {
+      return
+    }
+    if (this._ordered) {
+      this._completed.set(sequence, output)
+      while (this._completed.has(this._nextToPush)) {
+        this.push(this._completed.get(this._nextToPush))
+        this._completed.delete(this._nextToPush++)
+        this._inFlight--
+      }
+    } else {
+      this.push(output)
+      this._inFlight--
+    }
+    this._release()
+  }
+
+  // Accepts the next frame once there is room in flight and the reader
+  // has caught up, and finishes once everything has been emitted
+  _release() {
+    if (this._pendingCallback && this._inFlight < this._maxInFlight && this.readableLength < this.readableHighWaterMark) {
+      const callback = this._pendingCallback
+      this._pendingCallback = null
+      callback()
+    }
+    if (this._flushCallback && this._inFlight === 0) {
+      const callback = this._flushCallback
+      this._flushCallback = null
+      this._closePool().then(() => callback(), callback)
+    }
+  }
+
+  _read(size) {
+    super._read(size)
+    this._release()
+  }
+
+  _flush(callback) {
+    this._flushCallback = callback
+    this._release()
+  }
+
+  _destroy(error, callback) {
+    this._closePool().then(() => callback(error), () => callback(error))
+  }
+
+  _closePool() {
+    return this._ownsPool ? this._pool.close() : Promise.resolve()
+  }
+}
+
+/**
+ * Encodes { frameInfo, pixels } objects (or pixel Buffers with the
+ * frameInfo option) into J2C Buffers.  options.encoder holds the settings
+ * applied to every worker's encoder: decompositions, lossless,
+ * quantizationStep, progressionOrder, tileSize, blockDimensions, tlm and
+ * tilePartDivisionsAtResolutions.
+ */
+class EncodeStream extends FrameTransform {
+  constructor(options) {
+    super(options)
+  }
+
+  _createTask(chunk) {
+    const frame = ArrayBuffer.isView(chunk) ? { frameInfo: this._options.frameInfo, pixels: chunk } : chunk
+    if (!frame.frameInfo || !ArrayBuffer.isView(frame.pixels)) {
+      throw new Error('EncodeStream: expected { frameInfo, pixels } or a Buffer with the frameInfo option')
+    }
+    if (frame.pixels.byteLength !== bytesPerFrame(frame.frameInfo)) {
+      throw new Error('EncodeStream: frame has ' + frame.pixels.byteLength + ' bytes, frameInfo needs ' + bytesPerFrame(frame.frameInfo))
+    }
+    const pixels = toArrayBuffer(frame.pixels, this._options.transfer)
+    return [{ kind: 'encode', frameInfo: frame.frameInfo, pixels, encoder: this._options.encoder || {} }, [pixels]]
+  }
+
+  _createOutput(reply) {
+    return Buffer.from(reply.encoded)
+  }
+}
+
+/**
+ * Decodes J2C Buffers into { frameInfo, pixels } objects, at
+ * options.decompositionLevel when set (frameInfo then holds the size at
+ * that level)
+ */
+class DecodeStream extends FrameTransform {
+  constructor(options) {
+    super(options)
+  }
+
+  _createTask(chunk) {
+    if (!ArrayBuffer.isView(chunk)) {
+      throw new Error('DecodeStream: expected a Buffer holding a codestream')
+    }
+    const encoded = toArrayBuffer(chunk, this._options.transfer)
+    return [{ kind: 'decode', encoded, decompositionLevel: this._options.decompositionLevel || 0 }, [encoded]]
+  }
+
+  _createOutput(reply) {
+    return { frameInfo: reply.frameInfo, pixels: Buffer.from(reply.pixels) }
+  }
+}
+
+function createEncodeStream(options) {
+  return new EncodeStream(options)
+}
+
+function createDecodeStream(options) {
+  return new DecodeStream(options)
+}
+
+// ---------------------------------------------------------------- worker
+
+function loadModule(modulePath) {
+  const openjphjs = require(modulePath)
+  return new Promise((resolve) => {
+    if (openjphjs.calledRun) {
+      resolve(openjphjs)
+    } else {
+      openjphjs.onRuntimeInitialized = () => resolve(openjphjs)
+    }
+  })
+}
+
+function configureEncoder(encoder, settings) {
+  if (settings.decompositions !== undefined) {
+    encoder.setDecompositions(settings.decompositions)
+  }
+  if (settings.lossless !== undefined || settings.quantizationStep !== undefined) {
+    encoder.setQuality(settings.lossless !== false, settings.quantizationStep || 0)
+  }
+  if (settings.progressionOrder !== undefined) {
+    encoder.setProgressionOrder(settings.progressionOrder)
+  }
+  if (settings.tileSize) {
+    encoder.setTileSize(settings.tileSize)
+  }
+  if (settings.blockDimensions) {
+    encoder.setBlockDimensions(settings.blockDimensions)
+  }
+  if (settings.tlm) {
+    encoder.setTLMMarker(true)
+  }
+  if (settings.tilePartDivisionsAtResolutions) {
+    encoder.setTilePartDivisionsAtResolutions(true)
+  }
+}
+
+async function runWorker(data) {
+  const openjphjs = await loadModule(data.modulePath)
+  // encoders by their settings in JSON, settings are not reset between frames
+  const encoders = new Map()
+  let decoder
+
+  function encode(task) {
+    const settings = JSON.stringify(task.encoder)
+    let encoder = encoders.get(settings)
+    if (!encoder) {
+      encoder = new openjphjs.HTJ2KEncoder()
+      configureEncoder(encoder, task.encoder)
+      encoders.set(settings, encoder)
+    }
+    encoder.getDecodedBuffer(task.frameInfo).set(new Uint8Array(task.pixels))
+    encoder.encode()
+    const encoded = new Uint8Array(encoder.getEncodedBuffer())
+    return [{ id: task.id, encoded: encoded.buffer }, [encoded.buffer]]
+  }
+
+  function decode(task) {
+    if (!decoder) {
+      decoder = new openjphjs.HTJ2KDecoder()
+    }
+    decoder.getEncodedBuffer(task.encoded.byteLength).set(new Uint8Array(task.encoded))
+    if (task.decompositionLevel) {
+      decoder.decodeSubResolution(task.decompositionLevel)
+    } else {
+      decoder.decode()
+    }
+    const info = decoder.getFrameInfo()
+    if (task.decompositionLevel) {
+      const size = decoder.calculateSizeAtDecompositionLevel(task.decompositionLevel)
+      info.width = size.width
+      info.height = size.height
+    }
+    const pixels = new Uint8Array(decoder.getDecodedBuffer())
+    return [{ id: task.id, frameInfo: info, pixels: pixels.buffer }, [pixels.buffer]]
+  }
+
+  parentPort.on('message', (task) => {
+    try {
+      const [reply, transferList] = task.kind === 'encode' ? encode(task) : decode(task)
+      parentPort.postMessage(reply, transferList)
+    } catch (error) {
+      parentPort.postMessage({ id: task.id, error: String(error && error.message || error) })
+    }
+  })
+}
+
+if (!isMainThread && workerData && workerData.openjphjsStreams) {
+  runWorker(workerData).catch((error) => {
+    throw error
+  })
+}
+
+module.exports = {
+  WorkerPool,
+  EncodeStream,
+  DecodeStream,
+  createEncodeStream,
+  createDecodeStream
+}
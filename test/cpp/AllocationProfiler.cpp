@@ -0,0 +1,368 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Interposes the glibc allocator and the C++ allocation operators to count
+// allocations for the profiling build of the native benchmark.  Recording
+// never allocates: each allocation walks up to MaxFrames frames of its
+// stack with backtrace() to the first frame owned by the executable or by
+// the OpenJPH shared library, skipping libc and libstdc++, and counts it
+// for that frame in a fixed size open addressing table.  The address
+// ranges of both objects come from dl_iterate_phdr in reset().
+
+#include "AllocationProfiler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <execinfo.h>
+#include <link.h>
+#include <malloc.h>
+#include <new>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void *__libc_memalign(size_t alignment, size_t size);
+    void __libc_free(void *ptr);
+}
+
+namespace
+{
+    struct CallerEntry
+    {
+        std::atomic<const void *> caller;
+        std::atomic<bool> isOpenJPH;
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> bytes;
+    };
+
+    // executable address ranges of a loaded object
+    struct ObjectRanges
+    {
+        static const size_t MaxRanges = 8;
+        uintptr_t start[MaxRanges];
+        uintptr_t end[MaxRanges];
+        size_t count = 0;
+
+        bool contains(const void *address) const
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                if ((uintptr_t)address >= start[i] && (uintptr_t)address < end[i])
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    const int MaxFrames = 16;
+
+    const size_t TableSize = 8192;
+    CallerEntry callers[TableSize];
+    CallerEntry overflow;
+
+    std::atomic<int64_t> liveBytes(0);
+    std::atomic<int64_t> resetLiveBytes(0);
+    std::atomic<int64_t> peakLiveBytes(0);
+
+    ObjectRanges executable;
+    ObjectRanges openjph;
+    std::atomic<bool> foundObjects(false);
+
+    // backtrace() allocates when it first loads the unwinder
+    __thread bool inBacktrace = false;
+
+    // dl_iterate_phdr callback, the main program is reported first
+    int findObjects(dl_phdr_info *info, size_t, void *data)
+    {
+        bool &isFirst = *(bool *)data;
+        const char *name = info->dlpi_name ? info->dlpi_name : "";
+        const char *base = strrchr(name, '/');
+        base = base ? base + 1 : name;
+        ObjectRanges *ranges = isFirst ? &executable : strncmp(base, "libopenjph", 10) == 0 ? &openjph : nullptr;
+        isFirst = false;
+        for (int i = 0; ranges && i < info->dlpi_phnum; i++)
+        {
+            const ElfW(Phdr) &header = info->dlpi_phdr[i];
+            if (header.p_type == PT_LOAD && (header.p_flags & PF_X) && ranges->count < ObjectRanges::MaxRanges)
+            {
+                ranges->start[ranges->count] = info->dlpi_addr + header.p_vaddr;
+                ranges->end[ranges->count] = info->dlpi_addr + header.p_vaddr + header.p_memsz;
+                ranges->count++;
+            }
+        }
+        return 0;
+    }
+
+    // Finds the frame the allocation is counted for, the first frame from
+    // caller up that belongs to the executable or to OpenJPH
+    const void *findOwner(const void *caller, bool &isOpenJPH)
+    {
+        isOpenJPH = openjph.contains(caller);
+        if (isOpenJPH || executable.contains(caller) || !foundObjects || inBacktrace)
+        {
+            return caller;
+        }
+        void *frames[MaxFrames];
+        inBacktrace = true;
+        const int count = backtrace(frames, MaxFrames);
+        inBacktrace = false;
+        int first = 0;
+        while (first < count && frames[first] != caller)
+        {
+            first++;
+        }
+        for (int i = first + 1; i < count; i++)
+        {
+            isOpenJPH = openjph.contains(frames[i]);
+            if (isOpenJPH || executable.contains(frames[i]))
+            {
+                return frames[i];
+            }
+        }
+        return caller;
+    }
+
+    void recordAllocation(void *ptr, size_t size, const void *caller)
+    {
+        if (ptr == nullptr)
+        {
+            return;
+        }
+        const int64_t usable = (int64_t)malloc_usable_size(ptr);
+        const int64_t live = liveBytes.fetch_add(usable) + usable;
+        int64_t peak = peakLiveBytes.load();
+        while (live > peak && !peakLiveBytes.compare_exchange_weak(peak, live))
+        {
+        }
+
+        bool isOpenJPH = false;
+        caller = findOwner(caller, isOpenJPH);
+        const size_t start = (size_t)(((uintptr_t)caller >> 2) * 2654435761u) % TableSize;
+        for (size_t i = 0; i < TableSize; i++)
+        {
+            CallerEntry &entry = callers[(start + i) % TableSize];
+            const void *current = entry.caller.load();
+            if (current == nullptr && entry.caller.compare_exchange_strong(current, caller))
+            {
+                entry.isOpenJPH = isOpenJPH;
+                current = caller;
+            }
+            if (current == caller)
+            {
+                entry.count++;
+                entry.bytes += size;
+                return;
+            }
+        }
+        overflow.count++;
+        overflow.bytes += size;
+    }
+
+    void recordFree(void *ptr)
+    {
+        if (ptr != nullptr)
+        {
+            liveBytes -= (int64_t)malloc_usable_size(ptr);
+        }
+    }
+}
+
+namespace AllocationProfiler
+{
+    void reset()
+    {
+        if (!foundObjects)
+        {
+            bool isFirst = true;
+            dl_iterate_phdr(findObjects, &isFirst);
+            void *frames[MaxFrames];
+            inBacktrace = true;
+            backtrace(frames, MaxFrames);
+            inBacktrace = false;
+            foundObjects = true;
+        }
+        for (CallerEntry &entry : callers)
+        {
+            entry.count = 0;
+            entry.bytes = 0;
+        }
+        overflow.count = 0;
+        overflow.bytes = 0;
+        resetLiveBytes = liveBytes.load();
+        peakLiveBytes = liveBytes.load();
+    }
+
+    AllocationStats snapshot()
+    {
+        static bool snapshotIsOpenJPH[TableSize];
+        static uint64_t snapshotCounts[TableSize];
+        static uint64_t snapshotBytes[TableSize];
+        AllocationStats stats;
+        for (size_t i = 0; i < TableSize; i++)
+        {
+            snapshotIsOpenJPH[i] = callers[i].isOpenJPH;
+            snapshotCounts[i] = callers[i].count;
+            snapshotBytes[i] = callers[i].bytes;
+        }
+        stats.isAttributed = openjph.count > 0;
+        stats.count = overflow.count;
+        stats.bytes = overflow.bytes;
+        stats.peakBytes = (uint64_t)std::max<int64_t>(0, peakLiveBytes - resetLiveBytes);
+
+        for (size_t i = 0; i < TableSize; i++)
+        {
+            if (snapshotCounts[i] == 0)
+            {
+                continue;
+            }
+            stats.count += snapshotCounts[i];
+            stats.bytes += snapshotBytes[i];
+            if (snapshotIsOpenJPH[i])
+            {
+                stats.ojphCount += snapshotCounts[i];
+                stats.ojphBytes += snapshotBytes[i];
+            }
+        }
+        return stats;
+    }
+}
+
+extern "C"
+{
+    void *malloc(size_t size) noexcept
+    {
+        void *ptr = __libc_malloc(size);
+        recordAllocation(ptr, size, __builtin_return_address(0));
+        return ptr;
+    }
+
+    void *calloc(size_t count, size_t size) noexcept
+    {
+        void *ptr = __libc_calloc(count, size);
+        recordAllocation(ptr, count * size, __builtin_return_address(0));
+        return ptr;
+    }
+
+    void *realloc(void *ptr, size_t size) noexcept
+    {
+        const int64_t previous = ptr ? (int64_t)malloc_usable_size(ptr) : 0;
+        void *result = __libc_realloc(ptr, size);
+        if (result != nullptr || size == 0)
+        {
+            liveBytes -= previous;
+            recordAllocation(result, size, __builtin_return_address(0));
+        }
+        return result;
+    }
+
+    void *memalign(size_t alignment, size_t size) noexcept
+    {
+        void *ptr = __libc_memalign(alignment, size);
+        recordAllocation(ptr, size, __builtin_return_address(0));
+        return ptr;
+    }
+
+    void *aligned_alloc(size_t alignment, size_t size) noexcept
+    {
+        void *ptr = __libc_memalign(alignment, size);
+        recordAllocation(ptr, size, __builtin_return_address(0));
+        return ptr;
+    }
+
+    int posix_memalign(void **result, size_t alignment, size_t size) noexcept
+    {
+        void *ptr = __libc_memalign(alignment, size);
+        if (ptr == nullptr)
+        {
+            return ENOMEM;
+        }
+        recordAllocation(ptr, size, __builtin_return_address(0));
+        *result = ptr;
+        return 0;
+    }
+
+    void free(void *ptr) noexcept
+    {
+        recordFree(ptr);
+        __libc_free(ptr);
+    }
+}
+
+// the operators call the libc allocator directly so the recorded caller is
+// the code doing the new, not operator new itself
+static void *newImpl(size_t size, size_t alignment, const void *caller)
+{
+    size = size ? size : 1;
+    void *ptr = alignment > alignof(max_align_t) ? __libc_memalign(alignment, size) : __libc_malloc(size);
+    recordAllocation(ptr, size, caller);
+    return ptr;
+}
+
+void *operator new(size_t size)
+{
+    void *ptr = newImpl(size, 0, __builtin_return_address(0));
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    void *ptr = newImpl(size, 0, __builtin_return_address(0));
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return newImpl(size, 0, __builtin_return_address(0));
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return newImpl(size, 0, __builtin_return_address(0));
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    void *ptr = newImpl(size, (size_t)alignment, __builtin_return_address(0));
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+    void *ptr = newImpl(size, (size_t)alignment, __builtin_return_address(0));
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept { free(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept { free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept { free(ptr); }
@@ -0,0 +1,41 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Allocation statistics collected by AllocationProfiler.cpp, which
+ * interposes malloc/free and operator new/delete in the profiling build of
+ * the native benchmark (OPENJPHJS_ALLOC_PROFILE, Linux/glibc only).
+ * Allocations are attributed by the object owning the nearest frame of
+ * their stack outside libc and libstdc++: the OpenJPH shared library
+ * (libopenjph, which OPENJPHJS_ALLOC_PROFILE builds shared) counts as
+ * OpenJPH internals, the executable (the wrapper's vectors, callbacks
+ * OpenJPH makes into the wrapper) as wrapper.
+ */
+struct AllocationStats
+{
+    /** Number of allocations since the last reset */
+    uint64_t count = 0;
+    /** Bytes requested since the last reset */
+    uint64_t bytes = 0;
+    /** Allocations and bytes requested from inside OpenJPH */
+    uint64_t ojphCount = 0;
+    uint64_t ojphBytes = 0;
+    /** Highest live heap bytes above the level at the last reset */
+    uint64_t peakBytes = 0;
+    /** false if libopenjph was not loaded as a shared library, then
+     *  nothing is counted as OpenJPH */
+    bool isAttributed = false;
+};
+
+namespace AllocationProfiler
+{
+    /** Starts a new measurement */
+    void reset();
+
+    /** Returns the statistics since the last reset */
+    AllocationStats snapshot();
+}
@@ -0,0 +1,177 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+/**
+ * Minimal JSON reader for the benchmark baselines.  Supports objects,
+ * arrays, strings (without unicode escapes), numbers, booleans and null,
+ * which is all the baseline files contain.
+ */
+struct JsonValue
+{
+    enum Type
+    {
+        Null,
+        Boolean,
+        Number,
+        String,
+        Array,
+        Object
+    };
+
+    Type type = Null;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<JsonValue> array;
+    std::map<std::string, JsonValue> object;
+
+    /** Returns the member with the given name or a null value */
+    const JsonValue &operator[](const std::string &name) const
+    {
+        static const JsonValue null;
+        auto it = object.find(name);
+        return it == object.end() ? null : it->second;
+    }
+
+    /** Returns the number or fallback if this is not a number */
+    double asNumber(double fallback = 0) const
+    {
+        return type == Number ? number : fallback;
+    }
+
+    static JsonValue parse(const std::string &text)
+    {
+        size_t pos = 0;
+        JsonValue value = parseValue_(text, pos);
+        skipWhitespace_(text, pos);
+        if (pos != text.size())
+        {
+            throw std::runtime_error("JSON: unexpected trailing characters");
+        }
+        return value;
+    }
+
+private:
+    static void skipWhitespace_(const std::string &text, size_t &pos)
+    {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+        {
+            pos++;
+        }
+    }
+
+    static void expect_(const std::string &text, size_t &pos, char c)
+    {
+        skipWhitespace_(text, pos);
+        if (pos >= text.size() || text[pos] != c)
+        {
+            throw std::runtime_error(std::string("JSON: expected '") + c + "' at offset " + std::to_string(pos));
+        }
+        pos++;
+    }
+
+    static std::string parseString_(const std::string &text, size_t &pos)
+    {
+        expect_(text, pos, '"');
+        std::string result;
+        while (pos < text.size() && text[pos] != '"')
+        {
+            if (text[pos] == '\\' && pos + 1 < text.size())
+            {
+                pos++;
+                const char escaped = text[pos];
+                result += escaped == 'n' ? '\n' : escaped == 't' ? '\t' : escaped;
+            }
+            else
+            {
+                result += text[pos];
+            }
+            pos++;
+        }
+        expect_(text, pos, '"');
+        return result;
+    }
+
+    static JsonValue parseValue_(const std::string &text, size_t &pos)
+    {
+        skipWhitespace_(text, pos);
+        if (pos >= text.size())
+        {
+            throw std::runtime_error("JSON: unexpected end of input");
+        }
+        JsonValue value;
+        const char c = text[pos];
+        if (c == '{')
+        {
+            value.type = Object;
+            pos++;
+            skipWhitespace_(text, pos);
+            if (pos < text.size() && text[pos] == '}')
+            {
+                pos++;
+                return value;
+            }
+            do
+            {
+                const std::string name = parseString_(text, pos);
+                expect_(text, pos, ':');
+                value.object[name] = parseValue_(text, pos);
+                skipWhitespace_(text, pos);
+            } while (pos < text.size() && text[pos] == ',' && ++pos);
+            expect_(text, pos, '}');
+        }
+        else if (c == '[')
+        {
+            value.type = Array;
+            pos++;
+            skipWhitespace_(text, pos);
+            if (pos < text.size() && text[pos] == ']')
+            {
+                pos++;
+                return value;
+            }
+            do
+            {
+                value.array.push_back(parseValue_(text, pos));
+                skipWhitespace_(text, pos);
+            } while (pos < text.size() && text[pos] == ',' && ++pos);
+            expect_(text, pos, ']');
+        }
+        else if (c == '"')
+        {
+            value.type = String;
+            value.string = parseString_(text, pos);
+        }
+        else if (text.compare(pos, 4, "true") == 0 || text.compare(pos, 5, "false") == 0)
+        {
+            value.type = Boolean;
+            value.boolean = c == 't';
+            pos += value.boolean ? 4 : 5;
+        }
+        else if (text.compare(pos, 4, "null") == 0)
+        {
+            pos += 4;
+        }
+        else
+        {
+            char *end;
+            value.type = Number;
+            value.number = strtod(text.c_str() + pos, &end);
+            if (end == text.c_str() + pos)
+            {
+                throw std::runtime_error("JSON: invalid value at offset " + std::to_string(pos));
+            }
+            pos = end - text.c_str();
+        }
+        return value;
+    }
+};
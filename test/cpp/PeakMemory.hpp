@@ -0,0 +1,34 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <fstream>
+#include <stdlib.h>
+#include <string>
+
+// Resets the peak resident set size (VmHWM) of the process so the peak of
+// each measurement can be read separately.  Linux only, returns false if
+// the peak cannot be reset
+inline bool resetPeakMemory()
+{
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+    clearRefs.flush();
+    return clearRefs.good();
+}
+
+// Returns the peak resident set size in KiB, 0 if unavailable
+inline double readPeakKiB()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+        {
+            return atof(line.c_str() + 6);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,159 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Counter values of one measurement, -1 for counters that are unavailable
+struct PerfCounterValues
+{
+    double cycles = -1;
+    double instructions = -1;
+    double llcMisses = -1;
+    double branchMisses = -1;
+};
+
+// Hardware performance counters of the calling thread from Linux
+// perf_event_open, user space only.  Counters the kernel or CPU refuses
+// (containers, perf_event_paranoid above 2, virtual machines without a
+// PMU, other platforms) read as -1 and the others still count.  Counts
+// are scaled when the kernel multiplexes the counters.
+class PerfCounters
+{
+public:
+    PerfCounters()
+    {
+#ifdef __linux__
+        const uint64_t configs[Count] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for (int i = 0; i < Count; i++)
+        {
+            perf_event_attr attr = perf_event_attr();
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds_[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+#endif
+    }
+
+    ~PerfCounters()
+    {
+#ifdef __linux__
+        for (int fd : fds_)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    // true if at least one counter could be opened
+    bool isAvailable() const
+    {
+        for (int fd : fds_)
+        {
+            if (fd >= 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Resets and starts the counters
+    void start()
+    {
+#ifdef __linux__
+        for (int fd : fds_)
+        {
+            if (fd >= 0)
+            {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    // Stops the counters and returns their values since start()
+    PerfCounterValues stop()
+    {
+        double values[Count] = {-1, -1, -1, -1};
+#ifdef __linux__
+        for (int i = 0; i < Count; i++)
+        {
+            if (fds_[i] >= 0)
+            {
+                ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+            }
+        }
+        for (int i = 0; i < Count; i++)
+        {
+            // value, time enabled, time running
+            uint64_t data[3];
+            if (fds_[i] >= 0 && read(fds_[i], data, sizeof(data)) == (ssize_t)sizeof(data) && data[2] > 0)
+            {
+                values[i] = (double)data[0] * ((double)data[1] / data[2]);
+            }
+        }
+#endif
+        PerfCounterValues result;
+        result.cycles = values[0];
+        result.instructions = values[1];
+        result.llcMisses = values[2];
+        result.branchMisses = values[3];
+        return result;
+    }
+
+private:
+    enum { Count = 4 };
+    int fds_[Count] = {-1, -1, -1, -1};
+};
+
+// Formats the values divided by frames as "cycles=... instructions=...
+// IPC=... LLC-misses=... branch-misses=... bytes/cycle=..." with n/a for
+// unavailable counters.  bytes is the pixel data one frame reads or writes
+inline std::string formatPerfCounters(const PerfCounterValues &values, double frames, double bytes)
+{
+    auto format = [](const char *name, double value, const char *fmt) {
+        char text[64];
+        if (value < 0)
+        {
+            snprintf(text, sizeof(text), "%s=n/a", name);
+        }
+        else
+        {
+            char number[32];
+            snprintf(number, sizeof(number), fmt, value);
+            snprintf(text, sizeof(text), "%s=%s", name, number);
+        }
+        return std::string(text);
+    };
+    const double cycles = values.cycles < 0 ? -1 : values.cycles / frames;
+    const double instructions = values.instructions < 0 ? -1 : values.instructions / frames;
+    return format("cycles", cycles, "%.0f") + " " +
+           format("instructions", instructions, "%.0f") + " " +
+           format("IPC", cycles > 0 && instructions >= 0 ? instructions / cycles : -1, "%.2f") + " " +
+           format("LLC-misses", values.llcMisses < 0 ? -1 : values.llcMisses / frames, "%.0f") + " " +
+           format("branch-misses", values.branchMisses < 0 ? -1 : values.branchMisses / frames, "%.0f") + " " +
+           format("bytes/cycle", cycles > 0 ? bytes / cycles : -1, "%.3f");
+}
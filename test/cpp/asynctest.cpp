@@ -0,0 +1,185 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Tests for the C++20 coroutine API in src/HTJ2KAsync.hpp.  Run from the
+// repository root (ctest does this) so the fixtures are found.
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../src/HTJ2KAsync.hpp"
+#include "../../src/ThreadPool.hpp"
+
+using namespace HTJ2KAsync;
+
+static size_t failures = 0;
+
+static void check(bool condition, const char *what)
+{
+    printf("%s %s\n", condition ? "OK   " : "ERROR", what);
+    failures += !condition;
+}
+
+static uint64_t decodeHash(const std::vector<uint8_t> &encoded)
+{
+    HTJ2KDecoder decoder;
+    decoder.getEncodedBytes() = encoded;
+    decoder.setComputeHash(true);
+    decoder.decode();
+    return decoder.getDecodedHash();
+}
+
+// Reads the next file on the I/O pool while the current one decodes
+static Task<std::vector<uint64_t>> decodeFiles(ThreadPool &io, ThreadPool &pool, std::vector<std::string> paths)
+{
+    std::vector<uint64_t> hashes;
+    HTJ2KDecoder decoder;
+    decoder.setComputeHash(true);
+    AsyncOperation<std::vector<uint8_t>> next = readFileAsync(io, paths[0]);
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        decoder.getEncodedBytes() = co_await next;
+        if (i + 1 < paths.size())
+        {
+            next = readFileAsync(io, paths[i + 1]);
+        }
+        co_await decodeAsync(pool, decoder);
+        hashes.push_back(decoder.getDecodedHash());
+    }
+    co_return hashes;
+}
+
+static Task<bool> roundTrip(ThreadPool &pool, std::string path)
+{
+    HTJ2KDecoder decoder;
+    decoder.getEncodedBytes() = co_await readFileAsync(pool, path);
+    decoder.setComputeHash(true);
+    co_await decodeAsync(pool, decoder);
+
+    HTJ2KEncoder encoder;
+    encoder.getDecodedBytes(decoder.getFrameInfo()) = decoder.getDecodedBytes();
+    co_await encodeAsync(pool, encoder);
+
+    HTJ2KDecoder check;
+    check.getEncodedBytes() = encoder.getEncodedBytes();
+    check.setComputeHash(true);
+    co_await decodeSubResolutionAsync(pool, check, 0);
+    co_return check.getDecodedHash() == decoder.getDecodedHash();
+}
+
+static Task<bool> cancelledBeforeStart(ThreadPool &pool, std::string path)
+{
+    HTJ2KDecoder decoder;
+    decoder.getEncodedBytes() = co_await readFileAsync(pool, path);
+    CancellationSource source;
+    source.cancel();
+    try
+    {
+        co_await decodeAsync(pool, decoder, source.getToken());
+    }
+    catch (const OperationCancelled &)
+    {
+        co_return decoder.getDecodedBytes().empty();
+    }
+    co_return false;
+}
+
+static Task<void> missingFile(ThreadPool &pool)
+{
+    co_await readFileAsync(pool, "test/fixtures/j2c/missing.j2c");
+}
+
+int main(int argc, char **argv)
+{
+    ThreadPool io(2);
+    ThreadPool pool(4);
+
+    std::vector<std::string> paths;
+    for (const char *name : {"CT1", "MG1", "US1", "VL1", "38320-4k"})
+    {
+        paths.push_back(std::string("test/fixtures/j2c/") + name + ".j2c");
+    }
+    std::vector<uint64_t> expected;
+    for (const std::string &path : paths)
+    {
+        expected.push_back(decodeHash(readFileAsync(io, path).wait()));
+    }
+
+    // several pipelines at once share the pools
+    std::vector<Task<std::vector<uint64_t>>> pipelines;
+    for (size_t i = 0; i < 4; i++)
+    {
+        pipelines.push_back(decodeFiles(io, pool, paths));
+    }
+    bool matches = true;
+    for (Task<std::vector<uint64_t>> &pipeline : pipelines)
+    {
+        matches &= syncWait(std::move(pipeline)) == expected;
+    }
+    check(matches, "decodeAsync with overlapped readFileAsync matches the synchronous decode");
+
+    check(syncWait(roundTrip(pool, paths[0])), "encodeAsync round trip is lossless");
+    check(syncWait(cancelledBeforeStart(pool, paths[0])), "a cancelled token skips the decode");
+
+    // the decoder stops at the next line once its flag is set
+    {
+        std::atomic<bool> cancelled(true);
+        HTJ2KDecoder decoder;
+        decoder.getEncodedBytes() = readFileAsync(io, paths[4]).wait();
+        decoder.setCancellationFlag(&cancelled);
+        bool threw = false;
+        try
+        {
+            decoder.decode();
+        }
+        catch (const std::runtime_error &)
+        {
+            threw = true;
+        }
+        decoder.setCancellationFlag(0);
+        decoder.setComputeHash(true);
+        decoder.decode();
+        check(threw && decoder.getDecodedHash() == expected[4], "HTJ2KDecoder cancellation flag stops the decode and the decoder stays usable");
+    }
+
+    // cancelling while the decode runs either finishes it or reports
+    // OperationCancelled, never anything else
+    {
+        HTJ2KDecoder decoder;
+        decoder.getEncodedBytes() = readFileAsync(io, paths[4]).wait();
+        CancellationSource source;
+        AsyncOperation<void> decode = decodeAsync(pool, decoder, source.getToken());
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        source.cancel();
+        bool reported = true;
+        try
+        {
+            decode.wait();
+        }
+        catch (const OperationCancelled &)
+        {
+        }
+        catch (...)
+        {
+            reported = false;
+        }
+        check(reported, "cancelling a running decode reports OperationCancelled");
+    }
+
+    bool threw = false;
+    try
+    {
+        syncWait(missingFile(io));
+    }
+    catch (const std::runtime_error &)
+    {
+        threw = true;
+    }
+    check(threw, "readFileAsync reports a missing file");
+
+    return failures ? 1 : 0;
+}
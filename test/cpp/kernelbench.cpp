@@ -0,0 +1,121 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Microbenchmark for the pixel conversion kernels in PixelConversion.hpp
+// that HTJ2KDecoder (narrow/interleave) and HTJ2KEncoder (widen/deinterleave)
+// run on every line.  Runs on synthetic rows so kernel changes can be
+// measured without codec noise.  GB/s counts the bytes read plus the bytes
+// written: the 32 bit line samples and the packed pixel row.  Every case
+// runs at each SIMD level this build and CPU support (see setSIMDLevel()),
+// only single component rows use the SIMD kernels.
+//
+// usage: kernelbench [milliseconds per case]
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "../../src/PixelConversion.hpp"
+
+struct Case
+{
+    size_t bitsPerSample;
+    bool isSigned;
+    size_t componentCount;
+    size_t width;
+};
+
+// keeps the compiler from discarding the converted data
+static volatile uint32_t sink;
+
+template <typename F>
+double measureGBs(F convert, size_t bytesPerRow, double minSeconds)
+{
+    size_t rows = 0;
+    const auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    do
+    {
+        for (int i = 0; i < 64; i++)
+        {
+            convert();
+        }
+        rows += 64;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < minSeconds);
+    return (double)bytesPerRow * rows / elapsed / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    const double minSeconds = ((argc > 1) ? atoi(argv[1]) : 100) / 1000.0;
+    const size_t bitDepths[] = {8, 16};
+    const size_t componentCounts[] = {1, 3, 4};
+    const size_t widths[] = {64, 512, 3064, 8192};
+
+    std::vector<SIMDLevel> levels;
+    for (SIMDLevel level : {SIMDLevel::Scalar, SIMDLevel::SSE2, SIMDLevel::AVX2, SIMDLevel::SIMD128})
+    {
+        if (isSIMDLevelSupported(level))
+        {
+            levels.push_back(level);
+        }
+    }
+
+    printf("direction bits signed comps width simd       GB/s\n");
+    for (size_t bitsPerSample : bitDepths)
+    {
+        for (bool isSigned : {false, true})
+        {
+            for (size_t componentCount : componentCounts)
+            {
+                for (size_t width : widths)
+                {
+                    const size_t bytesPerPixel = (bitsPerSample + 8 - 1) / 8;
+                    const size_t rowSize = width * componentCount * bytesPerPixel;
+                    std::vector<uint8_t> row(rowSize);
+                    std::vector<std::vector<int32_t>> lines(componentCount, std::vector<int32_t>(width));
+
+                    // samples slightly outside the output range exercise the clamping
+                    const int32_t range = 1 << bitsPerSample;
+                    const int32_t low = isSigned ? -range / 2 - 16 : -16;
+                    srand(1);
+                    for (auto &line : lines)
+                    {
+                        for (auto &sample : line)
+                        {
+                            sample = low + rand() % (range + 32);
+                        }
+                    }
+
+                    const size_t bytesPerRow = rowSize + componentCount * width * sizeof(int32_t);
+                    for (SIMDLevel level : levels)
+                    {
+                        setSIMDLevel(level);
+                        const double narrowGBs = measureGBs([&]() {
+                            for (size_t c = 0; c < componentCount; c++)
+                            {
+                                narrowLineToRow(lines[c].data(), row.data(), width, componentCount, c, bitsPerSample, isSigned);
+                            }
+                            sink = sink + row[width / 2];
+                        }, bytesPerRow, minSeconds);
+                        const double widenGBs = measureGBs([&]() {
+                            for (size_t c = 0; c < componentCount; c++)
+                            {
+                                widenRowToLine(row.data(), lines[c].data(), width, componentCount, c, bitsPerSample, isSigned);
+                            }
+                            sink = sink + lines[0][width / 2];
+                        }, bytesPerRow, minSeconds);
+
+                        const char *simd = getSIMDLevelName(level);
+                        printf("narrow    %4zu %6s %5zu %5zu %-7s %7.2f\n", bitsPerSample, isSigned ? "yes" : "no", componentCount, width, simd, narrowGBs);
+                        printf("widen     %4zu %6s %5zu %5zu %-7s %7.2f\n", bitsPerSample, isSigned ? "yes" : "no", componentCount, width, simd, widenGBs);
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -7,9 +7,23 @@
 #include <iterator>
 #include <time.h>
 #include <algorithm>
+#include <string.h>
 
+#include "../../src/BatchScheduler.hpp"
+#include "../../src/CodestreamIndex.hpp"
+#include "../../src/FrameContainer.hpp"
 #include "../../src/HTJ2KDecoder.hpp"
 #include "../../src/HTJ2KEncoder.hpp"
+#include "../../src/PixelConversion.hpp"
+#include "../../src/SIMDLevel.hpp"
+#include "../../src/SidecarIndex.hpp"
+#include "../../src/VirtualImage.hpp"
+#include "PerfCounters.hpp"
+
+#ifdef OPENJPHJS_ALLOC_PROFILE
+#include "AllocationProfiler.hpp"
+#include "PeakMemory.hpp"
+#endif
 
 void readFile(std::string fileName, std::vector<uint8_t> &vec)
 {
@@ -63,6 +77,16 @@ void sub_timespec(struct timespec t1, struct timespec t2, struct timespec *td)
     }
 }
 
+// checks of this run that failed, main returns 1 if there are any
+size_t failures = 0;
+
+// "OK" if ok, otherwise error, counted in failures
+const char *verdict(bool ok, const char *error)
+{
+    failures += ok ? 0 : 1;
+    return ok ? "OK" : error;
+}
+
 void decodeFile(const char *path, size_t iterations = 1)
 {
     HTJ2KDecoder decoder;
@@ -96,6 +120,765 @@ void decodeFile(const char *path, size_t iterations = 1)
     auto mps = (double)(megaPixels) * fps;
 
     printf("Native-decode %s Pixels=%d megaPixels=%f TotalTime= %.2f ms TPF=%.2f ms (%.2f MP/s, %.2f FPS)\n", path, pixels, megaPixels, totalTimeMS, timePerFrameMS, mps, fps);
+
+    // hardware counters per frame of a second batch, where permitted
+    PerfCounters counters;
+    if (counters.isAvailable())
+    {
+        counters.start();
+        for (size_t i = 0; i < iterations; i++)
+        {
+            decoder.decode();
+        }
+        printf("Native-counters decode %s %s\n", path, formatPerfCounters(counters.stop(), (double)iterations, (double)decoder.getDecodedBytes().size()).c_str());
+    }
+
+    // verify the fused hash matches a separate pass over the decoded buffer
+    decoder.setComputeHash(true);
+    decoder.decode();
+    const std::vector<uint8_t> &decodedBytes = decoder.getDecodedBytes();
+    const uint64_t hash = XXHash64::hash(decodedBytes.data(), decodedBytes.size());
+    if (decoder.getDecodedHash() != hash)
+    {
+        printf("  ERROR - fused hash %016llx != %016llx\n", (unsigned long long)decoder.getDecodedHash(), (unsigned long long)hash);
+        failures++;
+    }
+}
+
+// Checks XXHash64 against the published XXH64 vectors (seed 0), updates
+// in chunks of every size against one call, and the hash the encoder
+// computes while reading its input against one call over that input
+void hashes(const char *path)
+{
+    bool matches = XXHash64::hash("", 0) == 0xEF46DB3751D8E999ULL && XXHash64::hash("abc", 3) == 0x44BC2CF5AD770999ULL;
+
+    std::vector<uint8_t> data(1000);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = (uint8_t)(i * 2654435761u >> 13);
+    }
+    const uint64_t expected = XXHash64::hash(data.data(), data.size());
+    for (size_t chunk = 1; chunk <= 65; chunk++)
+    {
+        XXHash64 hasher;
+        for (size_t offset = 0; offset < data.size(); offset += chunk)
+        {
+            hasher.update(data.data() + offset, std::min(chunk, data.size() - offset));
+        }
+        matches = matches && hasher.digest() == expected;
+    }
+
+    HTJ2KDecoder decoder;
+    readFile(path, decoder.getEncodedBytes());
+    decoder.decode();
+    HTJ2KEncoder encoder;
+    encoder.getDecodedBytes(decoder.getFrameInfo()) = decoder.getDecodedBytes();
+    encoder.setComputeHash(true);
+    encoder.encode();
+    matches = matches && encoder.getDecodedHash() == XXHash64::hash(decoder.getDecodedBytes().data(), decoder.getDecodedBytes().size());
+    printf("Native-hash %s %s\n", path, verdict(matches, "ERROR - hashes differ from the reference"));
+}
+
+// Decodes every tile of a codestream on its own (cut out with
+// CodestreamIndex) and checks the pixels against the full decode
+void decodeTiles(const char *path, size_t decompositionLevel = 0)
+{
+    std::vector<uint8_t> encodedBytes;
+    readFile(path, encodedBytes);
+    HTJ2KDecoder decoder;
+    decoder.setEncodedBytes(&encodedBytes);
+    decoder.decodeSubResolution(decompositionLevel);
+    const FrameInfo frameInfo = decoder.getFrameInfo();
+    const size_t bytesPerPixel = frameInfo.componentCount * ((frameInfo.bitsPerSample + 8 - 1) / 8);
+    const Size size = decoder.calculateSizeAtDecompositionLevel(decompositionLevel);
+
+    CodestreamIndex index;
+    index.parse(encodedBytes.data(), encodedBytes.size());
+    size_t mismatches = 0;
+    for (uint32_t tileIndex = 0; tileIndex < index.getTileCount(); tileIndex++)
+    {
+        HTJ2KDecoder tileDecoder;
+        index.extractTile(encodedBytes.data(), encodedBytes.size(), tileIndex, tileDecoder.getEncodedBytes());
+        tileDecoder.decodeSubResolution(decompositionLevel);
+        const Rect rect = index.getTileRect(tileIndex, decompositionLevel);
+        for (uint32_t y = 0; y < rect.height; y++)
+        {
+            const uint8_t *expected = decoder.getDecodedBytes().data() + ((size_t)(rect.y + y) * size.width + rect.x) * bytesPerPixel;
+            const uint8_t *actual = tileDecoder.getDecodedBytes().data() + (size_t)y * rect.width * bytesPerPixel;
+            mismatches += memcmp(expected, actual, rect.width * bytesPerPixel) != 0;
+        }
+    }
+    printf("Native-tiles %s level=%zu tiles=%u %s\n", path, decompositionLevel, index.getTileCount(),
+           verdict(!mismatches, "ERROR - tile pixels differ from the full decode"));
+}
+
+// Decodes into tiled output layouts and checks every pixel against the
+// row-major decode, the padding must be zero and the fused hash must match
+// the buffer
+void decodeLayouts(const char *path, size_t decompositionLevel, const OutputLayout &layout)
+{
+    std::vector<uint8_t> encodedBytes;
+    readFile(path, encodedBytes);
+    HTJ2KDecoder decoder;
+    decoder.setEncodedBytes(&encodedBytes);
+    decoder.decodeSubResolution(decompositionLevel);
+    const std::vector<uint8_t> rowMajor = decoder.getDecodedBytes();
+    const FrameInfo frameInfo = decoder.getFrameInfo();
+    const size_t bytesPerPixel = frameInfo.componentCount * ((frameInfo.bitsPerSample + 8 - 1) / 8);
+    const Size size = decoder.calculateSizeAtDecompositionLevel(decompositionLevel);
+
+    decoder.setOutputLayout(layout);
+    decoder.setComputeHash(true);
+    decoder.decodeSubResolution(decompositionLevel);
+    const std::vector<uint8_t> &tiled = decoder.getDecodedBytes();
+    const OutputTiling tiling(layout, size);
+    std::vector<bool> written(tiling.getPixelCount(), false);
+    size_t mismatches = tiled.size() != tiling.getPixelCount() * bytesPerPixel ||
+                        decoder.getDecodedHash() != XXHash64::hash(tiled.data(), tiled.size());
+    for (uint32_t y = 0; y < size.height && !mismatches; y++)
+    {
+        for (uint32_t x = 0; x < size.width; x++)
+        {
+            const size_t index = tiling.getPixelIndex(x, y);
+            written[index] = true;
+            mismatches += memcmp(&tiled[index * bytesPerPixel], &rowMajor[((size_t)y * size.width + x) * bytesPerPixel], bytesPerPixel) != 0;
+        }
+    }
+    for (size_t index = 0; index < written.size() && !mismatches; index++)
+    {
+        for (size_t b = 0; b < bytesPerPixel && !written[index]; b++)
+        {
+            mismatches += tiled[index * bytesPerPixel + b] != 0;
+        }
+    }
+    printf("Native-layout %s level=%zu order=%u tile=%ux%u %s\n", path, decompositionLevel, (uint32_t)layout.order,
+           tiling.tileWidth, tiling.tileHeight, verdict(!mismatches, "ERROR - pixels differ from the row-major decode"));
+}
+
+// Pans a viewport across the image at decompositionLevel through a
+// VirtualImage and compares every view against the full decode
+void virtualImage(const char *path, size_t decompositionLevel, uint32_t viewWidth, uint32_t viewHeight)
+{
+    std::vector<uint8_t> encodedBytes;
+    readFile(path, encodedBytes);
+    HTJ2KDecoder decoder;
+    decoder.setEncodedBytes(&encodedBytes);
+    decoder.decodeSubResolution(decompositionLevel);
+    const FrameInfo frameInfo = decoder.getFrameInfo();
+    const size_t bytesPerPixel = frameInfo.componentCount * ((frameInfo.bitsPerSample + 8 - 1) / 8);
+    const Size size = decoder.calculateSizeAtDecompositionLevel(decompositionLevel);
+
+    VirtualImageSettings settings;
+    settings.memoryBudget = 4 << 20;
+    VirtualImage image(encodedBytes.data(), encodedBytes.size(), settings);
+    size_t views = 0, mismatches = 0;
+    for (uint32_t y = 0; y < size.height; y += viewHeight / 2)
+    {
+        for (uint32_t x = 0; x < size.width; x += viewWidth / 2, views++)
+        {
+            const Rect rect(x, y, std::min(viewWidth, size.width - x), std::min(viewHeight, size.height - y));
+            const std::vector<uint8_t> pixels = image.getPixels(rect, (uint32_t)decompositionLevel);
+            for (uint32_t row = 0; row < rect.height; row++)
+            {
+                const uint8_t *expected = decoder.getDecodedBytes().data() + ((size_t)(rect.y + row) * size.width + rect.x) * bytesPerPixel;
+                mismatches += memcmp(expected, &pixels[(size_t)row * rect.width * bytesPerPixel], rect.width * bytesPerPixel) != 0;
+            }
+        }
+    }
+    const VirtualImage::Statistics statistics = image.getStatistics();
+
+    // without prefetching every cache miss is one decode on this thread
+    settings.prefetchThreads = 0;
+    VirtualImage serial(encodedBytes.data(), encodedBytes.size(), settings);
+    serial.getPixels(Rect(0, 0, size.width, size.height), (uint32_t)decompositionLevel);
+    const VirtualImage::Statistics serialStatistics = serial.getStatistics();
+    const bool counted = serialStatistics.tilesDecoded > 0 && serialStatistics.cacheMisses == serialStatistics.tilesDecoded;
+    printf("Native-virtual %s level=%zu views=%zu decoded=%llu prefetched=%llu hits=%llu %s\n", path, decompositionLevel, views,
+           (unsigned long long)statistics.tilesDecoded, (unsigned long long)statistics.tilesPrefetched, (unsigned long long)statistics.cacheHits,
+           verdict(!mismatches && counted, !mismatches ? "ERROR - cache misses differ from the tiles decoded" : "ERROR - views differ from the full decode"));
+}
+
+// Decodes the fixture at path into decoder and encodes its pixels into
+// encoder with tileSize, and any settings made before, as the reference
+// codestream of the tiled coding tests
+void reencode(const char *path, Size tileSize, HTJ2KDecoder &decoder, HTJ2KEncoder &encoder)
+{
+    readFile(path, decoder.getEncodedBytes());
+    decoder.decode();
+    encoder.getDecodedBytes(decoder.getFrameInfo()) = decoder.getDecodedBytes();
+    encoder.setTileSize(tileSize);
+    encoder.encode();
+}
+
+// Encodes the frame with tiles into a buffer and through the output
+// callback, the streamed codestream must be identical
+void streamFile(const char *path, Size tileSize)
+{
+    HTJ2KDecoder decoder;
+    HTJ2KEncoder encoder;
+    reencode(path, tileSize, decoder, encoder);
+    const std::vector<uint8_t> expected = encoder.getEncodedBytes();
+
+    std::vector<uint8_t> streamed;
+    size_t chunks = 0;
+    double firstChunkMs = 0;
+    timespec start, now, delta;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    encoder.setOutputCallback([&](const uint8_t *data, size_t size) {
+        // the first chunk is the main header, time the first tile-parts
+        if (chunks++ == 1)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            sub_timespec(start, now, &delta);
+            firstChunkMs = (delta.tv_sec * 1000000000.0 + delta.tv_nsec) / 1000000.0;
+        }
+        streamed.insert(streamed.end(), data, data + size);
+    });
+    encoder.encode();
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    sub_timespec(start, now, &delta);
+    const double totalMs = (delta.tv_sec * 1000000000.0 + delta.tv_nsec) / 1000000.0;
+    printf("Native-stream %s chunks=%zu first tile-parts after %f of %f ms %s\n", path, chunks, firstChunkMs, totalMs,
+           verdict(streamed == expected, "ERROR - streamed codestream differs"));
+}
+
+// Encodes the frame with tiles from the decoded buffer and from a tile
+// source that copies each tile out of it, the codestreams must be identical
+void tileSourceFile(const char *path, Size tileSize)
+{
+    HTJ2KDecoder decoder;
+    HTJ2KEncoder encoder;
+    reencode(path, tileSize, decoder, encoder);
+    const std::vector<uint8_t> expected = encoder.getEncodedBytes();
+    const FrameInfo frameInfo = decoder.getFrameInfo();
+    const std::vector<uint8_t> &frame = decoder.getDecodedBytes();
+    const size_t bytesPerPixel = frameInfo.componentCount * ((frameInfo.bitsPerSample + 8 - 1) / 8);
+
+    size_t tiles = 0;
+    XXHash64 hash;
+    encoder.setTileSource(frameInfo, [&](uint32_t tileIndex, const Rect &rect, uint8_t *pixels, size_t size) {
+        tiles += tileIndex == tiles && size == (size_t)rect.width * rect.height * bytesPerPixel;
+        for (uint32_t y = 0; y < rect.height; y++)
+        {
+            memcpy(pixels + (size_t)y * rect.width * bytesPerPixel, &frame[((size_t)(rect.y + y) * frameInfo.width + rect.x) * bytesPerPixel], rect.width * bytesPerPixel);
+        }
+        hash.update(pixels, size);
+    });
+    encoder.setComputeHash(true);
+    encoder.encode();
+    const bool matches = encoder.getEncodedBytes() == expected && encoder.getDecodedHash() == hash.digest();
+    printf("Native-tilesource %s tiles=%zu %s\n", path, tiles, verdict(matches, "ERROR - codestream differs from the full frame encode"));
+}
+
+// Re-encodes the frame with tiles and checks that decoding the tiles on a
+// thread pool gives the same pixels and hash as the serial decode
+void decodeParallel(const char *path, Size tileSize, size_t decompositionLevel)
+{
+    HTJ2KDecoder decoder;
+    HTJ2KEncoder encoder;
+    reencode(path, tileSize, decoder, encoder);
+
+    HTJ2KDecoder serial;
+    serial.getEncodedBytes() = encoder.getEncodedBytes();
+    serial.setComputeHash(true);
+    serial.decodeSubResolution(decompositionLevel);
+
+    ThreadPool pool(4);
+    HTJ2KDecoder parallel;
+    parallel.getEncodedBytes() = encoder.getEncodedBytes();
+    parallel.setComputeHash(true);
+    parallel.setThreadPool(&pool);
+    parallel.decodeSubResolution(decompositionLevel);
+    const bool matches = parallel.getDecodedBytes() == serial.getDecodedBytes() && parallel.getDecodedHash() == serial.getDecodedHash();
+    printf("Native-parallel %s level=%zu %s\n", path, decompositionLevel, verdict(matches, "ERROR - parallel decode differs from the serial decode"));
+}
+
+// Encodes the frame with tiles serially and on a thread pool, from the
+// decoded buffer and from a tile source, the codestreams and hashes must
+// be identical
+void encodeParallel(const char *path, Size tileSize)
+{
+    HTJ2KDecoder decoder;
+    HTJ2KEncoder encoder;
+    encoder.setComputeHash(true);
+    reencode(path, tileSize, decoder, encoder);
+    const std::vector<uint8_t> expected = encoder.getEncodedBytes();
+    const uint64_t expectedHash = encoder.getDecodedHash();
+    const FrameInfo frameInfo = decoder.getFrameInfo();
+    const std::vector<uint8_t> &frame = decoder.getDecodedBytes();
+    const size_t bytesPerPixel = frameInfo.componentCount * ((frameInfo.bitsPerSample + 8 - 1) / 8);
+
+    ThreadPool pool(3);
+    encoder.setThreadPool(&pool);
+    encoder.encode();
+    bool matches = encoder.getEncodedBytes() == expected && encoder.getDecodedHash() == expectedHash;
+
+    // tile sources hash the tiles in order, compare with the serial hash
+    uint32_t nextTile = 0;
+    encoder.setTileSource(frameInfo, [&](uint32_t tileIndex, const Rect &rect, uint8_t *pixels, size_t size) {
+        matches = matches && tileIndex == nextTile++;
+        for (uint32_t y = 0; y < rect.height; y++)
+        {
+            memcpy(pixels + (size_t)y * rect.width * bytesPerPixel, &frame[((size_t)(rect.y + y) * frameInfo.width + rect.x) * bytesPerPixel], rect.width * bytesPerPixel);
+        }
+    });
+    encoder.setThreadPool(nullptr);
+    encoder.encode();
+    const uint64_t expectedTileHash = encoder.getDecodedHash();
+    nextTile = 0;
+    encoder.setThreadPool(&pool);
+    encoder.encode();
+    matches = matches && encoder.getEncodedBytes() == expected && encoder.getDecodedHash() == expectedTileHash;
+    printf("Native-parallelencode %s tiles=%u %s\n", path, nextTile, verdict(matches, "ERROR - parallel encode differs from the serial encode"));
+}
+
+// Re-encodes the frame without a color transform in CPRL order and checks
+// that encoding the components on a thread pool gives the serial
+// codestream, and that with tile-parts divided at components decoding them
+// on a thread pool gives the serial pixels
+void encodeComponents(const char *path, Size tileSize)
+{
+    HTJ2KDecoder decoder;
+    readFile(path, decoder.getEncodedBytes());
+    decoder.decode();
+    FrameInfo frameInfo = decoder.getFrameInfo();
+    frameInfo.isUsingColorTransform = false;
+
+    ThreadPool pool(3);
+    bool matches = true;
+    for (bool divided : {false, true})
+    {
+        HTJ2KEncoder encoder;
+        encoder.getDecodedBytes(frameInfo) = decoder.getDecodedBytes();
+        encoder.setTileSize(tileSize);
+        encoder.setProgressionOrder(4);
+        encoder.setTilePartDivisionsAtComponents(divided);
+        encoder.encode();
+        const std::vector<uint8_t> expected = encoder.getEncodedBytes();
+        encoder.setThreadPool(&pool);
+        encoder.encode();
+        matches = matches && encoder.getEncodedBytes() == expected;
+
+        CodestreamIndex index;
+        index.parse(expected.data(), expected.size());
+        matches = matches && index.hasComponentTileParts() == divided;
+
+        HTJ2KDecoder parallel;
+        parallel.getEncodedBytes() = expected;
+        parallel.setThreadPool(&pool);
+        parallel.decode();
+        matches = matches && parallel.getDecodedBytes() == decoder.getDecodedBytes();
+    }
+    printf("Native-components %s components=%zu %s\n", path, (size_t)frameInfo.componentCount,
+           verdict(matches, "ERROR - component parallel coding differs from the serial coding"));
+}
+
+// Encodes the frame lossless with two lossy outputs in one pass, each
+// codestream must equal a separate encode with its quality
+void encodeLossyOutputs(const char *path)
+{
+    HTJ2KDecoder decoder;
+    readFile(path, decoder.getEncodedBytes());
+    decoder.decode();
+
+    const float steps[] = {0.001f, 0.01f};
+    HTJ2KEncoder encoder;
+    encoder.getDecodedBytes(decoder.getFrameInfo()) = decoder.getDecodedBytes();
+    encoder.setComputeHash(true);
+    encoder.encode();
+    const std::vector<uint8_t> lossless = encoder.getEncodedBytes();
+    const uint64_t hash = encoder.getDecodedHash();
+    std::vector<std::vector<uint8_t>> lossy;
+    for (float step : steps)
+    {
+        encoder.setQuality(false, step);
+        encoder.encode();
+        lossy.push_back(encoder.getEncodedBytes());
+    }
+
+    encoder.setQuality(true, 0);
+    for (float step : steps)
+    {
+        encoder.addLossyOutput(step);
+    }
+    encoder.encode();
+    bool matches = encoder.getEncodedBytes() == lossless && encoder.getDecodedHash() == hash && encoder.getLossyOutputCount() == 2;
+    for (size_t i = 0; i < lossy.size(); i++)
+    {
+        matches = matches && encoder.getLossyEncodedBytes(i) == lossy[i] && lossy[i] != lossless;
+    }
+    printf("Native-lossyoutputs %s outputs=%zu %s\n", path, encoder.getLossyOutputCount(),
+           verdict(matches, "ERROR - lossy outputs differ from separate encodes"));
+}
+
+// Converts lines with samples outside the output range at every width up
+// to a few vectors, and decodes and encodes path, at every supported SIMD
+// level.  Everything must match the scalar level
+template <typename T>
+bool simdLineMatches(size_t width)
+{
+    std::vector<int32_t> line(width);
+    for (size_t x = 0; x < width; x++)
+    {
+        line[x] = (int32_t)(x * 2654435761u) >> (x % 16);
+    }
+    setSIMDLevel(SIMDLevel::Scalar);
+    std::vector<T> expected(width), narrowed(width);
+    std::vector<int32_t> expectedWide(width), widened(width);
+    narrowLine<T>(line.data(), expected.data(), width, 1);
+    widenLine<T>(expected.data(), expectedWide.data(), width, 1);
+    bool matches = true;
+    for (SIMDLevel level : {SIMDLevel::SSE2, SIMDLevel::AVX2, SIMDLevel::SIMD128})
+    {
+        if (isSIMDLevelSupported(level))
+        {
+            setSIMDLevel(level);
+            narrowLine<T>(line.data(), narrowed.data(), width, 1);
+            widenLine<T>(expected.data(), widened.data(), width, 1);
+            matches = matches && narrowed == expected && widened == expectedWide;
+        }
+    }
+    return matches;
+}
+
+void simdLevels(const char *path)
+{
+    const SIMDLevel initial = getSIMDLevel();
+    bool matches = true;
+    for (size_t width = 0; width < 100; width++)
+    {
+        matches = matches && simdLineMatches<uint8_t>(width) && simdLineMatches<int16_t>(width) && simdLineMatches<uint16_t>(width);
+    }
+
+    std::string levels;
+    std::vector<uint8_t> expectedDecoded, expectedEncoded;
+    for (SIMDLevel level : {SIMDLevel::Scalar, SIMDLevel::SSE2, SIMDLevel::AVX2, SIMDLevel::SIMD128})
+    {
+        if (!isSIMDLevelSupported(level))
+        {
+            continue;
+        }
+        setSIMDLevel(level);
+        levels += std::string(levels.empty() ? "" : ",") + getSIMDLevelName(level);
+        HTJ2KDecoder decoder;
+        readFile(path, decoder.getEncodedBytes());
+        decoder.decode();
+        HTJ2KEncoder encoder;
+        encoder.getDecodedBytes(decoder.getFrameInfo()) = decoder.getDecodedBytes();
+        encoder.encode();
+        if (level == SIMDLevel::Scalar)
+        {
+            expectedDecoded = decoder.getDecodedBytes();
+            expectedEncoded = encoder.getEncodedBytes();
+        }
+        matches = matches && decoder.getDecodedBytes() == expectedDecoded && encoder.getEncodedBytes() == expectedEncoded;
+    }
+    setSIMDLevel(initial);
+    printf("Native-simd %s levels=%s %s\n", path, levels.c_str(), verdict(matches, "ERROR - SIMD kernels differ from the scalar kernels"));
+}
+
+// Decodes and encodes a batch of the fixtures plus a tiled re-encode of the
+// last one with every Parallelism, the results must match serial coding.
+// A batch of small frames must run frame parallel and a lone tiled frame
+// intra parallel
+void batchScheduler(const std::vector<const char *> &paths)
+{
+    std::vector<std::vector<uint8_t>> codestreams(paths.size());
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        readFile(paths[i], codestreams[i]);
+    }
+    HTJ2KDecoder decoder;
+    decoder.getEncodedBytes() = codestreams.back();
+    decoder.decode();
+    HTJ2KEncoder encoder;
+    encoder.getDecodedBytes(decoder.getFrameInfo()) = decoder.getDecodedBytes();
+    encoder.setTileSize(Size(256, 256));
+    encoder.encode();
+    codestreams.push_back(encoder.getEncodedBytes());
+
+    std::vector<std::vector<uint8_t>> expected;
+    for (const std::vector<uint8_t> &codestream : codestreams)
+    {
+        decoder.getEncodedBytes() = codestream;
+        decoder.decode();
+        expected.push_back(decoder.getDecodedBytes());
+    }
+
+    ThreadPool pool(3);
+    BatchScheduler scheduler(pool);
+    bool matches = true;
+    for (Parallelism parallelism : {Parallelism::Frame, Parallelism::Intra, Parallelism::Auto})
+    {
+        scheduler.setParallelism(parallelism);
+        std::vector<DecodeJob> decodeJobs(codestreams.size());
+        for (size_t i = 0; i < codestreams.size(); i++)
+        {
+            decodeJobs[i].data = codestreams[i].data();
+            decodeJobs[i].size = codestreams[i].size();
+        }
+        scheduler.decode(decodeJobs);
+        std::vector<EncodeJob> encodeJobs(codestreams.size());
+        for (size_t i = 0; i < codestreams.size(); i++)
+        {
+            matches = matches && decodeJobs[i].decoded == expected[i];
+            encodeJobs[i].frameInfo = decodeJobs[i].frameInfo;
+            encodeJobs[i].pixels = decodeJobs[i].decoded.data();
+            encodeJobs[i].configure = [](HTJ2KEncoder &encoder) { encoder.setTileSize(Size(256, 256)); };
+        }
+        scheduler.encode(encodeJobs);
+        for (size_t i = 0; i < codestreams.size(); i++)
+        {
+            encoder.getDecodedBytes(decodeJobs[i].frameInfo) = decodeJobs[i].decoded;
+            encoder.encode();
+            matches = matches && encodeJobs[i].encoded == encoder.getEncodedBytes();
+        }
+    }
+
+    std::vector<DecodeJob> small(16);
+    for (DecodeJob &job : small)
+    {
+        job.data = codestreams.front().data();
+        job.size = codestreams.front().size();
+    }
+    std::vector<DecodeJob> large(1);
+    large[0].data = codestreams.back().data();
+    large[0].size = codestreams.back().size();
+    scheduler.decode(small);
+    const bool smallIsFrame = scheduler.getLastPlan().intraJobs.empty();
+    scheduler.decode(large);
+    const bool largeIsIntra = scheduler.getLastPlan().intraJobs.size() == 1;
+    printf("Native-scheduler jobs=%zu %s\n", codestreams.size(),
+           verdict(matches && smallIsFrame && largeIsIntra,
+                   !matches ? "ERROR - scheduled coding differs from serial coding" : "ERROR - unexpected plan"));
+}
+
+// Returns the error readHeader() (and decode() if decode is set) throws
+// for the codestream under limits, or an empty string if it succeeds
+std::string limitError(const std::vector<uint8_t> &codestream, const DecoderLimits &limits, bool decode = false)
+{
+    HTJ2KDecoder decoder;
+    decoder.setLimits(limits);
+    decoder.setEncodedBytes(codestream.data(), codestream.size());
+    try
+    {
+        decoder.readHeader();
+        if (decode)
+        {
+            decoder.decode();
+        }
+    }
+    catch (const std::exception &e)
+    {
+        return e.what();
+    }
+    return "";
+}
+
+// Overwrites the big endian 32 bit SIZ field at offset in the codestream
+void setSizField(std::vector<uint8_t> &codestream, size_t offset, uint32_t value)
+{
+    codestream[offset] = value >> 24;
+    codestream[offset + 1] = value >> 16;
+    codestream[offset + 2] = value >> 8;
+    codestream[offset + 3] = value;
+}
+
+// Checks each decoder limit once just inside and once just outside the
+// value of a header.  CT1 is 512x512 16 bit with one tile, 5
+// decompositions and 64x64 codeblocks, 1 + 3 * 3 + 12 + 48 = 70
+// codeblocks.  Tiled is CT1 with 128x128 tiles in the main header, 16
+// tiles.  Hostile places a 100x100 image at the end of the 32 bit
+// coordinate range on a grid of 1x1 tiles starting at 0, which must be
+// rejected without visiting the tiles in front of the image
+void decoderLimits(const char *ct1Path, const char *largePath)
+{
+    std::vector<uint8_t> ct1, large;
+    readFile(ct1Path, ct1);
+    readFile(largePath, large);
+
+    std::vector<uint8_t> tiled = ct1;
+    setSizField(tiled, 24, 128);
+    setSizField(tiled, 28, 128);
+
+    std::vector<uint8_t> hostile = ct1;
+    setSizField(hostile, 8, 0xFFFFFFFF);
+    setSizField(hostile, 12, 0xFFFFFFFF);
+    setSizField(hostile, 16, 0xFFFFFFFF - 100);
+    setSizField(hostile, 20, 0xFFFFFFFF - 100);
+    setSizField(hostile, 24, 1);
+    setSizField(hostile, 28, 1);
+    setSizField(hostile, 32, 0);
+    setSizField(hostile, 36, 0);
+
+    struct Case
+    {
+        const char *name;
+        const std::vector<uint8_t> *codestream;
+        DecoderLimits inside;
+        DecoderLimits outside;
+        bool decode;
+    };
+    auto limits = [](uint32_t maxPixels, uint32_t maxOutputBytes, uint32_t maxTiles, uint32_t maxCodeblocks, uint32_t maxDecodeTimeMs) {
+        DecoderLimits result;
+        result.maxPixels = maxPixels;
+        result.maxOutputBytes = maxOutputBytes;
+        result.maxTiles = maxTiles;
+        result.maxCodeblocks = maxCodeblocks;
+        result.maxDecodeTimeMs = maxDecodeTimeMs;
+        return result;
+    };
+    const Case cases[] = {
+        {"maxPixels", &ct1, limits(512 * 512, 0, 0, 0, 0), limits(512 * 512 - 1, 0, 0, 0, 0), false},
+        {"maxOutputBytes", &ct1, limits(0, 512 * 512 * 2, 0, 0, 0), limits(0, 512 * 512 * 2 - 1, 0, 0, 0), false},
+        {"maxTiles", &tiled, limits(0, 0, 16, 0, 0), limits(0, 0, 15, 0, 0), false},
+        {"maxCodeblocks", &ct1, limits(0, 0, 0, 70, 0), limits(0, 0, 0, 69, 0), false},
+        {"maxCodeblocks tiled", &tiled, limits(0, 0, 0, 16 * 16, 0), limits(0, 0, 0, 16 * 16 - 1, 0), false},
+        {"maxDecodeTimeMs", &large, limits(0, 0, 0, 0, 60000), limits(0, 0, 0, 0, 1), true},
+    };
+    for (const Case &c : cases)
+    {
+        const std::string inside = limitError(*c.codestream, c.inside, c.decode);
+        const std::string outside = limitError(*c.codestream, c.outside, c.decode);
+        const std::string error = !inside.empty() ? "ERROR - inside the limit: " + inside : outside.empty() ? "ERROR - limit not enforced" : "";
+        printf("Native-limits %s %s\n", c.name, verdict(error.empty(), error.c_str()));
+    }
+
+    timespec start, finish, delta;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const std::string hostileError = limitError(hostile, limits(0, 0, 0, 1000, 0));
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    sub_timespec(start, finish, &delta);
+    const double hostileMS = delta.tv_sec * 1000.0 + delta.tv_nsec / 1000000.0;
+    printf("Native-limits hostile SIZ TotalTime= %.2f ms %s\n", hostileMS,
+           verdict(!hostileError.empty() && hostileMS <= 1000, hostileError.empty() ? "ERROR - limit not enforced" : "ERROR - too slow"));
+}
+
+// Writes the frame re-encoded frameCount times into a multi-frame
+// container, appends one more frame, and decodes every frame zero-copy
+// from the memory mapped container
+void containerFile(const char *path, size_t frameCount)
+{
+    HTJ2KDecoder decoder;
+    readFile(path, decoder.getEncodedBytes());
+    decoder.setComputeHash(true);
+    decoder.decode();
+    const uint64_t expectedHash = decoder.getDecodedHash();
+
+    HTJ2KEncoder encoder;
+    encoder.getDecodedBytes(decoder.getFrameInfo()) = decoder.getDecodedBytes();
+    encoder.encode();
+    const std::string containerPath = "containertest.htj2k";
+    {
+        FrameContainerWriter writer;
+        writer.create(containerPath, decoder.getFrameInfo());
+        for (size_t i = 0; i < frameCount; i++)
+        {
+            writer.addFrame(encoder.getEncodedBytes());
+        }
+    }
+    {
+        FrameContainerWriter writer;
+        writer.append(containerPath);
+        writer.addFrame(encoder.getEncodedBytes());
+    }
+
+    FrameContainerReader reader;
+    reader.open(containerPath);
+    size_t mismatches = 0;
+    timespec start, finish, delta;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < reader.getFrameCount(); i++)
+    {
+        decoder.setEncodedBytes(reader.getFrame(i), reader.getFrameSize(i));
+        decoder.decode();
+        mismatches += decoder.getDecodedHash() != expectedHash;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    sub_timespec(start, finish, &delta);
+    const size_t framesRead = reader.getFrameCount();
+    reader.close();
+
+    // a trailer whose index offset plus index length wraps around to the
+    // end of the index must not be hashed, the frames are recovered by
+    // scanning instead
+    {
+        std::fstream file(containerPath, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(0, std::ios::end);
+        const uint64_t indexEnd = (uint64_t)file.tellp() - FrameContainerFormat::TrailerLength;
+        const uint64_t hostileCount = 0x10000000;
+        const uint64_t hostileOffset = indexEnd - hostileCount * FrameContainerFormat::IndexEntryLength;
+        char fields[12];
+        for (int i = 0; i < 12; i++)
+        {
+            fields[i] = (char)((i < 8 ? hostileOffset >> (8 * i) : hostileCount >> (8 * (i - 8))) & 0xFF);
+        }
+        file.seekp(indexEnd);
+        file.write(fields, sizeof(fields));
+    }
+    reader.open(containerPath);
+    mismatches += !reader.isRecovered() || reader.getFrameCount() != framesRead;
+    reader.close();
+    remove(containerPath.c_str());
+    printf("Native-container %s frames=%zu TotalTime= %.2f ms %s\n", path, framesRead,
+           (delta.tv_sec * 1000000000.0 + delta.tv_nsec) / 1000000.0,
+           verdict(!mismatches && framesRead == frameCount + 1, "ERROR - frames do not match"));
+}
+
+// Indexes the files into a sidecar index and checks every record against
+// the header HTJ2KDecoder reads through OpenJPH
+void sidecarIndex(const std::vector<const char *> &paths)
+{
+    const std::string indexPath = "sidecartest.idx";
+    {
+        SidecarIndexWriter writer;
+        writer.create(indexPath);
+        for (const char *path : paths)
+        {
+            std::vector<uint8_t> encodedBytes;
+            readFile(path, encodedBytes);
+            writer.addCodestream(writer.addPath(path), 0, 0, encodedBytes.data(), encodedBytes.size());
+        }
+        writer.close();
+    }
+
+    SidecarIndexReader reader;
+    reader.open(indexPath);
+    size_t mismatches = !reader.verify() || reader.getRecordCount() != paths.size();
+    for (size_t i = 0; i < reader.getRecordCount() && !mismatches; i++)
+    {
+        const SidecarRecord record = reader.getRecord(i);
+        HTJ2KDecoder decoder;
+        readFile(reader.getPath(record.pathIndex), decoder.getEncodedBytes());
+        decoder.readHeader();
+        const FrameInfo expected = decoder.getFrameInfo();
+        const FrameInfo actual = record.getFrameInfo();
+        mismatches += expected.width != actual.width || expected.height != actual.height ||
+                      expected.bitsPerSample != actual.bitsPerSample || expected.componentCount != actual.componentCount ||
+                      expected.isSigned != actual.isSigned || expected.isUsingColorTransform != actual.isUsingColorTransform ||
+                      record.length != decoder.getEncodedBytes().size() ||
+                      record.numDecompositions != decoder.getNumDecompositions() ||
+                      record.isReversible != decoder.getIsReversible() ||
+                      record.progressionOrder != decoder.getProgressionOrder() ||
+                      record.numLayers != (uint32_t)decoder.getNumLayers() ||
+                      record.imageOffset.x != decoder.getImageOffset().x || record.imageOffset.y != decoder.getImageOffset().y ||
+                      record.tileSize.width != decoder.getTileSize().width || record.tileSize.height != decoder.getTileSize().height ||
+                      record.tileOffset.x != decoder.getTileOffset().x || record.tileOffset.y != decoder.getTileOffset().y ||
+                      record.blockDimensions.width != decoder.getBlockDimensions().width ||
+                      record.blockDimensions.height != decoder.getBlockDimensions().height;
+        for (size_t c = 0; c < record.componentCount && c < SidecarIndexFormat::MaxDownSamples; c++)
+        {
+            mismatches += record.downSamples[c].x != decoder.getDownSample(c).x || record.downSamples[c].y != decoder.getDownSample(c).y;
+        }
+        for (size_t level = 0; level < record.numDecompositions; level++)
+        {
+            mismatches += record.precincts[level].width != decoder.getPrecinct(level).width ||
+                          record.precincts[level].height != decoder.getPrecinct(level).height;
+        }
+    }
+    reader.close();
+    remove(indexPath.c_str());
+    printf("Native-sidecar records=%zu %s\n", paths.size(), verdict(!mismatches, "ERROR - records differ from the decoder header"));
 }
 
 void encodeFile(const char *inPath, const FrameInfo frameInfo, const char *outPath)
@@ -126,12 +909,119 @@ void encodeFile(const char *inPath, const FrameInfo frameInfo, const char *outPa
     }
 }
 
+#ifdef OPENJPHJS_ALLOC_PROFILE
+void printAllocations(const char *operation, const char *path, size_t iterations, const AllocationStats &stats, double peakKiB)
+{
+    const double mb = 1024.0 * 1024.0;
+    printf("Allocations-%s %s allocations=%llu (%.1f per frame, %.1f%% ojph) allocated=%.2f MB (%.2f MB per frame, %.1f%% ojph) peakHeap=%.2f MB peakRSS=%.2f MB\n",
+           operation, path,
+           (unsigned long long)stats.count, (double)stats.count / iterations, stats.count ? 100.0 * stats.ojphCount / stats.count : 0.0,
+           stats.bytes / mb, stats.bytes / mb / iterations, stats.bytes ? 100.0 * stats.ojphBytes / stats.bytes : 0.0,
+           stats.peakBytes / mb, peakKiB / 1024.0);
+    if (!stats.isAttributed)
+    {
+        printf("  libopenjph is not a loaded shared library, OpenJPH allocations are counted as wrapper\n");
+    }
+}
+
+// Reports allocation count, bytes allocated, peak heap and peak resident
+// memory for decoding the file and re-encoding its pixels
+void profileFile(const char *path, size_t iterations)
+{
+    HTJ2KDecoder decoder;
+    readFile(path, decoder.getEncodedBytes());
+
+    resetPeakMemory();
+    AllocationProfiler::reset();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        decoder.decode();
+    }
+    printAllocations("decode", path, iterations, AllocationProfiler::snapshot(), readPeakKiB());
+
+    HTJ2KEncoder encoder;
+    encoder.getDecodedBytes(decoder.getFrameInfo()) = decoder.getDecodedBytes();
+    resetPeakMemory();
+    AllocationProfiler::reset();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        encoder.encode();
+    }
+    printAllocations("encode", path, iterations, AllocationProfiler::snapshot(), readPeakKiB());
+}
+#endif
+
+// Decodes every j2c fixture and re-encodes the decoded pixels lossless and
+// lossy.  Used as the training run for profile guided builds (build-pgo.sh)
+void train()
+{
+    const char *fixtures[] = {
+        "38320-4k", "CT1", "CT2", "MG1", "MR1", "MR2", "MR3", "MR4",
+        "NM1", "RG1", "RG2", "RG3", "SC1", "US1", "VL1", "XA1"};
+    for (const char *fixture : fixtures)
+    {
+        const std::string path = std::string("test/fixtures/j2c/") + fixture + ".j2c";
+        HTJ2KDecoder decoder;
+        readFile(path, decoder.getEncodedBytes());
+        decoder.decode();
+        decoder.decodeSubResolution(1);
+        decoder.decode();
+
+        for (bool lossless : {true, false})
+        {
+            HTJ2KEncoder encoder;
+            std::vector<uint8_t> &rawBytes = encoder.getDecodedBytes(decoder.getFrameInfo());
+            rawBytes = decoder.getDecodedBytes();
+            encoder.setQuality(lossless, 0.001f);
+            encoder.encode();
+        }
+        printf("Trained on %s\n", path.c_str());
+    }
+}
+
 int main(int argc, char **argv)
 {
+    if (argc > 2 && std::string(argv[2]) == "train")
+    {
+        train();
+        return 0;
+    }
+
     const size_t iterations = (argc > 1) ? atoi(argv[1]) : 1;
+#ifdef OPENJPHJS_ALLOC_PROFILE
+    profileFile("test/fixtures/j2c/CT1.j2c", iterations);
+    profileFile("test/fixtures/j2c/MG1.j2c", iterations);
+    profileFile("test/fixtures/j2c/38320-4k.j2c", iterations);
+    return 0;
+#endif
     decodeFile("test/fixtures/j2c/CT1.j2c", iterations);
     decodeFile("test/fixtures/j2c/MG1.j2c", iterations);
     decodeFile("test/fixtures/j2c/38320-4k.j2c", iterations);
+    hashes("test/fixtures/j2c/CT1.j2c");
+    decodeTiles("test/fixtures/j2c/CT1.j2c");
+    decodeTiles("test/fixtures/j2c/US1.j2c", 1);
+    decodeParallel("test/fixtures/j2c/US1.j2c", Size(128, 96), 0);
+    decodeParallel("test/fixtures/j2c/CT1.j2c", Size(200, 300), 1);
+    encodeParallel("test/fixtures/j2c/38320-4k.j2c", Size(512, 512));
+    encodeParallel("test/fixtures/j2c/CT1.j2c", Size(200, 300));
+    encodeComponents("test/fixtures/j2c/US1.j2c", Size(0, 0));
+    encodeComponents("test/fixtures/j2c/VL1.j2c", Size(256, 256));
+    encodeLossyOutputs("test/fixtures/j2c/CT1.j2c");
+    encodeLossyOutputs("test/fixtures/j2c/US1.j2c");
+    simdLevels("test/fixtures/j2c/CT1.j2c");
+    batchScheduler({"test/fixtures/j2c/CT1.j2c", "test/fixtures/j2c/US1.j2c", "test/fixtures/j2c/MG1.j2c"});
+    decoderLimits("test/fixtures/j2c/CT1.j2c", "test/fixtures/j2c/MG1.j2c");
+    containerFile("test/fixtures/j2c/CT1.j2c", 10);
+    sidecarIndex({"test/fixtures/j2c/CT1.j2c", "test/fixtures/j2c/MG1.j2c", "test/fixtures/j2c/US1.j2c", "test/fixtures/j2c/38320-4k.j2c"});
+    streamFile("test/fixtures/j2c/38320-4k.j2c", Size(512, 512));
+    tileSourceFile("test/fixtures/j2c/38320-4k.j2c", Size(512, 512));
+    tileSourceFile("test/fixtures/j2c/CT1.j2c", Size(200, 300));
+    virtualImage("test/fixtures/j2c/US1.j2c", 0, 200, 150);
+    decodeLayouts("test/fixtures/j2c/CT1.j2c", 0, {OutputOrder::TileMajor, Size(256, 256)});
+    decodeLayouts("test/fixtures/j2c/US1.j2c", 1, {OutputOrder::TileMajor, Size(96, 64)});
+    decodeLayouts("test/fixtures/j2c/US1.j2c", 0, {OutputOrder::Morton, Size(64, 32)});
+    decodeLayouts("test/fixtures/j2c/MG1.j2c", 2, {OutputOrder::Morton, Size(0, 0)});
+    virtualImage("test/fixtures/j2c/US1.j2c", 1, 100, 100);
 
     // decodeFile("test/fixtures/j2c/CT2.j2c");
     // decodeFile("test/fixtures/j2c/MG1.j2c");
@@ -162,5 +1052,5 @@ int main(int argc, char **argv)
     //encodeFile("test/fixtures/raw/38320-4k.RAW", {.width = 3840, .height = 2160, .bitsPerSample = 8, .componentCount = 3, .isSigned = false, .isUsingColorTransform=true}, "test/fixtures/j2c/38320-4k.j2c");
     //encodeFile("../tiffextract/38320.RAW", {.width = 17515, .height = 14440, .bitsPerSample = 8, .componentCount = 3, .isSigned = false, .isUsingColorTransform=true}, "test/fixtures/j2c/38320.j2c");
 
-    return 0;
+    return failures ? 1 : 0;
 }
@@ -0,0 +1,137 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Measures how decoding and encoding one image scale with the number of
+// threads given to HTJ2KDecoder::setThreadPool() and
+// HTJ2KEncoder::setThreadPool().  Every fixture is decoded as stored and
+// re-encoded with 512x512 tiles, and its pixels are encoded untiled and
+// with 512x512 tiles.  Both parallelize across tiles, so single tile
+// images are expected to stay flat and tiled ones to scale until the
+// tiles or cores run out.
+//
+// usage: parallelbench [milliseconds per case] [fixtures...]
+
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "../../src/CodestreamIndex.hpp"
+#include "../../src/HTJ2KDecoder.hpp"
+#include "../../src/HTJ2KEncoder.hpp"
+#include "../../src/ThreadPool.hpp"
+
+static std::vector<uint8_t> readFile(const char *path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error(std::string("cannot open ") + path);
+    }
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// runs operation repeatedly for at least minSeconds and returns megapixels
+// per second
+template <typename F>
+static double measureMPs(F operation, double megapixels, double minSeconds)
+{
+    operation();
+    size_t runs = 0;
+    const auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    do
+    {
+        operation();
+        runs++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < minSeconds);
+    return megapixels * runs / elapsed;
+}
+
+// prints one row per thread count, run(pool) measures with pool (none for
+// the serial row)
+template <typename F>
+static void bench(const std::string &name, const char *operation, uint32_t tiles, F run)
+{
+    const double serial = run(nullptr);
+    printf("%-36s %-6s %5u %7d %9.1f %7.2f\n", name.c_str(), operation, tiles, 1, serial, 1.0);
+    for (size_t threads : {2, 4, 8, 16})
+    {
+        // the calling thread works too, so the pool gets one thread less
+        std::unique_ptr<ThreadPool> pool(new ThreadPool(threads - 1));
+        const double mps = run(pool.get());
+        printf("%-36s %-6s %5u %7zu %9.1f %7.2f\n", name.c_str(), operation, tiles, threads, mps, mps / serial);
+    }
+}
+
+static void benchDecode(const std::string &name, const std::vector<uint8_t> &encoded, double minSeconds)
+{
+    CodestreamIndex index;
+    index.parse(encoded.data(), encoded.size());
+    HTJ2KDecoder decoder;
+    decoder.getEncodedBytes() = encoded;
+    decoder.readHeader();
+    const double megapixels = (double)decoder.getFrameInfo().width * decoder.getFrameInfo().height / 1e6;
+    bench(name, "decode", index.getTileCount(), [&](ThreadPool *pool) {
+        decoder.setThreadPool(pool);
+        return measureMPs([&] { decoder.decode(); }, megapixels, minSeconds);
+    });
+}
+
+static void benchEncode(const std::string &name, const FrameInfo &frameInfo, const std::vector<uint8_t> &pixels, Size tileSize, double minSeconds)
+{
+    HTJ2KEncoder encoder;
+    encoder.getDecodedBytes(frameInfo) = pixels;
+    encoder.setTileSize(tileSize);
+    encoder.encode();
+    CodestreamIndex index;
+    index.parse(encoder.getEncodedBytes().data(), encoder.getEncodedBytes().size());
+    const double megapixels = (double)frameInfo.width * frameInfo.height / 1e6;
+    bench(name, "encode", index.getTileCount(), [&](ThreadPool *pool) {
+        encoder.setThreadPool(pool);
+        return measureMPs([&] { encoder.encode(); }, megapixels, minSeconds);
+    });
+}
+
+int main(int argc, char **argv)
+{
+    const double minSeconds = ((argc > 1) ? atoi(argv[1]) : 1000) / 1000.0;
+    std::vector<const char *> paths(argv + std::min(argc, 2), argv + argc);
+    if (paths.empty())
+    {
+        paths = {"test/fixtures/j2c/MG1.j2c", "test/fixtures/j2c/38320-4k.j2c"};
+    }
+
+    printf("%-36s %-6s %5s %7s %9s %7s\n", "image", "op", "tiles", "threads", "MP/s", "speedup");
+    try
+    {
+        for (const char *path : paths)
+        {
+            const std::vector<uint8_t> encoded = readFile(path);
+            benchDecode(path, encoded, minSeconds);
+
+            HTJ2KDecoder decoder;
+            decoder.getEncodedBytes() = encoded;
+            decoder.decode();
+            HTJ2KEncoder encoder;
+            encoder.getDecodedBytes(decoder.getFrameInfo()) = decoder.getDecodedBytes();
+            encoder.setTileSize(Size(512, 512));
+            encoder.encode();
+            benchDecode(std::string(path) + " 512x512", encoder.getEncodedBytes(), minSeconds);
+
+            benchEncode(path, decoder.getFrameInfo(), decoder.getDecodedBytes(), Size(0, 0), minSeconds);
+            benchEncode(std::string(path) + " 512x512", decoder.getFrameInfo(), decoder.getDecodedBytes(), Size(512, 512), minSeconds);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
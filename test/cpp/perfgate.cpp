@@ -0,0 +1,343 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Performance regression gate.  Measures decode and encode throughput (MP/s)
+// and peak resident memory for fixtures and compares them with a committed
+// baseline.  Each measurement is repeated, the median is compared and a
+// regression is only reported when the whole 95% confidence interval of the
+// median is slower than the baseline by more than the tolerance, so normal
+// run to run noise does not fail the gate.
+//
+// usage:
+//   perfgate [--skip-missing] <baseline.json> <decode|encode> <fixture.j2c>...
+//   perfgate --update <baseline.json> <fixture.j2c>...
+//
+// Exit code is 0 when everything is within tolerance and 1 on a regression
+// or when the baseline has no entry for a fixture.  With --skip-missing
+// fixtures without an entry are skipped instead, with 77 (ctest
+// SKIP_RETURN_CODE) if none was compared.  --update measures every fixture
+// and operation in a new perfgate process, like ctest runs them, so the
+// peak memory of one measurement does not include the heap left by the
+// others.
+// Where Linux perf_event_open is permitted the hardware counters of an
+// extra batch are reported per frame next to each measurement, they are
+// informational and not compared.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "../../src/HTJ2KDecoder.hpp"
+#include "../../src/HTJ2KEncoder.hpp"
+#include "Json.hpp"
+#include "PeakMemory.hpp"
+#include "PerfCounters.hpp"
+
+struct Measurement
+{
+    double medianMPs = 0;
+    double lowMPs = 0;
+    double highMPs = 0;
+    double peakKiB = 0;
+
+    // per frame counters, empty if unavailable
+    std::string counters;
+};
+
+struct Settings
+{
+    size_t runs = 15;
+    double mpsTolerance = 0.10;
+    double memoryTolerance = 0.10;
+};
+
+static bool readFile(const std::string &fileName, std::vector<uint8_t> &vec)
+{
+    std::ifstream file(fileName, std::ios::in | std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    vec.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// "decode/CT1" for ("decode", "test/fixtures/j2c/CT1.j2c")
+static std::string fixtureKey(const std::string &operation, const std::string &path)
+{
+    std::string name = path.substr(path.find_last_of('/') + 1);
+    name = name.substr(0, name.find_last_of('.'));
+    return operation + "/" + name;
+}
+
+static Measurement measure(const std::string &operation, const std::string &path, const Settings &settings)
+{
+    std::unique_ptr<HTJ2KDecoder> decoder(new HTJ2KDecoder());
+    if (!readFile(path, decoder->getEncodedBytes()))
+    {
+        throw std::runtime_error("cannot read " + path);
+    }
+    decoder->decode();
+    const FrameInfo frameInfo = decoder->getFrameInfo();
+    const size_t decodedSize = decoder->getDecodedBytes().size();
+    const bool isDecode = operation == "decode";
+
+    // only the coder being measured is kept, so its peak memory does not
+    // include a copy of the frame held for the other operation
+    std::unique_ptr<HTJ2KEncoder> encoder;
+    if (!isDecode)
+    {
+        encoder.reset(new HTJ2KEncoder());
+        encoder->getDecodedBytes(frameInfo) = std::move(decoder->getDecodedBytes());
+        decoder.reset();
+    }
+
+    auto timeIterations = [&](size_t iterations) {
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++)
+        {
+            if (isDecode)
+            {
+                decoder->decode();
+            }
+            else
+            {
+                encoder->encode();
+            }
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    // warm up and batch small images so every sample takes at least 20 ms
+    size_t iterations = 1;
+    while (timeIterations(iterations) < 0.02)
+    {
+        iterations *= 2;
+    }
+
+    const bool peakAvailable = resetPeakMemory();
+    const double megaPixels = (double)frameInfo.width * frameInfo.height / (1024.0 * 1024.0);
+    std::vector<double> samples;
+    for (size_t run = 0; run < settings.runs; run++)
+    {
+        samples.push_back(megaPixels * iterations / timeIterations(iterations));
+    }
+    std::sort(samples.begin(), samples.end());
+
+    // distribution free 95% confidence interval of the median from the
+    // binomial order statistics
+    const double n = (double)samples.size();
+    const double halfWidth = 1.96 * sqrt(n) / 2;
+    const size_t low = (size_t)std::max(0.0, floor(n / 2 - halfWidth));
+    const size_t high = (size_t)std::min(n - 1, ceil(n / 2 + halfWidth) - 1);
+
+    Measurement result;
+    result.medianMPs = samples.size() % 2 ? samples[samples.size() / 2] : (samples[samples.size() / 2 - 1] + samples[samples.size() / 2]) / 2;
+    result.lowMPs = samples[low];
+    result.highMPs = samples[high];
+    result.peakKiB = peakAvailable ? readPeakKiB() : 0;
+
+    PerfCounters counters;
+    if (counters.isAvailable())
+    {
+        counters.start();
+        timeIterations(iterations);
+        result.counters = formatPerfCounters(counters.stop(), (double)iterations, (double)decodedSize);
+    }
+    return result;
+}
+
+static Settings readSettings(const JsonValue &baseline)
+{
+    Settings settings;
+    settings.runs = (size_t)baseline["runs"].asNumber((double)settings.runs);
+    settings.mpsTolerance = baseline["mpsTolerance"].asNumber(settings.mpsTolerance);
+    settings.memoryTolerance = baseline["memoryTolerance"].asNumber(settings.memoryTolerance);
+    return settings;
+}
+
+static Settings readSettings(const std::string &baselinePath)
+{
+    std::vector<uint8_t> existing;
+    return readFile(baselinePath, existing) ? readSettings(JsonValue::parse(std::string(existing.begin(), existing.end()))) : Settings();
+}
+
+// perfgate --measure <baseline.json> <decode|encode> <fixture.j2c>, run by
+// update() in a child process.  Prints the measurement on the first line
+// and the counters on the second
+static int measureChild(const std::string &baselinePath, const std::string &operation, const std::string &fixture)
+{
+    const Measurement measured = measure(operation, fixture, readSettings(baselinePath));
+    printf("%.17g %.17g %.17g %.17g\n%s\n", measured.medianMPs, measured.lowMPs, measured.highMPs, measured.peakKiB, measured.counters.c_str());
+    return 0;
+}
+
+// Quotes text for /bin/sh
+static std::string shellQuote(const std::string &text)
+{
+    std::string quoted = "'";
+    for (char c : text)
+    {
+        quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    }
+    return quoted + "'";
+}
+
+// Measures in a new process of this executable, see measureChild()
+static Measurement measureInProcess(const std::string &self, const std::string &baselinePath, const std::string &operation, const std::string &fixture)
+{
+    const std::string command = shellQuote(self) + " --measure " + shellQuote(baselinePath) + " " + operation + " " + shellQuote(fixture);
+    FILE *child = popen(command.c_str(), "r");
+    if (!child)
+    {
+        throw std::runtime_error("cannot run " + command);
+    }
+    Measurement result;
+    char counters[1024] = "";
+    const int fields = fscanf(child, "%lf %lf %lf %lf\n", &result.medianMPs, &result.lowMPs, &result.highMPs, &result.peakKiB);
+    if (fields == 4 && fgets(counters, sizeof(counters), child))
+    {
+        counters[strcspn(counters, "\n")] = 0;
+        result.counters = counters;
+    }
+    if (pclose(child) != 0 || fields != 4)
+    {
+        throw std::runtime_error("measuring " + fixtureKey(operation, fixture) + " failed");
+    }
+    return result;
+}
+
+static int update(const std::string &self, const std::string &baselinePath, const std::vector<std::string> &fixtures)
+{
+    const Settings settings = readSettings(baselinePath);
+
+    std::map<std::string, Measurement> measurements;
+    for (const std::string &fixture : fixtures)
+    {
+        for (const char *operation : {"decode", "encode"})
+        {
+            const std::string key = fixtureKey(operation, fixture);
+            measurements[key] = measureInProcess(self, baselinePath, operation, fixture);
+            const Measurement &measured = measurements[key];
+            printf("%-20s %9.2f MP/s %9.0f KiB%s%s\n", key.c_str(), measured.medianMPs, measured.peakKiB, measured.counters.empty() ? "" : " ", measured.counters.c_str());
+        }
+    }
+
+    FILE *file = fopen(baselinePath.c_str(), "w");
+    if (!file)
+    {
+        fprintf(stderr, "cannot write %s\n", baselinePath.c_str());
+        return 1;
+    }
+    fprintf(file, "{\n  \"runs\": %zu,\n  \"mpsTolerance\": %.2f,\n  \"memoryTolerance\": %.2f,\n  \"fixtures\": {", settings.runs, settings.mpsTolerance, settings.memoryTolerance);
+    const char *separator = "\n";
+    for (const auto &entry : measurements)
+    {
+        fprintf(file, "%s    \"%s\": { \"mps\": %.2f, \"peakKiB\": %.0f }", separator, entry.first.c_str(), entry.second.medianMPs, entry.second.peakKiB);
+        separator = ",\n";
+    }
+    fprintf(file, "\n  }\n}\n");
+    fclose(file);
+    return 0;
+}
+
+static int compare(const std::string &baselinePath, const std::string &operation, const std::vector<std::string> &fixtures, bool skipMissing)
+{
+    std::vector<uint8_t> text;
+    if (!readFile(baselinePath, text))
+    {
+        fprintf(stderr, "cannot read %s\n", baselinePath.c_str());
+        return 1;
+    }
+    const JsonValue baseline = JsonValue::parse(std::string(text.begin(), text.end()));
+    const Settings settings = readSettings(baseline);
+
+    size_t compared = 0;
+    size_t failed = 0;
+    size_t missing = 0;
+    printf("%-20s %28s %10s %8s %10s %10s %8s\n", "fixture", "MP/s median [95% CI]", "baseline", "diff", "peak KiB", "baseline", "diff");
+    for (const std::string &fixture : fixtures)
+    {
+        const std::string key = fixtureKey(operation, fixture);
+        const JsonValue &expected = baseline["fixtures"][key];
+        if (expected.type != JsonValue::Object)
+        {
+            printf("%-20s no baseline%s\n", key.c_str(), skipMissing ? ", skipped" : "");
+            missing++;
+            continue;
+        }
+        const Measurement measured = measure(operation, fixture, settings);
+        const double baselineMPs = expected["mps"].asNumber();
+        const double baselineKiB = expected["peakKiB"].asNumber();
+
+        // slower only if even the optimistic end of the interval is too slow
+        const bool slower = baselineMPs > 0 && measured.highMPs < baselineMPs * (1 - settings.mpsTolerance);
+        const bool larger = baselineKiB > 0 && measured.peakKiB > baselineKiB * (1 + settings.memoryTolerance);
+        const double mpsDiff = baselineMPs > 0 ? (measured.medianMPs / baselineMPs - 1) * 100 : 0;
+        const double memoryDiff = baselineKiB > 0 && measured.peakKiB > 0 ? (measured.peakKiB / baselineKiB - 1) * 100 : 0;
+        printf("%-20s %8.2f [%8.2f, %8.2f] %10.2f %+7.1f%% %10.0f %10.0f %+7.1f%% %s%s\n",
+               key.c_str(), measured.medianMPs, measured.lowMPs, measured.highMPs, baselineMPs, mpsDiff,
+               measured.peakKiB, baselineKiB, memoryDiff,
+               slower ? " SLOWER" : "", larger ? " MORE MEMORY" : "");
+        if (!measured.counters.empty())
+        {
+            printf("%-20s %s\n", "", measured.counters.c_str());
+        }
+        compared++;
+        failed += (slower || larger) ? 1 : 0;
+    }
+
+    if (missing)
+    {
+        printf("%zu fixtures have no baseline entry, record them with: perfgate --update %s <fixtures>\n", missing, baselinePath.c_str());
+        if (!skipMissing)
+        {
+            return 1;
+        }
+    }
+    if (compared == 0)
+    {
+        return 77;
+    }
+    printf("%zu of %zu fixtures regressed beyond %.0f%% throughput / %.0f%% memory tolerance\n",
+           failed, compared, settings.mpsTolerance * 100, settings.memoryTolerance * 100);
+    return failed ? 1 : 0;
+}
+
+// Path of this executable for starting the measurement processes
+static std::string selfPath(const char *argv0)
+{
+    char path[4096];
+    const ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    return length > 0 ? std::string(path, length) : std::string(argv0);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 3 && strcmp(argv[1], "--update") == 0)
+    {
+        return update(selfPath(argv[0]), argv[2], std::vector<std::string>(argv + 3, argv + argc));
+    }
+    if (argc == 5 && strcmp(argv[1], "--measure") == 0)
+    {
+        return measureChild(argv[2], argv[3], argv[4]);
+    }
+    const bool skipMissing = argc > 1 && strcmp(argv[1], "--skip-missing") == 0;
+    const int first = skipMissing ? 2 : 1;
+    if (argc > first + 2 && (strcmp(argv[first + 1], "decode") == 0 || strcmp(argv[first + 1], "encode") == 0))
+    {
+        return compare(argv[first], argv[first + 1], std::vector<std::string>(argv + first + 2, argv + argc), skipMissing);
+    }
+    fprintf(stderr, "usage: perfgate [--skip-missing] <baseline.json> <decode|encode> <fixture.j2c>...\n"
+                    "       perfgate --update <baseline.json> <fixture.j2c>...\n");
+    return 1;
+}
@@ -0,0 +1,215 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Compares BatchScheduler's cost model (Auto) with always running jobs
+// concurrently (Frame) and always splitting them (Intra) on batches built
+// from the fixtures: every fixture once, a series of 64 copies of the
+// first fixture, and each fixture alone re-encoded with 512x512 tiles.
+// Each batch is decoded and re-encoded with 512x512 tiles, the best of
+// the repetitions is reported.
+//
+// First the per task overhead of the cost model is calibrated: each tiled
+// fixture is decoded and encoded whole and split into its tasks on the
+// calling thread alone, and the extra time per task is converted to
+// samples at the serial rate.  The median is printed and used for the
+// Auto runs; put it in BatchScheduler::taskOverhead_ when it differs much
+// from the default on the reference machine.
+//
+// usage: schedulerbench [threads] [repetitions] [fixtures...]
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "../../src/BatchScheduler.hpp"
+
+static std::vector<uint8_t> readFile(const char *path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error(std::string("cannot open ") + path);
+    }
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// best time in milliseconds of repetitions runs
+template <typename F>
+static double bestMs(F run, size_t repetitions)
+{
+    double best = 0;
+    for (size_t i = 0; i < repetitions; i++)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        run();
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        best = i == 0 ? ms : std::min(best, ms);
+    }
+    return best;
+}
+
+// Extra cost in samples of splitting one tiled codestream into tasks,
+// for decoding and for encoding, from timing the serial and the split
+// coding on the calling thread alone
+static std::vector<double> measureTaskOverhead(const std::vector<uint8_t> &tiled, size_t repetitions)
+{
+    ThreadPool callerOnly(0);
+    HTJ2KDecoder decoder;
+    decoder.setEncodedBytes(tiled.data(), tiled.size());
+    decoder.decode();
+    const FrameInfo frameInfo = decoder.getFrameInfo();
+    const size_t tasks = decoder.getParallelTaskCount();
+    if (tasks < 2)
+    {
+        return {};
+    }
+    HTJ2KEncoder encoder;
+    encoder.getDecodedBytes(frameInfo) = decoder.getDecodedBytes();
+    encoder.setTileSize(Size(512, 512));
+    const double samples = (double)frameInfo.width * frameInfo.height * frameInfo.componentCount;
+
+    std::vector<double> overheads;
+    for (int operation = 0; operation < 2; operation++)
+    {
+        double ms[2];
+        for (int split = 0; split < 2; split++)
+        {
+            decoder.setThreadPool(split ? &callerOnly : nullptr);
+            encoder.setThreadPool(split ? &callerOnly : nullptr);
+            ms[split] = bestMs([&] {
+                if (operation == 0)
+                {
+                    decoder.decode();
+                }
+                else
+                {
+                    encoder.encode();
+                }
+            }, repetitions);
+        }
+        overheads.push_back(std::max(0.0, ms[1] - ms[0]) / tasks * samples / ms[0]);
+    }
+    return overheads;
+}
+
+static void bench(BatchScheduler &scheduler, const std::string &name, const std::vector<const std::vector<uint8_t> *> &batch, size_t repetitions)
+{
+    std::vector<DecodeJob> decodeJobs(batch.size());
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        decodeJobs[i].data = batch[i]->data();
+        decodeJobs[i].size = batch[i]->size();
+    }
+    scheduler.setParallelism(Parallelism::Auto);
+    scheduler.decode(decodeJobs);
+    std::vector<EncodeJob> encodeJobs(batch.size());
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        encodeJobs[i].frameInfo = decodeJobs[i].frameInfo;
+        encodeJobs[i].pixels = decodeJobs[i].decoded.data();
+        encodeJobs[i].configure = [](HTJ2KEncoder &encoder) { encoder.setTileSize(Size(512, 512)); };
+    }
+
+    const char *names[] = {"auto", "frame", "intra"};
+    for (const char *operation : {"decode", "encode"})
+    {
+        for (Parallelism parallelism : {Parallelism::Auto, Parallelism::Frame, Parallelism::Intra})
+        {
+            scheduler.setParallelism(parallelism);
+            const bool decode = operation[0] == 'd';
+            // decode into copies so the encode jobs keep their pixels
+            std::vector<DecodeJob> jobs = decodeJobs;
+            const double ms = bestMs([&] {
+                if (decode)
+                {
+                    scheduler.decode(jobs);
+                }
+                else
+                {
+                    scheduler.encode(encodeJobs);
+                }
+            }, repetitions);
+            const BatchPlan &plan = scheduler.getLastPlan();
+            printf("%-36s %6zu %-6s %-5s %10.2f %6zu\n", name.c_str(), batch.size(), operation, names[(int)parallelism], ms, plan.intraJobs.size());
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const size_t threads = (argc > 1) ? atoi(argv[1]) : 0;
+    const size_t repetitions = (argc > 2) ? atoi(argv[2]) : 3;
+    std::vector<const char *> paths(argv + std::min(argc, 3), argv + argc);
+    if (paths.empty())
+    {
+        paths = {"test/fixtures/j2c/CT1.j2c", "test/fixtures/j2c/MR1.j2c", "test/fixtures/j2c/US1.j2c",
+                 "test/fixtures/j2c/MG1.j2c", "test/fixtures/j2c/38320-4k.j2c"};
+    }
+
+    // the calling thread works too
+    ThreadPool pool(threads > 1 ? threads - 1 : 0);
+    BatchScheduler scheduler(pool);
+    printf("threads %zu\n", pool.getThreadCount() + 1);
+    try
+    {
+        std::vector<std::vector<uint8_t>> codestreams;
+        std::vector<std::vector<uint8_t>> tiledCodestreams;
+        for (const char *path : paths)
+        {
+            codestreams.push_back(readFile(path));
+            HTJ2KDecoder decoder;
+            decoder.setEncodedBytes(codestreams.back().data(), codestreams.back().size());
+            decoder.decode();
+            HTJ2KEncoder encoder;
+            encoder.getDecodedBytes(decoder.getFrameInfo()) = decoder.getDecodedBytes();
+            encoder.setTileSize(Size(512, 512));
+            encoder.encode();
+            tiledCodestreams.push_back(encoder.getEncodedBytes());
+        }
+
+        printf("%-36s %14s %14s\n", "task overhead (samples)", "decode", "encode");
+        std::vector<double> overheads;
+        for (size_t i = 0; i < paths.size(); i++)
+        {
+            const std::vector<double> measured = measureTaskOverhead(tiledCodestreams[i], repetitions);
+            if (!measured.empty())
+            {
+                printf("%-36s %14.0f %14.0f\n", (std::string(paths[i]) + " 512x512").c_str(), measured[0], measured[1]);
+                overheads.insert(overheads.end(), measured.begin(), measured.end());
+            }
+        }
+        if (!overheads.empty())
+        {
+            std::sort(overheads.begin(), overheads.end());
+            const double calibrated = overheads[overheads.size() / 2];
+            printf("calibrated task overhead %.0f samples (default %d)\n", calibrated, 1 << 14);
+            scheduler.setTaskOverhead(calibrated);
+        }
+
+        printf("%-36s %6s %-6s %-5s %10s %6s\n", "batch", "jobs", "op", "mode", "ms", "split");
+
+        std::vector<const std::vector<uint8_t> *> corpus;
+        for (const std::vector<uint8_t> &codestream : codestreams)
+        {
+            corpus.push_back(&codestream);
+        }
+        bench(scheduler, "corpus", corpus, repetitions);
+        bench(scheduler, std::string(paths[0]) + " x64", std::vector<const std::vector<uint8_t> *>(64, &codestreams[0]), repetitions);
+
+        for (size_t i = 0; i < paths.size(); i++)
+        {
+            bench(scheduler, std::string(paths[i]) + " 512x512", std::vector<const std::vector<uint8_t> *>(1, &tiledCodestreams[i]), repetitions);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,84 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Decode and encode throughput over the j2c fixtures.  Used to compare
+// WASM builds:
+//   node benchmark.js [path to openjphjs.js] [iterations]
+const fs = require('fs')
+const path = require('path')
+
+const modulePath = path.resolve(process.argv[2] || path.join(__dirname, '../../dist/openjphjs.js'))
+const iterations = parseInt(process.argv[3] || '10')
+const fixturesPath = path.join(__dirname, '../fixtures/j2c')
+
+let openjphjs = require(modulePath);
+
+function seconds(hrtime) {
+  return hrtime[0] + hrtime[1] / 1000000000
+}
+
+function benchmark(encodedImagePath) {
+  const encodedBitStream = fs.readFileSync(encodedImagePath);
+  const decoder = new openjphjs.HTJ2KDecoder();
+  const encodedBuffer = decoder.getEncodedBuffer(encodedBitStream.length);
+  encodedBuffer.set(encodedBitStream);
+
+  const beginDecode = process.hrtime();
+  for(var i=0; i < iterations; i++) {
+    decoder.decode();
+  }
+  const decodeSeconds = seconds(process.hrtime(beginDecode)) / iterations
+  const frameInfo = decoder.getFrameInfo();
+
+  // re-encode the decoded pixels so encode sees the same corpus.  The
+  // decoded view is fetched after the encoder allocates because heap
+  // growth detaches previously returned views
+  const encoder = new openjphjs.HTJ2KEncoder();
+  const decodedBytes = encoder.getDecodedBuffer(frameInfo);
+  decodedBytes.set(decoder.getDecodedBuffer());
+  const beginEncode = process.hrtime();
+  for(var i=0; i < iterations; i++) {
+    encoder.encode();
+  }
+  const encodeSeconds = seconds(process.hrtime(beginEncode)) / iterations
+
+  encoder.delete();
+  decoder.delete();
+
+  const megaPixels = frameInfo.width * frameInfo.height / (1024 * 1024)
+  return { megaPixels, decodeSeconds, encodeSeconds }
+}
+
+// heap usage after an operation, older builds lack getHeapStatistics()
+function heapStatistics() {
+  if (!openjphjs.getHeapStatistics) {
+    return ''
+  }
+  const mb = (bytes) => (bytes / (1024 * 1024)).toFixed(1)
+  const statistics = openjphjs.getHeapStatistics()
+  if (statistics.highWater === undefined) {
+    return ' heap ' + mb(statistics.heapSize) + ' MB'
+  }
+  return ' heap ' + mb(statistics.heapSize) + ' MB, high water ' + mb(statistics.highWater) +
+    ' MB, in use ' + mb(statistics.inUse) + ' MB, free ' + mb(statistics.free) + ' MB'
+}
+
+openjphjs.onRuntimeInitialized = async _ => {
+  console.log('Benchmarking ' + modulePath + ' (' + iterations + ' iterations)')
+  let totalMegaPixels = 0, totalDecodeSeconds = 0, totalEncodeSeconds = 0
+  const fixtures = fs.readdirSync(fixturesPath).filter((name) => name.endsWith('.j2c')).sort()
+  for (const fixture of fixtures) {
+    const result = benchmark(path.join(fixturesPath, fixture))
+    totalMegaPixels += result.megaPixels
+    totalDecodeSeconds += result.decodeSeconds
+    totalEncodeSeconds += result.encodeSeconds
+    console.log(fixture.padEnd(16) +
+      ' decode ' + (result.megaPixels / result.decodeSeconds).toFixed(2).padStart(8) + ' MP/s' +
+      ' encode ' + (result.megaPixels / result.encodeSeconds).toFixed(2).padStart(8) + ' MP/s' +
+      heapStatistics())
+  }
+  console.log('TOTAL'.padEnd(16) +
+    ' decode ' + (totalMegaPixels / totalDecodeSeconds).toFixed(2).padStart(8) + ' MP/s' +
+    ' encode ' + (totalMegaPixels / totalEncodeSeconds).toFixed(2).padStart(8) + ' MP/s')
+  console.log('heap size ' + (openjphjs.HEAP8.length / (1024 * 1024)).toFixed(1) + ' MB')
+}
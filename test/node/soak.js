@@ -0,0 +1,165 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Long running soak benchmark for heap growth and fragmentation.  Streams
+// randomly sized synthetic frames through one HTJ2KEncoder and one
+// HTJ2KDecoder (the way a long lived viewer uses them) for the requested
+// number of minutes, sampling heap size, fragmentation and throughput.
+// The samples are written as CSV and charted on the console at the end.
+//
+//   node soak.js [minutes] [path to openjphjs.js] [csv output path]
+//
+// Set SOAK_FRESH=1 to create a new encoder/decoder for every frame and
+// SOAK_SEED to change the random frame sequence.
+const fs = require('fs')
+const path = require('path')
+
+const minutes = parseFloat(process.argv[2] || '5')
+const modulePath = path.resolve(process.argv[3] || path.join(__dirname, '../../dist/openjphjs.js'))
+const csvPath = process.argv[4] || 'soak.csv'
+const fresh = process.env.SOAK_FRESH === '1'
+const sampleIntervalMs = Math.max(1000, minutes * 60 * 1000 / 120)
+
+let openjphjs = require(modulePath);
+
+// small deterministic PRNG (mulberry32) so runs are comparable
+let seed = parseInt(process.env.SOAK_SEED || '1')
+function random() {
+  seed = (seed + 0x6D2B79F5) | 0
+  let t = Math.imul(seed ^ (seed >>> 15), 1 | seed)
+  t = (t + Math.imul(t ^ (t >>> 7), 61 | t)) ^ t
+  return ((t ^ (t >>> 14)) >>> 0) / 4294967296
+}
+
+function randomInt(min, max) {
+  return min + Math.floor(random() * (max - min + 1))
+}
+
+// mostly small frames (CT/MR sized) with the occasional large one, which is
+// the mix that fragments a heap the most
+function randomFrameInfo() {
+  const large = random() < 0.1
+  const width = large ? randomInt(1024, 4096) : randomInt(16, 1024)
+  const height = large ? randomInt(1024, 4096) : randomInt(16, 1024)
+  if (random() < 0.25) {
+    return { width, height, bitsPerSample: 8, componentCount: 3, isSigned: false, isUsingColorTransform: true }
+  }
+  const bitsPerSample = [8, 12, 16][randomInt(0, 2)]
+  return { width, height, bitsPerSample, componentCount: 1, isSigned: bitsPerSample > 8 && random() < 0.5, isUsingColorTransform: false }
+}
+
+// a gradient with some noise compresses like a real image
+function fillPixels(pixels, frameInfo) {
+  const samples = frameInfo.bitsPerSample > 8 ? new Int16Array(pixels.buffer, pixels.byteOffset, pixels.length / 2) : pixels
+  const maxValue = (1 << (frameInfo.bitsPerSample - (frameInfo.isSigned ? 1 : 0))) - 1
+  const rowLength = frameInfo.width * frameInfo.componentCount
+  for (let y = 0; y < frameInfo.height; y++) {
+    for (let x = 0; x < rowLength; x++) {
+      samples[y * rowLength + x] = ((x + y) * 7 + randomInt(0, 15)) % maxValue
+    }
+  }
+}
+
+function heapSample() {
+  const sample = { heapSize: openjphjs.HEAP8.length, inUse: undefined, free: undefined }
+  if (openjphjs.getHeapStatistics) {
+    const statistics = openjphjs.getHeapStatistics()
+    sample.inUse = statistics.inUse
+    sample.free = statistics.free
+  }
+  return sample
+}
+
+// ascii chart of one series over time
+function chart(title, values, unit) {
+  const height = 10
+  const width = Math.min(values.length, 100)
+  const step = values.length / width
+  const columns = []
+  for (let i = 0; i < width; i++) {
+    columns.push(values[Math.floor(i * step)])
+  }
+  const max = Math.max(...columns)
+  const min = Math.min(0, ...columns)
+  console.log('\n' + title + ' (' + min.toFixed(1) + ' - ' + max.toFixed(1) + ' ' + unit + ')')
+  for (let row = height; row > 0; row--) {
+    const threshold = min + (max - min) * (row - 0.5) / height
+    console.log('|' + columns.map((value) => value >= threshold ? '#' : ' ').join(''))
+  }
+  console.log('+' + '-'.repeat(width) + ' time')
+}
+
+function soak() {
+  const samples = []
+  const begin = Date.now()
+  const end = begin + minutes * 60 * 1000
+  let encoder = new openjphjs.HTJ2KEncoder()
+  let decoder = new openjphjs.HTJ2KDecoder()
+  let frames = 0, intervalMegaPixels = 0, mismatches = 0
+  let intervalBegin = Date.now()
+
+  console.log('Soaking ' + modulePath + ' for ' + minutes + ' minutes' + (fresh ? ' (fresh codecs per frame)' : ''))
+  while (Date.now() < end) {
+    if (fresh) {
+      encoder.delete()
+      decoder.delete()
+      encoder = new openjphjs.HTJ2KEncoder()
+      decoder = new openjphjs.HTJ2KDecoder()
+    }
+    const frameInfo = randomFrameInfo()
+    const pixels = encoder.getDecodedBuffer(frameInfo)
+    fillPixels(pixels, frameInfo)
+    // the heap can grow during encode/decode which detaches this view
+    const pixelsLength = pixels.length
+    const probe = pixels.slice(0, 64)
+    encoder.encode()
+
+    const encoded = encoder.getEncodedBuffer()
+    decoder.getEncodedBuffer(encoded.length).set(encoder.getEncodedBuffer())
+    decoder.decode()
+    const decoded = decoder.getDecodedBuffer()
+    if (decoded.length !== pixelsLength || probe.some((value, i) => decoded[i] !== value)) {
+      mismatches++
+    }
+
+    frames++
+    intervalMegaPixels += frameInfo.width * frameInfo.height / (1024 * 1024)
+    const now = Date.now()
+    if (now - intervalBegin >= sampleIntervalMs) {
+      const heap = heapSample()
+      const sample = {
+        seconds: (now - begin) / 1000,
+        frames,
+        megaPixelsPerSecond: intervalMegaPixels / ((now - intervalBegin) / 1000),
+        heapMB: heap.heapSize / (1024 * 1024),
+        inUseMB: heap.inUse === undefined ? '' : heap.inUse / (1024 * 1024),
+        // fraction of the heap the allocator holds as free blocks
+        fragmentation: heap.free === undefined ? '' : heap.free / heap.heapSize
+      }
+      samples.push(sample)
+      console.log(sample.seconds.toFixed(0).padStart(6) + 's frames ' + String(frames).padStart(7) +
+        ' ' + sample.megaPixelsPerSecond.toFixed(1).padStart(7) + ' MP/s heap ' + sample.heapMB.toFixed(1).padStart(7) + ' MB' +
+        (sample.fragmentation === '' ? '' : ' fragmentation ' + (sample.fragmentation * 100).toFixed(1) + '%'))
+      intervalBegin = now
+      intervalMegaPixels = 0
+    }
+  }
+  encoder.delete()
+  decoder.delete()
+
+  const columns = ['seconds', 'frames', 'megaPixelsPerSecond', 'heapMB', 'inUseMB', 'fragmentation']
+  fs.writeFileSync(csvPath, columns.join(',') + '\n' + samples.map((sample) => columns.map((column) => sample[column]).join(',')).join('\n') + '\n')
+
+  if (samples.length) {
+    chart('Heap size', samples.map((sample) => sample.heapMB), 'MB')
+    if (samples[0].fragmentation !== '') {
+      chart('Fragmentation', samples.map((sample) => sample.fragmentation * 100), '%')
+    }
+    chart('Throughput', samples.map((sample) => sample.megaPixelsPerSecond), 'MP/s')
+  }
+  console.log('\n' + frames + ' frames, ' + mismatches + ' round trip mismatches, samples written to ' + csvPath)
+}
+
+openjphjs.onRuntimeInitialized = async _ => {
+  soak()
+}
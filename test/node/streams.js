@@ -0,0 +1,120 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Tests for the Transform streams in openjphjs-streams.js: round trips the
+// fixtures through the encode and decode streams in ordered and unordered
+// mode and checks the in-flight bound with a slow consumer.
+//   node streams.js [path to openjphjs-streams.js] [path to openjphjs.js]
+const fs = require('fs')
+const path = require('path')
+const { pipeline, Readable, Writable } = require('stream')
+
+const streamsPath = path.resolve(process.argv[2] || path.join(__dirname, '../../dist/openjphjs-streams.js'))
+const modulePath = path.resolve(process.argv[3] || path.join(path.dirname(streamsPath), 'openjphjs.js'))
+const { WorkerPool, createEncodeStream, createDecodeStream } = require(streamsPath)
+const fixturesPath = path.join(__dirname, '../fixtures/j2c')
+
+let failures = 0
+function check(condition, what) {
+  console.log((condition ? 'OK    ' : 'ERROR ') + what)
+  failures += condition ? 0 : 1
+}
+
+function collect(source, transforms, delayMs = 0) {
+  const outputs = []
+  return new Promise((resolve, reject) => {
+    pipeline(Readable.from(source), ...transforms, new Writable({
+      objectMode: true,
+      highWaterMark: 1,
+      write(chunk, encoding, callback) {
+        outputs.push(chunk)
+        setTimeout(callback, delayMs)
+      }
+    }), (error) => error ? reject(error) : resolve(outputs))
+  })
+}
+
+async function main() {
+  const names = fs.readdirSync(fixturesPath).filter((name) => name.endsWith('.j2c')).sort()
+  const codestreams = names.map((name) => fs.readFileSync(path.join(fixturesPath, name)))
+
+  // decode, re-encode and decode again, the pixels must survive
+  const decoded = await collect(codestreams, [createDecodeStream({ modulePath, workers: 4 })])
+  check(decoded.length === codestreams.length, 'decode stream emits one frame per codestream')
+  const reencoded = await collect(decoded, [createEncodeStream({ modulePath, workers: 4 }), createDecodeStream({ modulePath, workers: 4 })])
+  check(reencoded.every((frame, i) => frame.pixels.equals(decoded[i].pixels)), 'ordered encode/decode round trip is lossless')
+
+  // unordered output carries every frame once, in any order
+  const frames = []
+  for (let i = 0; i < 40; i++) {
+    frames.push(codestreams[i % codestreams.length])
+  }
+  const unordered = await collect(frames, [createDecodeStream({ modulePath, workers: 4, ordered: false })])
+  const key = (frame) => frame.frameInfo.width + 'x' + frame.frameInfo.height + ':' + frame.pixels.length
+  const expected = frames.map((_, i) => key(decoded[i % codestreams.length])).sort()
+  check(JSON.stringify(unordered.map(key).sort()) === JSON.stringify(expected), 'unordered decode stream emits every frame')
+
+  // a slow consumer must hold the producer back: count frames pulled from
+  // the source that have not reached the consumer yet
+  let pulled = 0
+  let consumed = 0
+  let maxOutstanding = 0
+  const source = (function* () {
+    for (let i = 0; i < 60; i++) {
+      pulled++
+      maxOutstanding = Math.max(maxOutstanding, pulled - consumed)
+      yield codestreams[i % codestreams.length]
+    }
+  })()
+  const maxInFlight = 4
+  await new Promise((resolve, reject) => {
+    pipeline(Readable.from(source, { highWaterMark: 1 }), createDecodeStream({ modulePath, workers: 2, maxInFlight }), new Writable({
+      objectMode: true,
+      highWaterMark: 1,
+      write(chunk, encoding, callback) {
+        consumed++
+        setTimeout(callback, 5)
+      }
+    }), (error) => error ? reject(error) : resolve())
+  })
+  // in flight and emitted frames plus the stream buffers in between
+  check(consumed === 60 && maxOutstanding <= 3 * maxInFlight + 4, 'backpressure bounds the frames in the pipeline (max ' + maxOutstanding + ')')
+
+  // a shared pool serves several streams and survives their end
+  const pool = new WorkerPool({ modulePath, workers: 2 })
+  const first = await collect(codestreams.slice(0, 3), [createDecodeStream({ pool })])
+  const second = await collect(codestreams.slice(0, 3), [createDecodeStream({ pool })])
+  check(first.every((frame, i) => frame.pixels.equals(second[i].pixels)), 'streams share a pool')
+  // each stream's options apply on a shared pool
+  const reduced = await collect(codestreams.slice(0, 3), [createDecodeStream({ pool, decompositionLevel: 1 })])
+  check(reduced.every((frame, i) => frame.frameInfo.width === Math.ceil(first[i].frameInfo.width / 2)), 'decompositionLevel applies on a shared pool')
+  const lossy = await collect(first, [createEncodeStream({ pool, encoder: { lossless: false, quantizationStep: 0.1 } })])
+  const lossless = await collect(first, [createEncodeStream({ pool })])
+  check(lossy.every((encoded, i) => encoded.length < lossless[i].length), 'encoder settings apply on a shared pool')
+  await pool.close()
+
+  // bad input fails the stream instead of hanging it
+  let failed = false
+  try {
+    await collect([Buffer.from('not a codestream')], [createDecodeStream({ modulePath, workers: 1 })])
+  } catch (error) {
+    failed = true
+  }
+  check(failed, 'an invalid codestream fails the stream')
+
+  failed = false
+  try {
+    await collect([{ frameInfo: { width: 4, height: 4, bitsPerSample: 8, componentCount: 1 }, pixels: Buffer.alloc(3) }],
+                  [createEncodeStream({ modulePath, workers: 1 })])
+  } catch (error) {
+    failed = true
+  }
+  check(failed, 'a frame not matching its frameInfo fails the stream')
+
+  process.exitCode = failures ? 1 : 0
+}
+
+main().catch((error) => {
+  console.error(error)
+  process.exitCode = 1
+})
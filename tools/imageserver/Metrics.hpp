@@ -0,0 +1,127 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+/**
+ * Latency histogram in the Prometheus exposition format.  Buckets are
+ * cumulative when written, observations only touch one counter so
+ * recording is lock free.
+ */
+class LatencyHistogram
+{
+public:
+  static const size_t BucketCount = 14;
+
+  void observe(double seconds)
+  {
+    size_t bucket = 0;
+    while (bucket < BucketCount && seconds > bounds()[bucket])
+    {
+      bucket++;
+    }
+    counts_[bucket]++;
+    sumMicroseconds_ += (uint64_t)(seconds * 1e6);
+  }
+
+  /** Appends the _bucket, _sum and _count series for name{labels} */
+  void write(std::string &out, const std::string &name, const std::string &labels) const
+  {
+    char line[256];
+    uint64_t cumulative = 0;
+    const std::string separator = labels.empty() ? "" : ",";
+    for (size_t bucket = 0; bucket <= BucketCount; bucket++)
+    {
+      cumulative += counts_[bucket];
+      if (bucket < BucketCount)
+      {
+        snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"%g\"} %llu\n", name.c_str(), labels.c_str(), separator.c_str(), bounds()[bucket], (unsigned long long)cumulative);
+      }
+      else
+      {
+        snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name.c_str(), labels.c_str(), separator.c_str(), (unsigned long long)cumulative);
+      }
+      out += line;
+    }
+    snprintf(line, sizeof(line), "%s_sum{%s} %.6f\n%s_count{%s} %llu\n", name.c_str(), labels.c_str(), sumMicroseconds_ / 1e6, name.c_str(), labels.c_str(), (unsigned long long)cumulative);
+    out += line;
+  }
+
+private:
+  // upper bounds in seconds, the last bucket is +Inf
+  static const double *bounds()
+  {
+    static const double values[BucketCount] = {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+    return values;
+  }
+
+  std::atomic<uint64_t> counts_[BucketCount + 1] = {};
+  std::atomic<uint64_t> sumMicroseconds_{0};
+};
+
+/**
+ * Request counters and latency histograms per endpoint
+ */
+class Metrics
+{
+public:
+  enum Endpoint
+  {
+    Resolution,
+    Region,
+    Raw,
+    Info,
+    MetricsEndpoint,
+    Other,
+    EndpointCount
+  };
+
+  void recordRequest(Endpoint endpoint, int status, double seconds)
+  {
+    const size_t statusIndex = status < 300 ? 0 : status == 400 ? 1 : status == 404 ? 2 : status < 500 ? 3 : 4;
+    requests_[endpoint][statusIndex]++;
+    latency_[endpoint].observe(seconds);
+  }
+
+  void recordTileDecode(double seconds)
+  {
+    tileDecodes_.observe(seconds);
+  }
+
+  /** Appends the request counters and histograms */
+  void write(std::string &out) const
+  {
+    static const char *endpoints[EndpointCount] = {"resolution", "region", "raw", "info", "metrics", "other"};
+    static const char *statuses[5] = {"200", "400", "404", "4xx", "500"};
+    char line[256];
+    out += "# HELP imageserver_requests_total Requests by endpoint and status\n"
+           "# TYPE imageserver_requests_total counter\n";
+    for (size_t e = 0; e < EndpointCount; e++)
+    {
+      for (size_t s = 0; s < 5; s++)
+      {
+        snprintf(line, sizeof(line), "imageserver_requests_total{endpoint=\"%s\",status=\"%s\"} %llu\n", endpoints[e], statuses[s], (unsigned long long)requests_[e][s]);
+        out += line;
+      }
+    }
+    out += "# HELP imageserver_request_duration_seconds Request latency by endpoint\n"
+           "# TYPE imageserver_request_duration_seconds histogram\n";
+    for (size_t e = 0; e < EndpointCount; e++)
+    {
+      latency_[e].write(out, "imageserver_request_duration_seconds", std::string("endpoint=\"") + endpoints[e] + "\"");
+    }
+    out += "# HELP imageserver_tile_decode_duration_seconds Time to decode one tile on a cache miss\n"
+           "# TYPE imageserver_tile_decode_duration_seconds histogram\n";
+    tileDecodes_.write(out, "imageserver_tile_decode_duration_seconds", "");
+  }
+
+private:
+  std::atomic<uint64_t> requests_[EndpointCount][5] = {};
+  LatencyHistogram latency_[EndpointCount];
+  LatencyHistogram tileDecodes_;
+};
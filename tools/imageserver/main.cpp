@@ -0,0 +1,661 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Local HTTP image server for J2C/JPH files, built on HTJ2KDecoder.  It is
+// the reference deployment and load test target for the library and runs
+// entirely offline (POSIX sockets, no dependencies beyond OpenJPH).
+//
+//   imageserver <directory> [--port 8080] [--bind 127.0.0.1] [--threads N]
+//               [--tile-cache-mb 256] [--file-cache-mb 256]
+//
+// Endpoints (<file> is relative to the served directory):
+//   GET /info/<file>                          image and codestream layout as JSON
+//   GET /resolution/<file>?level=L            whole image at decomposition level L
+//   GET /region/<file>?x=&y=&w=&h=&level=L    area of the image at level L, the
+//                                             rectangle is in level L coordinates
+//   GET /raw/<file>                           main header bytes
+//   GET /raw/<file>?tile=N                    the tile-part bytes of tile N as
+//                                             located by the TLM index
+//   GET /metrics                              Prometheus text format metrics
+//
+// Pixel responses are the raw decoded samples (interleaved, little endian
+// for more than 8 bits) described by the X-Width, X-Height, X-Components,
+// X-Bits-Per-Sample and X-Signed headers.  Images are decoded tile by tile
+// (each tile cut out with CodestreamIndex and decoded with
+// decodeSubResolution) and the decoded tiles are kept in an LRU cache, so
+// regions only decode the tiles they touch.
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <errno.h>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+#include "../../src/CodestreamIndex.hpp"
+#include "../../src/HTJ2KDecoder.hpp"
+#include "../../src/LRUCache.hpp"
+#include "../../src/ThreadPool.hpp"
+#include "Metrics.hpp"
+
+namespace
+{
+  struct HttpError : std::runtime_error
+  {
+    HttpError(int status, const std::string &message) : std::runtime_error(message), status(status) {}
+    int status;
+  };
+
+  struct Request
+  {
+    std::string path;
+    std::map<std::string, std::string> query;
+  };
+
+  struct Response
+  {
+    int status = 200;
+    std::string contentType = "application/octet-stream";
+    std::vector<std::string> headers;
+    std::string body;
+  };
+
+  // an indexed codestream, the bytes are the codestream only (the JPH
+  // boxes around it are removed when loading)
+  struct ImageFile
+  {
+    std::vector<uint8_t> bytes;
+    CodestreamIndex index;
+    FrameInfo frameInfo;
+    size_t bytesPerPixel;
+  };
+
+  struct DecodedTile
+  {
+    std::vector<uint8_t> pixels;
+    Rect rect;
+  };
+
+  typedef std::tuple<std::string, uint32_t, uint32_t> TileKey;
+
+  struct Settings
+  {
+    std::string root;
+    std::string bind = "127.0.0.1";
+    int port = 8080;
+    size_t threads = 0;
+    size_t tileCacheBytes = 256 << 20;
+    size_t fileCacheBytes = 256 << 20;
+  };
+
+  volatile sig_atomic_t stopping = 0;
+
+  void onSignal(int)
+  {
+    stopping = 1;
+  }
+
+  std::string urlDecode(const std::string &text)
+  {
+    std::string result;
+    for (size_t i = 0; i < text.size(); i++)
+    {
+      if (text[i] == '%' && i + 2 < text.size())
+      {
+        result += (char)strtol(text.substr(i + 1, 2).c_str(), nullptr, 16);
+        i += 2;
+      }
+      else
+      {
+        result += text[i] == '+' ? ' ' : text[i];
+      }
+    }
+    return result;
+  }
+
+  uint32_t queryNumber(const Request &request, const std::string &name, uint32_t fallback, bool required = false)
+  {
+    auto it = request.query.find(name);
+    if (it == request.query.end())
+    {
+      if (required)
+      {
+        throw HttpError(400, "missing query parameter " + name);
+      }
+      return fallback;
+    }
+    char *end;
+    const unsigned long value = strtoul(it->second.c_str(), &end, 10);
+    if (it->second.empty() || *end != 0 || value > UINT32_MAX)
+    {
+      throw HttpError(400, "invalid query parameter " + name);
+    }
+    return (uint32_t)value;
+  }
+
+  // returns the offset and length of the codestream in a J2C or JPH file
+  void findCodestream(const std::vector<uint8_t> &bytes, size_t &offset, size_t &length)
+  {
+    offset = 0;
+    length = bytes.size();
+    if (bytes.size() >= 2 && bytes[0] == 0xFF && bytes[1] == 0x4F)
+    {
+      return;
+    }
+    // walk the top level boxes for the contiguous codestream box
+    while (offset + 8 <= bytes.size())
+    {
+      uint64_t boxLength = ((uint32_t)bytes[offset] << 24) | (bytes[offset + 1] << 16) | (bytes[offset + 2] << 8) | bytes[offset + 3];
+      size_t header = 8;
+      if (boxLength == 1 && offset + 16 <= bytes.size())
+      {
+        boxLength = 0;
+        for (size_t i = 0; i < 8; i++)
+        {
+          boxLength = (boxLength << 8) | bytes[offset + 8 + i];
+        }
+        header = 16;
+      }
+      else if (boxLength == 0)
+      {
+        boxLength = bytes.size() - offset;
+      }
+      if (boxLength < header || offset + boxLength > bytes.size())
+      {
+        break;
+      }
+      if (memcmp(&bytes[offset + 4], "jp2c", 4) == 0)
+      {
+        offset += header;
+        length = boxLength - header;
+        return;
+      }
+      offset += boxLength;
+    }
+    throw HttpError(400, "not a J2C codestream or JPH file");
+  }
+
+  class ImageServer
+  {
+  public:
+    explicit ImageServer(const Settings &settings)
+        : settings_(settings),
+          files_(settings.fileCacheBytes),
+          tiles_(settings.tileCacheBytes),
+          pool_(settings.threads)
+    {
+    }
+
+    void run()
+    {
+      const int listener = socket(AF_INET, SOCK_STREAM, 0);
+      const int enable = 1;
+      setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+      sockaddr_in address = {};
+      address.sin_family = AF_INET;
+      address.sin_port = htons((uint16_t)settings_.port);
+      if (inet_pton(AF_INET, settings_.bind.c_str(), &address.sin_addr) != 1 ||
+          bind(listener, (sockaddr *)&address, sizeof(address)) != 0 ||
+          listen(listener, 128) != 0)
+      {
+        throw std::runtime_error("cannot listen on " + settings_.bind + ":" + std::to_string(settings_.port) + ": " + strerror(errno));
+      }
+      printf("serving %s on http://%s:%d with %zu workers\n", settings_.root.c_str(), settings_.bind.c_str(), settings_.port, pool_.getThreadCount());
+      fflush(stdout);
+
+      while (!stopping)
+      {
+        const int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0)
+        {
+          continue;
+        }
+        pool_.post([this, connection] { serve_(connection); });
+      }
+      close(listener);
+    }
+
+  private:
+    void serve_(int connection)
+    {
+      timeval timeout = {10, 0};
+      setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+      std::string text;
+      char buffer[4096];
+      while (text.find("\r\n\r\n") == std::string::npos && text.size() < 16384)
+      {
+        const ssize_t received = recv(connection, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+        {
+          close(connection);
+          return;
+        }
+        text.append(buffer, received);
+      }
+
+      const auto start = std::chrono::steady_clock::now();
+      Metrics::Endpoint endpoint = Metrics::Other;
+      Response response;
+      try
+      {
+        const Request request = parse_(text);
+        response = route_(request, endpoint);
+      }
+      catch (const HttpError &error)
+      {
+        response.status = error.status;
+        response.contentType = "text/plain";
+        response.body = std::string(error.what()) + "\n";
+      }
+      catch (const std::exception &error)
+      {
+        response.status = 500;
+        response.contentType = "text/plain";
+        response.body = std::string(error.what()) + "\n";
+      }
+      send_(connection, response);
+      close(connection);
+      metrics_.recordRequest(endpoint, response.status, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    static Request parse_(const std::string &text)
+    {
+      const size_t methodEnd = text.find(' ');
+      const size_t targetEnd = text.find(' ', methodEnd + 1);
+      if (methodEnd == std::string::npos || targetEnd == std::string::npos)
+      {
+        throw HttpError(400, "malformed request");
+      }
+      if (text.compare(0, methodEnd, "GET") != 0)
+      {
+        throw HttpError(405, "only GET is supported");
+      }
+      const std::string target = text.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+      const size_t queryStart = target.find('?');
+      Request request;
+      request.path = urlDecode(target.substr(0, queryStart));
+      if (queryStart != std::string::npos)
+      {
+        size_t p = queryStart + 1;
+        while (p <= target.size())
+        {
+          size_t end = target.find('&', p);
+          end = end == std::string::npos ? target.size() : end;
+          const std::string pair = target.substr(p, end - p);
+          const size_t equals = pair.find('=');
+          request.query[urlDecode(pair.substr(0, equals))] = equals == std::string::npos ? "" : urlDecode(pair.substr(equals + 1));
+          p = end + 1;
+        }
+      }
+      return request;
+    }
+
+    Response route_(const Request &request, Metrics::Endpoint &endpoint)
+    {
+      static const struct
+      {
+        const char *prefix;
+        Metrics::Endpoint endpoint;
+      } routes[] = {
+          {"/resolution/", Metrics::Resolution},
+          {"/region/", Metrics::Region},
+          {"/raw/", Metrics::Raw},
+          {"/info/", Metrics::Info}};
+
+      if (request.path == "/metrics")
+      {
+        endpoint = Metrics::MetricsEndpoint;
+        return metricsResponse_();
+      }
+      for (const auto &route : routes)
+      {
+        const size_t prefixLength = strlen(route.prefix);
+        if (request.path.compare(0, prefixLength, route.prefix) != 0)
+        {
+          continue;
+        }
+        endpoint = route.endpoint;
+        std::shared_ptr<const ImageFile> file = load_(request.path.substr(prefixLength));
+        switch (endpoint)
+        {
+        case Metrics::Resolution:
+          return resolution_(request, *file, request.path.substr(prefixLength));
+        case Metrics::Region:
+          return region_(request, *file, request.path.substr(prefixLength));
+        case Metrics::Raw:
+          return raw_(request, *file);
+        default:
+          return info_(*file);
+        }
+      }
+      throw HttpError(404, "unknown endpoint " + request.path);
+    }
+
+    std::shared_ptr<const ImageFile> load_(const std::string &name)
+    {
+      // names are relative and may not leave the served directory
+      if (name.empty() || name[0] == '/' || name == ".." || name.compare(0, 3, "../") == 0 ||
+          name.find("/../") != std::string::npos || (name.size() >= 3 && name.compare(name.size() - 3, 3, "/..") == 0))
+      {
+        throw HttpError(400, "invalid file name");
+      }
+      std::shared_ptr<const ImageFile> cached = files_.get(name);
+      if (cached)
+      {
+        return cached;
+      }
+
+      std::ifstream stream(settings_.root + "/" + name, std::ios::in | std::ios::binary);
+      if (!stream)
+      {
+        throw HttpError(404, "file not found: " + name);
+      }
+      std::shared_ptr<ImageFile> file = std::make_shared<ImageFile>();
+      file->bytes.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+      size_t offset, length;
+      findCodestream(file->bytes, offset, length);
+      file->bytes.erase(file->bytes.begin() + offset + length, file->bytes.end());
+      file->bytes.erase(file->bytes.begin(), file->bytes.begin() + offset);
+      file->index.parse(file->bytes.data(), file->bytes.size());
+
+      // sample format from the first tile, which is small even for
+      // huge tiled images
+      HTJ2KDecoder decoder;
+      file->index.extractTile(file->bytes.data(), file->bytes.size(), 0, decoder.getEncodedBytes());
+      decoder.readHeader();
+      file->frameInfo = decoder.getFrameInfo();
+      const Size size = file->index.getImageSize();
+      if (size.width > USHRT_MAX || size.height > USHRT_MAX)
+      {
+        throw HttpError(400, "image dimensions exceed the supported range");
+      }
+      file->frameInfo.width = (uint16_t)size.width;
+      file->frameInfo.height = (uint16_t)size.height;
+      file->bytesPerPixel = file->frameInfo.componentCount * ((file->frameInfo.bitsPerSample + 8 - 1) / 8);
+      files_.put(name, file, file->bytes.size());
+      return file;
+    }
+
+    std::shared_ptr<const DecodedTile> decodeTile_(const ImageFile &file, const std::string &name, uint32_t tileIndex, uint32_t level)
+    {
+      const TileKey key(name, level, tileIndex);
+      std::shared_ptr<const DecodedTile> cached = tiles_.get(key);
+      if (cached)
+      {
+        return cached;
+      }
+
+      // concurrent misses on the same tile both decode it, the second
+      // put simply replaces the first
+      const auto start = std::chrono::steady_clock::now();
+      thread_local HTJ2KDecoder decoder;
+      std::shared_ptr<DecodedTile> tile = std::make_shared<DecodedTile>();
+      file.index.extractTile(file.bytes.data(), file.bytes.size(), tileIndex, decoder.getEncodedBytes());
+      decoder.setDecodedBytes(&tile->pixels);
+      try
+      {
+        decoder.decodeSubResolution(level);
+      }
+      catch (...)
+      {
+        decoder.setDecodedBytes(0);
+        throw;
+      }
+      decoder.setDecodedBytes(0);
+      tile->rect = file.index.getTileRect(tileIndex, level);
+      if (tile->pixels.size() != (size_t)tile->rect.width * tile->rect.height * file.bytesPerPixel)
+      {
+        throw std::runtime_error("decoded tile " + std::to_string(tileIndex) + " does not match the tile size");
+      }
+      metrics_.recordTileDecode(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+      tiles_.put(key, tile, tile->pixels.size());
+      return tile;
+    }
+
+    // decodes the tiles intersecting rect and copies their pixels into
+    // the response body
+    Response pixels_(const ImageFile &file, const std::string &name, const Rect &rect, uint32_t level)
+    {
+      Response response;
+      const std::vector<uint32_t> tileIndices = file.index.getTilesInRect(rect, level);
+      const size_t rowBytes = (size_t)rect.width * file.bytesPerPixel;
+      response.body.resize(rowBytes * rect.height);
+      for (uint32_t tileIndex : tileIndices)
+      {
+        std::shared_ptr<const DecodedTile> tile = decodeTile_(file, name, tileIndex, level);
+        const uint32_t x0 = std::max(rect.x, tile->rect.x);
+        const uint32_t y0 = std::max(rect.y, tile->rect.y);
+        const uint32_t x1 = std::min(rect.x + rect.width, tile->rect.x + tile->rect.width);
+        const uint32_t y1 = std::min(rect.y + rect.height, tile->rect.y + tile->rect.height);
+        for (uint32_t y = y0; y < y1; y++)
+        {
+          memcpy(&response.body[(y - rect.y) * rowBytes + (x0 - rect.x) * file.bytesPerPixel],
+                 &tile->pixels[((size_t)(y - tile->rect.y) * tile->rect.width + (x0 - tile->rect.x)) * file.bytesPerPixel],
+                 (x1 - x0) * file.bytesPerPixel);
+        }
+      }
+      response.headers.push_back("X-Width: " + std::to_string(rect.width));
+      response.headers.push_back("X-Height: " + std::to_string(rect.height));
+      response.headers.push_back("X-Components: " + std::to_string(file.frameInfo.componentCount));
+      response.headers.push_back("X-Bits-Per-Sample: " + std::to_string(file.frameInfo.bitsPerSample));
+      response.headers.push_back(std::string("X-Signed: ") + (file.frameInfo.isSigned ? "true" : "false"));
+      response.headers.push_back("X-Tiles: " + std::to_string(tileIndices.size()));
+      return response;
+    }
+
+    static uint32_t level_(const Request &request, const ImageFile &file)
+    {
+      const uint32_t level = queryNumber(request, "level", 0);
+      if (level > file.index.getNumDecompositions())
+      {
+        throw HttpError(400, "level must be at most " + std::to_string(file.index.getNumDecompositions()));
+      }
+      return level;
+    }
+
+    Response resolution_(const Request &request, const ImageFile &file, const std::string &name)
+    {
+      const uint32_t level = level_(request, file);
+      const Size size = file.index.getSizeAtDecompositionLevel(level);
+      return pixels_(file, name, Rect(0, 0, size.width, size.height), level);
+    }
+
+    Response region_(const Request &request, const ImageFile &file, const std::string &name)
+    {
+      const uint32_t level = level_(request, file);
+      const Size size = file.index.getSizeAtDecompositionLevel(level);
+      Rect rect(queryNumber(request, "x", 0, true), queryNumber(request, "y", 0, true),
+                queryNumber(request, "w", 0, true), queryNumber(request, "h", 0, true));
+      if (rect.x >= size.width || rect.y >= size.height || rect.width == 0 || rect.height == 0)
+      {
+        throw HttpError(400, "region is outside the " + std::to_string(size.width) + "x" + std::to_string(size.height) + " image");
+      }
+      rect.width = std::min(rect.width, size.width - rect.x);
+      rect.height = std::min(rect.height, size.height - rect.y);
+      return pixels_(file, name, rect, level);
+    }
+
+    static Response raw_(const Request &request, const ImageFile &file)
+    {
+      Response response;
+      response.headers.push_back(std::string("X-Indexed-From: ") + (file.index.isIndexedFromTLM() ? "TLM" : "SOT"));
+      if (request.query.count("tile") == 0)
+      {
+        response.body.assign(file.bytes.begin(), file.bytes.begin() + file.index.getMainHeaderLength());
+        return response;
+      }
+      const uint32_t tileIndex = queryNumber(request, "tile", 0);
+      if (tileIndex >= file.index.getTileCount())
+      {
+        throw HttpError(400, "tile must be less than " + std::to_string(file.index.getTileCount()));
+      }
+      std::string ranges;
+      for (const TilePart &part : file.index.getTileParts(tileIndex))
+      {
+        response.body.append((const char *)&file.bytes[part.offset], part.length);
+        ranges += (ranges.empty() ? "" : ",") + std::to_string(part.offset) + "-" + std::to_string(part.offset + part.length - 1);
+      }
+      response.headers.push_back("X-Tile-Parts: " + ranges);
+      return response;
+    }
+
+    static Response info_(const ImageFile &file)
+    {
+      const CodestreamIndex &index = file.index;
+      char json[512];
+      snprintf(json, sizeof(json),
+               "{\"width\":%u,\"height\":%u,\"componentCount\":%u,\"bitsPerSample\":%u,\"isSigned\":%s,"
+               "\"numDecompositions\":%u,\"tileWidth\":%u,\"tileHeight\":%u,\"tilesX\":%u,\"tilesY\":%u,"
+               "\"hasTLM\":%s,\"bytes\":%zu}\n",
+               file.frameInfo.width, file.frameInfo.height, file.frameInfo.componentCount, file.frameInfo.bitsPerSample,
+               file.frameInfo.isSigned ? "true" : "false", index.getNumDecompositions(),
+               index.getTileSize().width, index.getTileSize().height, index.getTilesX(), index.getTilesY(),
+               index.hasTLM() ? "true" : "false", file.bytes.size());
+      Response response;
+      response.contentType = "application/json";
+      response.body = json;
+      return response;
+    }
+
+    template <typename Statistics>
+    static void writeCacheStatistics_(std::string &out, const char *name, const Statistics &statistics)
+    {
+      char line[512];
+      snprintf(line, sizeof(line),
+               "imageserver_%s_cache_hits_total %llu\nimageserver_%s_cache_misses_total %llu\n"
+               "imageserver_%s_cache_evictions_total %llu\nimageserver_%s_cache_entries %zu\n"
+               "imageserver_%s_cache_bytes %zu\nimageserver_%s_cache_budget_bytes %zu\n",
+               name, (unsigned long long)statistics.hits, name, (unsigned long long)statistics.misses,
+               name, (unsigned long long)statistics.evictions, name, statistics.entries,
+               name, statistics.cost, name, statistics.budget);
+      out += line;
+    }
+
+    Response metricsResponse_()
+    {
+      Response response;
+      response.contentType = "text/plain; version=0.0.4";
+      metrics_.write(response.body);
+      writeCacheStatistics_(response.body, "tile", tiles_.getStatistics());
+      writeCacheStatistics_(response.body, "file", files_.getStatistics());
+      char line[256];
+      snprintf(line, sizeof(line), "imageserver_workers %zu\nimageserver_worker_queue_depth %zu\n", pool_.getThreadCount(), pool_.getQueueDepth());
+      response.body += line;
+      return response;
+    }
+
+    static void send_(int connection, const Response &response)
+    {
+      static const std::map<int, const char *> reasons = {
+          {200, "OK"}, {400, "Bad Request"}, {404, "Not Found"}, {405, "Method Not Allowed"}, {500, "Internal Server Error"}};
+      auto reason = reasons.find(response.status);
+      std::string header = "HTTP/1.1 " + std::to_string(response.status) + " " + (reason == reasons.end() ? "Error" : reason->second) + "\r\n" +
+                           "Content-Type: " + response.contentType + "\r\n" +
+                           "Content-Length: " + std::to_string(response.body.size()) + "\r\n" +
+                           "Connection: close\r\n";
+      for (const std::string &line : response.headers)
+      {
+        header += line + "\r\n";
+      }
+      header += "\r\n";
+      const std::string *parts[] = {&header, &response.body};
+      for (const std::string *part : parts)
+      {
+        size_t sent = 0;
+        while (sent < part->size())
+        {
+          const ssize_t result = ::send(connection, part->data() + sent, part->size() - sent, MSG_NOSIGNAL);
+          if (result <= 0)
+          {
+            return;
+          }
+          sent += result;
+        }
+      }
+    }
+
+    Settings settings_;
+    Metrics metrics_;
+    LRUCache<std::string, ImageFile> files_;
+    LRUCache<TileKey, DecodedTile> tiles_;
+    ThreadPool pool_;
+  };
+}
+
+int main(int argc, char **argv)
+{
+  Settings settings;
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string argument = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (argument == "--port" && hasValue)
+    {
+      settings.port = atoi(argv[++i]);
+    }
+    else if (argument == "--bind" && hasValue)
+    {
+      settings.bind = argv[++i];
+    }
+    else if (argument == "--threads" && hasValue)
+    {
+      settings.threads = (size_t)atoi(argv[++i]);
+    }
+    else if (argument == "--tile-cache-mb" && hasValue)
+    {
+      settings.tileCacheBytes = (size_t)atoi(argv[++i]) << 20;
+    }
+    else if (argument == "--file-cache-mb" && hasValue)
+    {
+      settings.fileCacheBytes = (size_t)atoi(argv[++i]) << 20;
+    }
+    else if (settings.root.empty() && argument[0] != '-')
+    {
+      settings.root = argument;
+    }
+    else
+    {
+      settings.root.clear();
+      break;
+    }
+  }
+  if (settings.root.empty())
+  {
+    fprintf(stderr, "usage: imageserver <directory> [--port 8080] [--bind 127.0.0.1] [--threads N] [--tile-cache-mb 256] [--file-cache-mb 256]\n");
+    return 1;
+  }
+
+  // no SA_RESTART so accept() returns when interrupted and the queued
+  // requests are finished before exiting
+  struct sigaction action = {};
+  action.sa_handler = onSignal;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  try
+  {
+    ImageServer server(settings);
+    server.run();
+  }
+  catch (const std::exception &error)
+  {
+    fprintf(stderr, "imageserver: %s\n", error.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,253 @@
+// Copyright (c) Chris Hafey.
+// SPDX-License-Identifier: MIT
+
+// Builds and prints sidecar metadata indexes (src/SidecarIndex.hpp) for
+// archives of J2C/JPH files and frame containers.  Only the main header of
+// each codestream is read, so scanning costs one or two pages per frame,
+// and later metadata queries read the index instead of the archive.
+//
+//   sidecarindex scan <index> <file or directory>...
+//   sidecarindex dump <index>
+//
+// scan walks the directories recursively in name order.  Files starting
+// with a codestream (FF4F) get one record, JPH files one record for their
+// codestream box, frame containers one record per frame.  Other files are
+// skipped.  dump prints the records as CSV.
+
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../../src/FrameContainer.hpp"
+#include "../../src/SidecarIndex.hpp"
+
+namespace
+{
+  struct ScanStatistics
+  {
+    size_t files = 0;
+    size_t skipped = 0;
+    size_t failed = 0;
+  };
+
+  // read only mapping of a whole file, unmapped when destroyed
+  class MappedFile
+  {
+  public:
+    explicit MappedFile(const std::string &path)
+    {
+      const int fd = ::open(path.c_str(), O_RDONLY);
+      struct stat status;
+      if (fd < 0 || fstat(fd, &status) != 0)
+      {
+        if (fd >= 0)
+        {
+          ::close(fd);
+        }
+        throw std::runtime_error("cannot open " + path);
+      }
+      size_ = (size_t)status.st_size;
+      void *mapping = size_ ? mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+      ::close(fd);
+      if (mapping == MAP_FAILED)
+      {
+        throw std::runtime_error("cannot map " + path);
+      }
+      data_ = (const uint8_t *)mapping;
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+      if (data_)
+      {
+        munmap((void *)data_, size_);
+      }
+    }
+
+    const uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+
+  private:
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+  };
+
+  // offset and length of the contiguous codestream box of a JPH file,
+  // false if there is none
+  bool findCodestreamBox(const uint8_t *data, size_t size, uint64_t &offset, uint64_t &length)
+  {
+    using FrameContainerFormat::readBigEndian;
+    uint64_t p = 0;
+    while (p + 8 <= size)
+    {
+      uint64_t boxLength = readBigEndian(data + p, 4);
+      uint64_t header = 8;
+      if (boxLength == 1 && p + 16 <= size)
+      {
+        boxLength = readBigEndian(data + p + 8, 8);
+        header = 16;
+      }
+      else if (boxLength == 0)
+      {
+        boxLength = size - p;
+      }
+      if (boxLength < header || boxLength > size - p)
+      {
+        return false;
+      }
+      if (memcmp(data + p + 4, "jp2c", 4) == 0)
+      {
+        offset = p + header;
+        length = boxLength - header;
+        return true;
+      }
+      p += boxLength;
+    }
+    return false;
+  }
+
+  void scanFile(SidecarIndexWriter &writer, const std::string &path, ScanStatistics &statistics)
+  {
+    try
+    {
+      MappedFile file(path);
+      const uint8_t *data = file.data();
+      const size_t size = file.size();
+      uint64_t offset = 0;
+      uint64_t length = 0;
+      if (size >= 8 && memcmp(data, FrameContainerFormat::HeaderMagic, 8) == 0)
+      {
+        FrameContainerReader container;
+        container.open(data, size);
+        const uint32_t pathIndex = writer.addPath(path);
+        for (size_t frame = 0; frame < container.getFrameCount(); frame++)
+        {
+          writer.addCodestream(pathIndex, (uint32_t)frame, container.getFrame(frame) - data, container.getFrame(frame), container.getFrameSize(frame));
+        }
+      }
+      else if (size >= 2 && data[0] == 0xFF && data[1] == 0x4F)
+      {
+        writer.addCodestream(writer.addPath(path), 0, 0, data, size);
+      }
+      else if (size >= 12 && memcmp(data + 4, "jP  ", 4) == 0 && findCodestreamBox(data, size, offset, length))
+      {
+        writer.addCodestream(writer.addPath(path), 0, offset, data + offset, (size_t)length);
+      }
+      else
+      {
+        statistics.skipped++;
+        return;
+      }
+      statistics.files++;
+    }
+    catch (const std::exception &e)
+    {
+      fprintf(stderr, "%s: %s\n", path.c_str(), e.what());
+      statistics.failed++;
+    }
+  }
+
+  void scan(SidecarIndexWriter &writer, const std::string &path, ScanStatistics &statistics)
+  {
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0)
+    {
+      fprintf(stderr, "%s: not found\n", path.c_str());
+      statistics.failed++;
+      return;
+    }
+    if (!S_ISDIR(status.st_mode))
+    {
+      scanFile(writer, path, statistics);
+      return;
+    }
+    DIR *directory = opendir(path.c_str());
+    if (!directory)
+    {
+      fprintf(stderr, "%s: cannot read directory\n", path.c_str());
+      statistics.failed++;
+      return;
+    }
+    std::vector<std::string> names;
+    while (const dirent *entry = readdir(directory))
+    {
+      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+      {
+        names.push_back(entry->d_name);
+      }
+    }
+    closedir(directory);
+    std::sort(names.begin(), names.end());
+    const std::string prefix = path.back() == '/' ? path : path + "/";
+    for (const std::string &name : names)
+    {
+      scan(writer, prefix + name, statistics);
+    }
+  }
+
+  void dump(const SidecarIndexReader &reader)
+  {
+    printf("path,frame,offset,length,width,height,components,bitsPerSample,signed,colorTransform,"
+           "reversible,decompositions,progressionOrder,layers,tileWidth,tileHeight,blockWidth,blockHeight\n");
+    for (size_t i = 0; i < reader.getRecordCount(); i++)
+    {
+      const SidecarRecord record = reader.getRecord(i);
+      printf("%s,%u,%llu,%llu,%u,%u,%u,%u,%d,%d,%d,%u,%u,%u,%u,%u,%u,%u\n",
+             reader.getPath(record.pathIndex).c_str(), record.frameIndex,
+             (unsigned long long)record.offset, (unsigned long long)record.length,
+             record.imageSize.width, record.imageSize.height, record.componentCount, record.bitsPerSample,
+             record.isSigned, record.isUsingColorTransform, record.isReversible,
+             record.numDecompositions, record.progressionOrder, record.numLayers,
+             record.tileSize.width, record.tileSize.height,
+             record.blockDimensions.width, record.blockDimensions.height);
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  const std::string command = argc > 1 ? argv[1] : "";
+  try
+  {
+    if (command == "scan" && argc > 3)
+    {
+      SidecarIndexWriter writer;
+      writer.create(argv[2]);
+      ScanStatistics statistics;
+      for (int i = 3; i < argc; i++)
+      {
+        scan(writer, argv[i], statistics);
+      }
+      writer.close();
+      printf("%llu codestreams from %zu files, %zu skipped, %zu failed\n",
+             (unsigned long long)writer.getRecordCount(), statistics.files, statistics.skipped, statistics.failed);
+      return statistics.failed ? 2 : 0;
+    }
+    if (command == "dump" && argc == 3)
+    {
+      SidecarIndexReader reader;
+      reader.open(argv[2]);
+      dump(reader);
+      return 0;
+    }
+  }
+  catch (const std::exception &e)
+  {
+    fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  fprintf(stderr, "usage: sidecarindex scan <index> <file or directory>...\n"
+                  "       sidecarindex dump <index>\n");
+  return 1;
+}